@@ -24,9 +24,10 @@
 using namespace Ds;
 
 AnnotMdl::AnnotMdl(QObject *parent)
-	: QAbstractItemModel(parent), d_sorted( false )
+	: QAbstractItemModel(parent), d_sorted( false ), d_batchDirty( false )
 {
 	AppContext::inst()->getDb()->addObserver( this, SLOT(onDbUpdate( Sdb::UpdateInfo )));
+	connect( AppContext::inst(), SIGNAL(batchFinished()), this, SLOT(onBatchFinished()) );
 }
 
 AnnotMdl::~AnnotMdl()
@@ -34,57 +35,98 @@ AnnotMdl::~AnnotMdl()
 	clearAll();
 }
 
+static QByteArray _head( const Sdb::Obj& o, Sdb::Database* db )
+{
+	QByteArray head = TypeDefs::getPrettyName( o.getValue( AttrAnnAttr ).getAtom(), db );
+	if( head.isEmpty() )
+		head = TypeDefs::getPrettyName( o.getOwner().getType(), db );
+	return head;
+}
+
 QModelIndex AnnotMdl::prependAnnot( quint64 id )
 {
 	if( d_obj.isNull() )
 		return QModelIndex();
-	Sdb::Obj o = d_obj.getTxn()->getObject( id );
-	if( o.getType() == TypeAnnotation )
-	{
-		beginInsertRows( QModelIndex(), 0, 0 );
-		d_rows.prepend( new Slot( o ) );
-		endInsertRows();
-		return index( 0, 0, index( 0, 0 ) );
-	}
+	int row = find( id ); // evtl. bereits ber onDbUpdate eingefgt
+	if( row == -1 )
+		row = insertAnnot( d_obj.getTxn()->getObject( id ) );
+	if( row != -1 )
+		return index( 0, 0, index( row, 0 ) );
 	else
 		return QModelIndex();
 }
 
+int AnnotMdl::insertAnnot( const Sdb::Obj& o )
+{
+	if( o.getType() != TypeAnnotation )
+		return -1;
+	int row = 0;
+	if( d_sorted )
+	{
+		// Wie in refill: nach Kopf sortiert, gleiche Kpfe in Einfgereihenfolge
+		const QByteArray head = _head( o, d_obj.getDb() );
+		row = d_rows.size();
+		for( int i = 0; i < d_rows.size(); i++ )
+		{
+			if( head < _head( d_rows[i]->d_obj, d_obj.getDb() ) )
+			{
+				row = i;
+				break;
+			}
+		}
+	}
+	beginInsertRows( QModelIndex(), row, row );
+	d_rows.insert( row, new Slot( o ) );
+	endInsertRows();
+	return row;
+}
+
+void AnnotMdl::removeAnnot( int row )
+{
+	beginRemoveRows( QModelIndex(), row, row );
+	delete d_rows[row];
+	d_rows.removeAt( row );
+	endRemoveRows();
+}
+
 void AnnotMdl::onDbUpdate( Sdb::UpdateInfo info )
 {
 	if( d_obj.isNull() )
 		return;
 	switch( info.d_kind )
 	{
-	/*
 	case Sdb::UpdateInfo::Aggregated:
-		if( info.d_id2 == d_obj.getId() )
 		{
-			if( d_obj.getTxn()->getObject( info.d_id ).getType() == TypeAnnotation )
+			const int row = find( info.d_id );
+			if( AppContext::inst()->isBatch() )
 			{
-				beginInsertRows( QModelIndex(), 0, 0 );
-				d_rows.prepend( info.d_id );
-				endInsertRows();
-			}
+				// Einzeln sortiert einfuegen waere quadratisch; einmal refill bei batchFinished
+				if( info.d_id2 == d_obj.getId() || row != -1 )
+					d_batchDirty = true;
+			}else if( info.d_id2 == d_obj.getId() )
+			{
+				if( row == -1 )
+					insertAnnot( d_obj.getTxn()->getObject( info.d_id ) );
+			}else if( row != -1 )
+				removeAnnot( row ); // verschoben
 		}
 		break;
-		*/
 	case Sdb::UpdateInfo::ObjectErased:
+		if( info.d_id == d_obj.getId() )
+			setObj( Sdb::Obj() );
+		else
 		{
 			const int row = find( info.d_id );
 			if( row != -1 && row < d_rows.size() )
-			{
-				beginRemoveRows( QModelIndex(), row, row );
-				delete d_rows[row];
-				d_rows.removeAt( row );
-				endRemoveRows();
-			}
+				removeAnnot( row );
 		}
 		break;
 	case Sdb::UpdateInfo::ValueChanged:
 		{
 			const int row = find( info.d_id );
-			if( row != -1 && row < d_rows.size() )
+			if( row != -1 && row < d_rows.size() && AppContext::inst()->isBatch() )
+				d_batchDirty = true;
+			else if( row != -1 && row < d_rows.size() )
 			{
 				QModelIndex i = index( row, 0 );
 				if( info.d_name == AttrAnnText )
@@ -100,6 +142,14 @@ void AnnotMdl::onDbUpdate( Sdb::UpdateInfo info )
 	}
 }
 
+void AnnotMdl::onBatchFinished()
+{
+	if( !d_batchDirty )
+		return;
+	d_batchDirty = false;
+	refill();
+}
+
 int AnnotMdl::find( quint64 id ) const
 {
 	for( int i = 0; i < d_rows.size(); i++ )
@@ -143,12 +193,7 @@ void AnnotMdl::refill()
 		if( !o.isNull() ) do
 		{
 			if( o.getType() == TypeAnnotation )
-			{
-				QByteArray head = TypeDefs::getPrettyName( o.getValue( AttrAnnAttr ).getAtom(), d_obj.getDb() );
-				if( head.isEmpty() )
-					head = TypeDefs::getPrettyName( o.getOwner().getType(), d_obj.getDb() );
-				order.insert( head, o );
-			}
+				order.insert( _head( o, d_obj.getDb() ), o );
 		}while( o.next() );
 		QMultiMap<QByteArray, Sdb::Obj>::const_iterator i;
 		for( i = order.begin(); i != order.end(); ++i )
@@ -234,10 +279,7 @@ QVariant AnnotMdl::data ( const QModelIndex & idx, int role ) const
 			if( idx.internalPointer() == 0 )
 			{
 				Sdb::Obj o = d_rows[idx.row()]->d_obj;
-				QByteArray head = TypeDefs::getPrettyName( o.getValue( AttrAnnAttr ).getAtom(),
-					d_obj.getDb() );
-				if( head.isEmpty() )
-					head = TypeDefs::getPrettyName( o.getOwner().getType(), d_obj.getDb() );
+				const QByteArray head = _head( o, d_obj.getDb() );
 				return QString( "%1: [%2] %3 %4" ).arg( head.data() ).
 					arg( o.getValue( AttrAnnNr ).getUInt32() ).
 					arg( TypeDefs::formatDate( o.getValue( AttrModifiedOn ).getDateTime() ) ).
@@ -63,9 +63,12 @@ namespace Ds
 		bool setData ( const QModelIndex & index, const QVariant & value, int role );
 	protected slots:
 		void onDbUpdate( Sdb::UpdateInfo );
+		void onBatchFinished();
 	private:
 		void clearAll();
 		int find( quint64 ) const; // row oder -1
+		int insertAnnot( const Sdb::Obj& ); // row oder -1
+		void removeAnnot( int row );
 		Sdb::Obj d_obj;
 		struct Slot
 		{
@@ -75,6 +78,7 @@ namespace Ds
 		};
 		QList<Slot*> d_rows;
 		bool d_sorted;
+		bool d_batchDirty; // refill bis AppContext::batchFinished zurueckgestellt
 	};
 }
 
@@ -27,6 +27,7 @@
 #include <QMessageBox>
 #include "Exceptions.h"
 #include "LuaBinding.h"
+#include "Compactor.h"
 #include <Qtl2/Objects.h>
 #include <Qtl2/Variant.h>
 #include <Script2/QtObject.h>
@@ -65,7 +66,7 @@ const char* AppContext::s_about =
 
 
 AppContext::AppContext(QObject *parent)
-	: QObject(parent),d_db(0),d_txn(0)
+	: QObject(parent),d_db(0),d_txn(0),d_batch(0)
 {
 	s_inst = this;
 	qApp->setOrganizationName( s_company );
@@ -129,12 +130,16 @@ bool AppContext::open( QString path )
 {
 	if( !path.toLower().endsWith( QLatin1String( ".dsdb" ) ) )
 		path += QLatin1String( ".dsdb" );
+	QString msg;
+	if( Compactor::applyPending( path, msg ) )
+		QMessageBox::information( 0, tr("Create/Open Repository"), msg );
 	d_db = new Database( this );
 	try
 	{
 		d_db->open( path );
 		d_txn = new Transaction( d_db, this );
 		TypeDefs::init( *d_db );
+		TypeDefs::setPacking( d_set->value( "Repository/PackLargeValues", true ).toBool() );
 		d_root = d_txn->getObject( QUuid( s_rootUuid ) );
 		if( d_root.isNull() )
 			d_root = d_txn->createObject(QUuid( s_rootUuid ));
@@ -191,6 +196,19 @@ QString AppContext::askUserName( QWidget* p, bool override )
 	return user;
 }
 
+void AppContext::beginBatch()
+{
+	d_batch++;
+}
+
+void AppContext::endBatch()
+{
+	Q_ASSERT( d_batch > 0 );
+	d_batch--;
+	if( d_batch == 0 )
+		emit batchFinished();
+}
+
 QString AppContext::getIndexPath() const
 {
 	if( d_db == 0 )
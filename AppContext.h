@@ -59,6 +59,13 @@ namespace Ds
 		QSettings* getSet() const { return d_set; }
 		void setDocFont( const QFont& );
 		QString getIndexPath() const;
+		// Sammelklammer fuer Massenaenderungen; Observer stellen ihre Einzelupdates zurueck
+		// und aktualisieren bei batchFinished einmal. Verschachtelbar, nur im GUI-Thread.
+		void beginBatch();
+		void endBatch();
+		bool isBatch() const { return d_batch > 0; }
+	signals:
+		void batchFinished();
 	private:
 		Sdb::Database* d_db;
 		Sdb::Transaction* d_txn;
@@ -67,6 +74,7 @@ namespace Ds
 		QSettings* d_set;
 		Txt::Styles* d_styles;
 		QString d_appPath;
+		int d_batch;
 	};
 }
 
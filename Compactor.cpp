@@ -0,0 +1,399 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Compactor.h"
+#include "ReadConnection.h"
+#include "Statistics.h"
+#include "TypeDefs.h"
+#include "AppContext.h"
+#include <Sdb/Database.h>
+#include <Sdb/Transaction.h>
+#include <Sdb/Exceptions.h>
+#include <Stream/DataReader.h>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QHash>
+#include <QSet>
+#include <QUuid>
+#include <QtAlgorithms>
+#include <stdexcept>
+using namespace Ds;
+
+static const quint64 s_batch = 1024; // Objekte pro Lese-Lock bzw. pro Commit
+
+Compactor::Compactor( const QString& dbPath, Mode m, QObject* p ):QThread(p),
+	d_path( dbPath ),d_fileSize(0),d_liveSize(0),d_mode(m),d_ok(false),d_cancel(false)
+{
+}
+
+QString Compactor::pendingPath( const QString& dbPath )
+{
+	return dbPath + QLatin1String( ".compacted" );
+}
+
+static QString _stampPath( const QString& dbPath )
+{
+	return Compactor::pendingPath( dbPath ) + QLatin1String( ".stamp" );
+}
+
+static QString _stamp( const QString& dbPath )
+{
+	// Aenderungszaehler von SQLite; Groesse und Zeitstempel bleiben bei einem Commit in derselben
+	// Sekunde unter Umstaenden gleich. Leer, wenn der Zaehler nicht zuverlaessig ist.
+	const qint64 n = ReadConnection::changeCounter( dbPath );
+	if( n < 0 )
+		return QString();
+	return QString::number( n );
+}
+
+bool Compactor::applyPending( const QString& dbPath, QString& msg )
+{
+	const QString pending = pendingPath( dbPath );
+	if( !QFile::exists( pending ) )
+		return false;
+	QString stamp;
+	QFile f( _stampPath( dbPath ) );
+	if( f.open( QIODevice::ReadOnly ) )
+		stamp = QString::fromLatin1( f.readAll() );
+	f.close();
+	const QString current = _stamp( dbPath );
+	if( stamp.isEmpty() || stamp != current || QFile::exists( dbPath + QLatin1String( "-journal" ) ) )
+	{
+		// Nur eine als veraltet erkannte Kopie wird verworfen
+		msg = tr("The repository was modified after it was compacted; the compacted copy was discarded.");
+		QFile::remove( pending );
+		f.remove();
+		return true;
+	}
+	// Das Original wird erst geloescht, wenn die Kopie an seinem Platz ist
+	const QString backup = dbPath + QLatin1String( ".bak" );
+	QFile::remove( backup );
+	if( !QFile::rename( dbPath, backup ) )
+	{
+		msg = tr("The compacted copy could not replace the repository file; it is kept as %1.").arg( pending );
+		return true;
+	}
+	if( !QFile::rename( pending, dbPath ) )
+	{
+		if( QFile::rename( backup, dbPath ) )
+			msg = tr("The compacted copy could not replace the repository file; it is kept as %1.").arg( pending );
+		else
+			msg = tr("The compacted copy could not replace the repository file. The original is kept as %1, "
+				"the compacted copy as %2.").arg( backup ).arg( pending );
+		return true;
+	}
+	QFile::remove( backup );
+	f.remove();
+	msg = tr("The repository was replaced by its compacted copy. Please rebuild the search index.");
+	return true;
+}
+
+void Compactor::run()
+{
+	try
+	{
+		ReadConnection conn( d_path );
+		if( d_mode == Measure )
+			measure( conn );
+		else
+			compact( conn );
+		d_ok = !d_cancel;
+	}catch( const Sdb::DatabaseException& e )
+	{
+		d_error = QString( "%1: %2" ).arg( e.getCodeString() ).arg( e.getMsg() );
+	}catch( const std::exception& e )
+	{
+		d_error = QString::fromLatin1( e.what() );
+	}
+	if( d_mode == Compact && !d_ok )
+	{
+		QFile::remove( d_path + QLatin1String( ".tmp" ) );
+		QFile::remove( pendingPath( d_path ) );
+		QFile::remove( _stampPath( d_path ) );
+	}
+}
+
+static void _account( const Sdb::Obj& o, const QHash<quint64,qint64>& sizes, QSet<quint64>& visited,
+					 Compactor::DocSpace& ds )
+{
+	if( visited.contains( o.getOid() ) )
+		return;
+	visited.insert( o.getOid() );
+	ds.d_bytes += sizes.value( o.getOid() );
+	ds.d_count++;
+	// TypeHistory ist nicht aggregiert, sondern nur ueber Slots erreichbar
+	Sdb::Qit q = o.getFirstSlot();
+	if( !q.isNull() ) do
+	{
+		const Sdb::Obj hr = o.getTxn()->getObject( q.getValue() );
+		if( !hr.isNull() )
+			_account( hr, sizes, visited, ds );
+	}while( q.next() );
+	Sdb::Obj sub = o.getFirstObj();
+	if( !sub.isNull() ) do
+	{
+		_account( sub, sizes, visited, ds );
+	}while( sub.next() );
+}
+
+static bool _bySize( const Compactor::DocSpace& lhs, const Compactor::DocSpace& rhs )
+{
+	return lhs.d_bytes > rhs.d_bytes;
+}
+
+void Compactor::measure( ReadConnection& conn )
+{
+	d_fileSize = QFileInfo( d_path ).size();
+	const quint64 maxOid = conn.getDb()->getMaxOid();
+	QHash<quint64,qint64> sizes;
+	QList<quint64> docs;
+	quint64 id = 1;
+	while( id <= maxOid && !d_cancel )
+	{
+		ReadConnection::Reader lock( conn );
+		const quint64 end = qMin( id + s_batch, maxOid + 1 );
+		for( ; id < end; id++ )
+		{
+			const Sdb::Obj o = conn.getObject( id );
+			if( o.isNull() )
+				continue;
+			const qint64 n = Statistics::objectSize( o );
+			sizes[id] = n;
+			d_liveSize += n;
+			if( o.getType() == TypeDocument )
+				docs.append( id );
+		}
+		emit progress( int( id - 1 ), int( maxOid ), tr("Measuring objects") );
+	}
+	QSet<quint64> visited;
+	for( int i = 0; i < docs.size() && !d_cancel; i++ )
+	{
+		ReadConnection::Reader lock( conn );
+		const Sdb::Obj doc = conn.getObject( docs[i] );
+		if( doc.isNull() )
+			continue;
+		DocSpace ds;
+		ds.d_doc = docs[i];
+		ds.d_name = doc.getValue( AttrDocName ).toString();
+		_account( doc, sizes, visited, ds );
+		d_docs.append( ds );
+		emit progress( i + 1, docs.size(), tr("Measuring documents") );
+	}
+	qSort( d_docs.begin(), d_docs.end(), _bySize );
+}
+
+static inline void _addAtom( QSet<quint32>& atoms, quint32 a )
+{
+	// Nur dynamische Atome; die statischen aus TypeDefs sind in jeder Datenbank gleich
+	if( a > DsMax )
+		atoms.insert( a );
+}
+
+static void _collectAtoms( const Stream::DataCell& v, QSet<quint32>& atoms )
+{
+	if( v.isAtom() )
+		_addAtom( atoms, v.getAtom() );
+	else if( v.isBml() )
+	{
+		// z.B. AttrDocObjAttrs, AttrDocAttrs
+		Stream::DataReader r( v );
+		Stream::DataReader::Token t = r.nextToken();
+		while( Stream::DataReader::isUseful( t ) )
+		{
+			if( t == Stream::DataReader::Slot )
+			{
+				const Stream::DataCell c = r.readValue();
+				if( c.isAtom() )
+					_addAtom( atoms, c.getAtom() );
+			}
+			t = r.nextToken();
+		}
+	}
+}
+
+static Stream::DataCell _remap( const Stream::DataCell& v, const QHash<quint64,quint64>& map )
+{
+	if( !v.isOid() )
+		return v;
+	Stream::DataCell res;
+	const quint64 id = map.value( v.getOid() );
+	if( id != 0 )
+		res.setOid( id );
+	else
+		res.setNull(); // Verweis auf ein geloeschtes Objekt
+	return res;
+}
+
+static inline bool _isCopied( quint32 attr )
+{
+	// FilterCache-Resultate enthalten OIDs im Bitset; werden neu berechnet.
+	// Frueher gespeicherter Bytecode wird nicht mehr gelesen.
+	return attr != AttrFilterResults && attr != AttrScriptBin && attr != AttrScriptBinKey;
+}
+
+void Compactor::compact( ReadConnection& conn )
+{
+	const QString tmp = d_path + QLatin1String( ".tmp" );
+	QFile::remove( tmp );
+	QFile::remove( pendingPath( d_path ) );
+	QFile::remove( _stampPath( d_path ) );
+
+	// Gelesen wird in kurzen Reader-Blocks, damit Schreiber im GUI-Thread nicht warten. Der Stempel
+	// wird vor dem ersten Lesen genommen; jeder spaetere Commit am Original macht die Kopie damit
+	// ungueltig, auch einer zwischen zwei Blocks.
+	const QString stamp = _stamp( d_path );
+	if( stamp.isEmpty() )
+		throw std::runtime_error( "the repository file does not provide a change counter" );
+	Sdb::Transaction* src = conn.getTxn();
+	quint64 maxOid;
+	{
+		ReadConnection::Reader lock( conn );
+		maxOid = conn.getDb()->getMaxOid();
+	}
+
+	// 1. Durchgang: lebende Objekte und benutzte Atome
+	QList<quint64> oids;
+	QSet<quint32> atoms;
+	for( quint64 from = 1; from <= maxOid && !d_cancel; from += s_batch )
+	{
+		ReadConnection::Reader lock( conn );
+		const quint64 to = qMin( from + s_batch - 1, maxOid );
+		for( quint64 id = from; id <= to; id++ )
+		{
+			const Sdb::Obj o = src->getObject( id );
+			if( o.isNull() )
+				continue;
+			oids.append( id );
+			Sdb::Obj::Names names = o.getNames();
+			Sdb::Obj::Names::const_iterator i;
+			for( i = names.begin(); i != names.end(); ++i )
+			{
+				_addAtom( atoms, *i );
+				_collectAtoms( o.getValue( *i ), atoms );
+			}
+			Sdb::Mit m = o.findCells( Sdb::Obj::KeyList() );
+			if( !m.isNull() ) do
+			{
+				const Stream::DataCell v = m.getValue();
+				_collectAtoms( v, atoms );
+				if( v.isUInt32() ) // ReqIF-Mapping: Attributname -> Atom
+					_addAtom( atoms, v.getUInt32() );
+			}while( m.nextKey() );
+		}
+		emit progress( int( to ), int( maxOid ), tr("Scanning objects") );
+	}
+	if( d_cancel )
+		return;
+
+	quint64 root;
+	quint64 mappings;
+	{
+		ReadConnection::Reader lock( conn );
+		root = src->getObject( QUuid( AppContext::s_rootUuid ) ).getOid();
+		mappings = src->getObject( AppContext::s_reqIfMappings ).getOid();
+	}
+	{
+		Sdb::Database db;
+		db.open( tmp );
+		TypeDefs::initDb( db );
+		{
+			ReadConnection::Reader lock( conn );
+			Sdb::Database::Lock w( &db, true );
+			foreach( quint32 a, atoms )
+				db.presetAtom( conn.getDb()->getAtomString( a ), a );
+		}
+		Sdb::Transaction txn( &db );
+
+		// 2. Durchgang: Objekte anlegen; OIDs werden neu vergeben
+		QHash<quint64,quint64> map;
+		for( int i = 0; i < oids.size() && !d_cancel; i += s_batch )
+		{
+			ReadConnection::Reader lock( conn );
+			Sdb::Database::Lock w( &db, true );
+			const int end = qMin( i + int( s_batch ), oids.size() );
+			for( int j = i; j < end; j++ )
+			{
+				const Sdb::Obj o = src->getObject( oids[j] );
+				Sdb::Obj n;
+				if( oids[j] == root )
+					n = txn.createObject( QUuid( AppContext::s_rootUuid ) );
+				else if( oids[j] == mappings )
+					n = txn.createObject( AppContext::s_reqIfMappings );
+				else
+					n = txn.createObject( o.getType() );
+				if( n.getType() != o.getType() )
+					n.setType( o.getType() );
+				map[ oids[j] ] = n.getOid();
+			}
+			txn.commit();
+			w.commit();
+			emit progress( end, oids.size(), tr("Creating objects") );
+		}
+
+		// 3. Durchgang: Werte, Slots, Zellen und Aggregation in Original-Reihenfolge
+		for( int i = 0; i < oids.size() && !d_cancel; i += s_batch )
+		{
+			ReadConnection::Reader lock( conn );
+			Sdb::Database::Lock w( &db, true );
+			const int end = qMin( i + int( s_batch ), oids.size() );
+			for( int j = i; j < end; j++ )
+			{
+				const Sdb::Obj o = src->getObject( oids[j] );
+				Sdb::Obj n = txn.getObject( map.value( oids[j] ) );
+				Sdb::Obj::Names names = o.getNames();
+				Sdb::Obj::Names::const_iterator k;
+				for( k = names.begin(); k != names.end(); ++k )
+				{
+					if( _isCopied( *k ) )
+						n.setValue( *k, _remap( o.getValue( *k ), map ) );
+				}
+				Sdb::Qit q = o.getFirstSlot();
+				if( !q.isNull() ) do
+				{
+					const quint64 t = map.value( src->getObject( q.getValue() ).getOid() );
+					if( t != 0 )
+						n.appendSlot( txn.getObject( t ) );
+				}while( q.next() );
+				Sdb::Mit m = o.findCells( Sdb::Obj::KeyList() );
+				if( !m.isNull() ) do
+				{
+					n.setCell( m.getKey(), _remap( m.getValue(), map ) );
+				}while( m.nextKey() );
+				Sdb::Obj sub = o.getFirstObj();
+				if( !sub.isNull() ) do
+				{
+					txn.getObject( map.value( sub.getOid() ) ).aggregateTo( n );
+				}while( sub.next() );
+			}
+			txn.commit();
+			w.commit();
+			emit progress( end, oids.size(), tr("Copying objects") );
+		}
+	}
+	if( d_cancel )
+		return;
+
+	if( conn.isChanged() || _stamp( d_path ) != stamp )
+		throw std::runtime_error( "the repository was modified while it was compacted" );
+	QFile f( _stampPath( d_path ) );
+	if( !f.open( QIODevice::WriteOnly ) )
+		throw std::runtime_error( "cannot write compaction stamp" );
+	f.write( stamp.toLatin1() );
+	f.close();
+	if( !QFile::rename( tmp, pendingPath( d_path ) ) )
+		throw std::runtime_error( "cannot rename compacted file" );
+}
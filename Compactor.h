@@ -0,0 +1,80 @@
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QThread>
+#include <QList>
+#include <QString>
+
+namespace Ds
+{
+	class ReadConnection;
+
+	// Measure: belegter Platz pro Dokument (Objekte, History, Annotationen) und freier Platz der Datei.
+	// Compact: kopiert alle lebenden Objekte mit Atomen und Indizes in eine neue Datei neben dem
+	// Repository; diese ersetzt das Original beim naechsten Oeffnen (applyPending), sofern das
+	// Original seither nicht veraendert wurde. Die OIDs aendern sich dabei, der Suchindex ist neu
+	// aufzubauen. Laeuft ueber eine eigene ReadConnection und liest in kurzen Blocks; Schreiber warten
+	// nicht, ein Commit waehrend Compact verwirft die Kopie aber.
+	class Compactor : public QThread
+	{
+		Q_OBJECT
+	public:
+		enum Mode { Measure, Compact };
+		struct DocSpace
+		{
+			quint64 d_doc;
+			QString d_name;
+			qint64 d_bytes;
+			int d_count;
+			DocSpace():d_doc(0),d_bytes(0),d_count(0) {}
+		};
+
+		Compactor( const QString& dbPath, Mode, QObject* p = 0 );
+		void cancel() { d_cancel = true; }
+		bool isCanceled() const { return d_cancel; }
+		bool isOk() const { return d_ok; }
+		const QString& getError() const { return d_error; }
+		Mode getMode() const { return d_mode; }
+		qint64 getFileSize() const { return d_fileSize; }
+		qint64 getLiveSize() const { return d_liveSize; } // geschaetzt aus den serialisierten Werten
+		qint64 getReclaimable() const { return qMax( qint64(0), d_fileSize - d_liveSize ); }
+		const QList<DocSpace>& getDocs() const { return d_docs; } // nach Groesse absteigend
+
+		static QString pendingPath( const QString& dbPath );
+		// Vor Database::open aufrufen; true wenn eine kompaktierte Kopie uebernommen oder verworfen wurde
+		static bool applyPending( const QString& dbPath, QString& msg );
+	signals:
+		void progress( int done, int total, const QString& phase );
+	protected:
+		void run();
+		void measure( ReadConnection& );
+		void compact( ReadConnection& );
+	private:
+		QString d_path;
+		QString d_error;
+		QList<DocSpace> d_docs;
+		qint64 d_fileSize;
+		qint64 d_liveSize;
+		Mode d_mode;
+		bool d_ok;
+		volatile bool d_cancel;
+	};
+}
+
+#endif // COMPACTOR_H
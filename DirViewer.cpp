@@ -37,6 +37,10 @@
 #include <QClipboard>
 #include <QtDebug>
 #include <QProgressDialog>
+#include <QThread>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QVBoxLayout>
 #include <Stream/DataReader.h>
 #include <Stream/DataWriter.h>
 #include <Script/Terminal2.h>
@@ -44,10 +48,68 @@
 #include "SearchView.h"
 #include "ReqIfImport.h"
 #include "LuaIde.h"
+#include "Compactor.h"
+#include "Statistics.h"
+#include "ReadConnection.h"
+#include <Sdb/Transaction.h>
+#include <Sdb/Exceptions.h>
 using namespace Stream;
 using namespace Ds;
 using namespace Sdb;
 
+static const int s_maxRetries = 3; // HistoJob: Vergleiche, bevor aufgegeben wird
+
+namespace Ds
+{
+	// Vergleicht die Dokumente ueber eine eigene Verbindung im Hintergrund; geschrieben wird
+	// erst in onHistoDone im GUI-Thread, die alte History bleibt bis zu dessen Commit unveraendert.
+	class HistoJob : public QThread
+	{
+	public:
+		DocManager d_dm;
+		DocManager::HistoDiff d_diff;
+		QString d_path; // eigene Verbindung, siehe ReadConnection
+		quint64 d_prev;
+		quint64 d_doc;
+		QList<quint32> d_attrs;
+		QString d_error;
+		bool d_ok;
+		volatile bool d_cancel; // GUI-Thread setzt, run liest
+		HistoJob( QObject* p ):QThread(p),d_prev(0),d_doc(0),d_ok(false),d_cancel(false) {}
+	protected:
+		void run();
+	};
+}
+
+void HistoJob::run()
+{
+	try
+	{
+		ReadConnection conn( d_path );
+		// Wird waehrend des Vergleichs committed, passen die Abschnitte nicht zusammen; neu beginnen
+		for( int i = 0; i < s_maxRetries; i++ )
+		{
+			conn.restart();
+			d_ok = d_dm.compareHisto( conn.getObject( d_prev ), conn.getObject( d_doc ), d_attrs, d_diff, &conn );
+			if( !d_ok )
+			{
+				d_error = d_dm.getError();
+				break;
+			}
+			if( !conn.isChanged() )
+				break;
+			d_ok = false;
+			d_error = DirViewer::tr("the repository was modified during the comparison");
+		}
+	}catch( const Sdb::DatabaseException& e )
+	{
+		d_ok = false;
+		d_error = QString( "%1: %2" ).arg( e.getCodeString() ).arg( e.getMsg() );
+	}
+	if( !d_ok )
+		d_diff = DocManager::HistoDiff();
+}
+
 enum Type { FOLDER, DOC };
 enum Role { _OID = Qt::UserRole + 1, DT }; 
 
@@ -65,7 +127,8 @@ private:
 */
 
 DirViewer::DirViewer(QWidget *parent)
-	: QTreeWidget(parent), d_loadLock( false )
+	: QTreeWidget(parent), d_loadLock( false ), d_histoJob( 0 ), d_histoDlg( 0 ),
+	d_compactJob( 0 ), d_compactDlg( 0 )
 {
 	setHeaderLabels( QStringList() << tr("Name") << tr("Version") << tr("Status") << 
 		tr("Status Date") << tr("Import Date") << tr("Doc. ID") );
@@ -125,6 +188,8 @@ DirViewer::DirViewer(QWidget *parent)
     m->addCommand( tr("Delete Object..."), this, SLOT(onDeleteObject()), tr("Del"), true );
 	m->addCommand( tr("Delete Annotations..."), this, SLOT(onDeleteAnnot()) );
 	m->addCommand( tr("Rebuild Index..."), this, SLOT(onReindex()) );
+	m->addCommand( tr("Compact Repository..."), this, SLOT(onCompact()) );
+	m->addCommand( tr("Repository Statistics..."), this, SLOT(onStatistics()) );
 #ifdef _DEBUG
 	//m->addCommand( tr("&Dump Repository"), SLOT(dumpDatabase() ) );
 #endif
@@ -143,7 +208,16 @@ DirViewer::DirViewer(QWidget *parent)
 
 DirViewer::~DirViewer()
 {
-
+	if( d_histoJob )
+	{
+		d_histoJob->d_dm.cancel();
+		d_histoJob->wait();
+	}
+	if( d_compactJob )
+	{
+		d_compactJob->cancel();
+		d_compactJob->wait();
+	}
 }
 
 void DirViewer::onDbUpdate( Sdb::UpdateInfo i )
@@ -212,6 +286,7 @@ void DirViewer::importDocs( QTreeWidgetItem* parentItem, const QStringList &path
 	dlg.setValue( 0 );
 	QApplication::processEvents();
 	QList<Sdb::Obj> docs;
+	AppContext::inst()->beginBatch(); // FilterCache u.a. schreiben nicht in den laufenden Import
 	{
 		Database::Lock lock( AppContext::inst()->getDb(), true );
 		Obj parent;
@@ -258,6 +333,7 @@ void DirViewer::importDocs( QTreeWidgetItem* parentItem, const QStringList &path
                 QApplication::processEvents();
 				AppContext::inst()->getTxn()->rollback();
 				lock.rollback();
+				AppContext::inst()->endBatch();
 				QApplication::restoreOverrideCursor();
                 QMessageBox::critical( this, tr("Error importing document" ), error );
 				return;
@@ -273,12 +349,14 @@ void DirViewer::importDocs( QTreeWidgetItem* parentItem, const QStringList &path
 			{
 				AppContext::inst()->getTxn()->rollback();
 				lock.rollback();
+				AppContext::inst()->endBatch();
 				return;
 			}
 			++it;
 		}
 		lock.commit();
 	}
+	AppContext::inst()->endBatch();
 	QTreeWidgetItem* item = 0;
 	if( parentItem )
 		item = parentItem;
@@ -859,7 +937,7 @@ void DirViewer::onExpAnnotCsv2()
 void DirViewer::onCreateHistory()
 {
 	QTreeWidgetItem* i = currentItem();
-	ENABLED_IF( i && i->type() == DOC );
+	ENABLED_IF( i && i->type() == DOC && d_histoJob == 0 );
 
 	Sdb::Obj doc = AppContext::inst()->getTxn()->getObject( i->data(0,_OID).toULongLong() );
 	DocSelectorDlg dlg( this );
@@ -882,15 +960,168 @@ void DirViewer::onCreateHistory()
 	else
 	{
 		DocViewer::closeAll( doc );
-		Sdb::Database::Lock lock( AppContext::inst()->getDb(), true ); // da sonst permanent in Db rattert.
-		QApplication::setOverrideCursor( Qt::WaitCursor );
-		DocManager dm;
-		dm.createHisto( prev, doc, atts );
-		AppContext::inst()->getTxn()->commit();
-		QApplication::restoreOverrideCursor();
+		d_histoJob = new HistoJob( this );
+		d_histoJob->d_path = doc.getDb()->getFilePath();
+		d_histoJob->d_prev = prev.getOid();
+		d_histoJob->d_doc = doc.getOid();
+		d_histoJob->d_attrs = atts;
+		connect( &d_histoJob->d_dm, SIGNAL( progress( int, int, const QString& ) ),
+			this, SLOT( onHistoProgress( int, int, const QString& ) ) );
+		connect( d_histoJob, SIGNAL( finished() ), this, SLOT( onHistoDone() ) );
+
+		d_histoDlg = new QProgressDialog( this );
+		d_histoDlg->setWindowTitle( tr("Create History - DoorScope") );
+		d_histoDlg->setLabelText( tr("Preparing...") );
+		d_histoDlg->setWindowModality( Qt::WindowModal );
+		d_histoDlg->setAutoClose( false );
+		d_histoDlg->setAutoReset( false );
+		d_histoDlg->setMinimumDuration( 0 );
+		d_histoDlg->setValue( 0 );
+		connect( d_histoDlg, SIGNAL( canceled() ), this, SLOT( onHistoCancel() ) );
+		d_histoDlg->show();
+		d_histoJob->start( QThread::LowPriority );
 	}
 }
 
+void DirViewer::onHistoProgress( int done, int total, const QString& section )
+{
+	if( d_histoDlg == 0 || d_histoJob == 0 || d_histoJob->d_cancel )
+		return;
+	d_histoDlg->setMaximum( total );
+	d_histoDlg->setValue( done );
+	if( done >= total )
+		d_histoDlg->setLabelText( tr("Finishing...") );
+	else if( d_histoJob->isRunning() )
+		d_histoDlg->setLabelText( tr("Section %1 of %2\n%3").arg( done + 1 ).arg( total ).arg( section ) );
+	else
+	{
+		// applyHisto laeuft in onHistoDone im GUI-Thread; Dialog nachfuehren und Cancel ermoeglichen
+		d_histoDlg->setLabelText( tr("%1\n%2 of %3 objects").arg( section ).arg( done ).arg( total ) );
+		QApplication::processEvents();
+	}
+}
+
+void DirViewer::onHistoCancel()
+{
+	if( d_histoJob == 0 )
+		return;
+	d_histoJob->d_cancel = true;
+	d_histoJob->d_dm.cancel();
+	d_histoDlg->setLabelText( tr("Cancelling...") );
+}
+
+void DirViewer::onHistoDone()
+{
+	if( d_histoJob == 0 )
+		return;
+	if( d_histoJob->d_ok && !d_histoJob->d_cancel )
+	{
+		// Geschrieben wird im GUI-Thread in Portionen mit Fortschritt und in einer eigenen
+		// Transaktion; die von AppContext gehoert der GUI. Erst der Commit am Ende ersetzt die
+		// alte History, bei Abbruch oder Fehler bleibt sie unveraendert.
+		Sdb::Transaction txn( AppContext::inst()->getDb() );
+		try
+		{
+			d_histoJob->d_ok = d_histoJob->d_dm.applyHisto( txn.getObject( d_histoJob->d_prev ), 
+				txn.getObject( d_histoJob->d_doc ), d_histoJob->d_diff );
+			if( d_histoJob->d_ok && !d_histoJob->d_cancel )
+			{
+				Sdb::Database::Lock lock( AppContext::inst()->getDb(), true );
+				txn.commit();
+				lock.commit();
+			}else
+			{
+				if( d_histoJob->d_dm.getError().isEmpty() )
+					d_histoJob->d_error = tr("invalid document");
+				else
+					d_histoJob->d_error = d_histoJob->d_dm.getError();
+				txn.rollback();
+			}
+		}catch( const Sdb::DatabaseException& e )
+		{
+			d_histoJob->d_ok = false;
+			d_histoJob->d_error = QString( "%1: %2" ).arg( e.getCodeString() ).arg( e.getMsg() );
+			txn.rollback();
+		}
+	}
+	if( d_histoDlg )
+	{
+		d_histoDlg->deleteLater();
+		d_histoDlg = 0;
+	}
+	if( !d_histoJob->d_ok && !d_histoJob->d_cancel )
+		QMessageBox::critical( this, tr("Create History - DoorScope"), 
+			tr("History could not be created: %1").arg( d_histoJob->d_error ) );
+	d_histoJob->deleteLater();
+	d_histoJob = 0;
+}
+
+void DirViewer::onStatistics()
+{
+	ENABLED_IF( true );
+
+	QProgressDialog progress( tr("Scanning repository..."), tr("Abort"), 0, 0, this );
+	progress.setWindowTitle( tr("Repository Statistics - DoorScope") );
+	progress.setWindowModality( Qt::WindowModal );
+	progress.setMinimumDuration( 500 );
+	if( !Statistics::inst()->refresh( &progress ) )
+		return;
+	progress.close();
+
+	QDialog dlg( this );
+	dlg.setWindowTitle( tr("Repository Statistics - DoorScope") );
+	QVBoxLayout* vbox = new QVBoxLayout( &dlg );
+	QTreeWidget* tree = new QTreeWidget( &dlg );
+	tree->setHeaderLabels( QStringList() << tr("Document") << tr("KB") << tr("Objects") << tr("Images KB")
+		<< tr("History") << tr("Annotations") << tr("Index Entries") << tr("Index KB") );
+	tree->setAlternatingRowColors( true );
+	tree->setSortingEnabled( true );
+	vbox->addWidget( tree );
+	QDialogButtonBox* bb = new QDialogButtonBox( QDialogButtonBox::Close, Qt::Horizontal, &dlg );
+	connect( bb, SIGNAL( rejected() ), &dlg, SLOT( reject() ) );
+	vbox->addWidget( bb );
+
+	Sdb::Database* db = AppContext::inst()->getDb();
+	const Statistics::Docs& docs = Statistics::inst()->getDocs();
+	Statistics::Docs::const_iterator i;
+	for( i = docs.begin(); i != docs.end(); ++i )
+	{
+		const Statistics::Doc& d = i.value();
+		QTreeWidgetItem* item = new QTreeWidgetItem( tree );
+		item->setText( 0, d.d_name );
+		item->setData( 1, Qt::DisplayRole, ( d.d_bytes + 1023 ) / 1024 );
+		item->setData( 2, Qt::DisplayRole, d.d_objects );
+		item->setData( 3, Qt::DisplayRole, ( d.d_imageBytes + 1023 ) / 1024 );
+		item->setData( 4, Qt::DisplayRole, d.d_history );
+		item->setData( 5, Qt::DisplayRole, d.d_annotations );
+		item->setData( 6, Qt::DisplayRole, d.d_indexEntries );
+		item->setData( 7, Qt::DisplayRole, ( d.d_indexBytes + 1023 ) / 1024 );
+		QTreeWidgetItem* types = new QTreeWidgetItem( item );
+		types->setText( 0, tr("Object Types") );
+		QMap<quint32,int>::const_iterator t;
+		for( t = d.d_types.begin(); t != d.d_types.end(); ++t )
+		{
+			QTreeWidgetItem* sub = new QTreeWidgetItem( types );
+			sub->setText( 0, TypeDefs::getPrettyName( t.key(), db ) );
+			sub->setData( 2, Qt::DisplayRole, t.value() );
+		}
+		QTreeWidgetItem* attrs = new QTreeWidgetItem( item );
+		attrs->setText( 0, tr("Attributes") );
+		QMap<quint32,qint64>::const_iterator a;
+		for( a = d.d_attrBytes.begin(); a != d.d_attrBytes.end(); ++a )
+		{
+			QTreeWidgetItem* sub = new QTreeWidgetItem( attrs );
+			sub->setText( 0, TypeDefs::getPrettyName( a.key(), db ) );
+			sub->setData( 1, Qt::DisplayRole, ( a.value() + 1023 ) / 1024 );
+		}
+	}
+	tree->sortByColumn( 1, Qt::DescendingOrder );
+	tree->resizeColumnToContents( 0 );
+	dlg.resize( AppContext::inst()->getSet()->value( "StatisticsDlg/Size", QSize( 700, 400 ) ).toSize() );
+	dlg.exec();
+	AppContext::inst()->getSet()->setValue( "StatisticsDlg/Size", dlg.size() );
+}
+
 void DirViewer::onSetDocFont()
 {
 	ENABLED_IF( true );
@@ -1004,3 +1235,99 @@ void DirViewer::onReindex()
 			QMessageBox::critical( this, tr("DoorScope Indexer"), idx.getError() );
 	}
 }
+
+static void _startCompactor( DirViewer* w, Compactor* job, QProgressDialog*& dlg )
+{
+	dlg = new QProgressDialog( w );
+	dlg->setWindowTitle( DirViewer::tr("Compact Repository - DoorScope") );
+	dlg->setLabelText( DirViewer::tr("Preparing...") );
+	dlg->setWindowModality( Qt::WindowModal );
+	dlg->setAutoClose( false );
+	dlg->setAutoReset( false );
+	dlg->setMinimumDuration( 0 );
+	dlg->setValue( 0 );
+	w->connect( job, SIGNAL( progress( int, int, const QString& ) ),
+		w, SLOT( onCompactProgress( int, int, const QString& ) ) );
+	w->connect( job, SIGNAL( finished() ), w, SLOT( onCompactDone() ) );
+	w->connect( dlg, SIGNAL( canceled() ), w, SLOT( onCompactCancel() ) );
+	dlg->show();
+	job->start( QThread::LowPriority );
+}
+
+void DirViewer::onCompact()
+{
+	ENABLED_IF( d_compactJob == 0 && d_histoJob == 0 );
+
+	// Zuerst wird gemessen; kompaktiert wird erst nach Bestaetigung in onCompactDone
+	d_compactJob = new Compactor( AppContext::inst()->getDb()->getFilePath(), Compactor::Measure, this );
+	_startCompactor( this, d_compactJob, d_compactDlg );
+}
+
+void DirViewer::onCompactProgress( int done, int total, const QString& phase )
+{
+	if( d_compactDlg == 0 || d_compactJob == 0 || d_compactJob->isCanceled() )
+		return;
+	d_compactDlg->setMaximum( total );
+	d_compactDlg->setValue( done );
+	d_compactDlg->setLabelText( phase );
+}
+
+void DirViewer::onCompactCancel()
+{
+	if( d_compactJob == 0 )
+		return;
+	d_compactJob->cancel();
+	d_compactDlg->setLabelText( tr("Cancelling...") );
+}
+
+static QString _bytes( qint64 n )
+{
+	return DirViewer::tr("%1 KB").arg( ( n + 1023 ) / 1024 );
+}
+
+void DirViewer::onCompactDone()
+{
+	if( d_compactJob == 0 )
+		return;
+	if( d_compactDlg )
+	{
+		d_compactDlg->deleteLater();
+		d_compactDlg = 0;
+	}
+	Compactor* job = d_compactJob;
+	d_compactJob = 0;
+	job->deleteLater();
+	if( job->isCanceled() )
+		return;
+	if( !job->isOk() )
+	{
+		QMessageBox::critical( this, tr("Compact Repository - DoorScope"),
+			tr("Compaction failed: %1").arg( job->getError() ) );
+		return;
+	}
+	if( job->getMode() == Compactor::Compact )
+	{
+		QMessageBox::information( this, tr("Compact Repository - DoorScope"),
+			tr("The compacted copy is ready and replaces the repository when it is opened next time, "
+			"provided it is not modified until then.") );
+		return;
+	}
+	QString details;
+	const QList<Compactor::DocSpace>& docs = job->getDocs();
+	for( int i = 0; i < docs.size(); i++ )
+		details += tr("%1\t%2 in %3 objects\n").arg( docs[i].d_name ).arg( _bytes( docs[i].d_bytes ) )
+				   .arg( docs[i].d_count );
+	QMessageBox box( QMessageBox::Question, tr("Compact Repository - DoorScope"),
+		tr("File size: %1\nLive data (estimated): %2\nReclaimable by compaction: %3\n\n"
+		"The details list the space each document occupies, i.e. what deleting it would reclaim.\n"
+		"Compaction copies all live objects into a new file; object ids change and the search index "
+		"has to be rebuilt. Continue?").arg( _bytes( job->getFileSize() ) )
+		.arg( _bytes( job->getLiveSize() ) ).arg( _bytes( job->getReclaimable() ) ),
+		QMessageBox::Yes | QMessageBox::Cancel, this );
+	box.setDetailedText( details );
+	box.setDefaultButton( QMessageBox::Cancel );
+	if( box.exec() != QMessageBox::Yes )
+		return;
+	d_compactJob = new Compactor( AppContext::inst()->getDb()->getFilePath(), Compactor::Compact, this );
+	_startCompactor( this, d_compactJob, d_compactDlg );
+}
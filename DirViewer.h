@@ -22,8 +22,13 @@
 #include <QMap>
 #include <Sdb/Obj.h>
 
+class QProgressDialog;
+
 namespace Ds
 {
+	class HistoJob;
+	class Compactor;
+
 	class DirViewer : public QTreeWidget
 	{
 		Q_OBJECT
@@ -56,12 +61,20 @@ namespace Ds
 		void onExpAnnotCsv();
 		void onExpAnnotCsv2();
 		void onCreateHistory();
+		void onHistoProgress( int done, int total, const QString& section );
+		void onHistoCancel();
+		void onHistoDone();
 		void onSetDocFont();
 		void onSetAppFont();
 		void onImportAnnot();
         void onPasteHtmlDoc();
 		void onSearch();
 		void onReindex();
+		void onCompact();
+		void onCompactProgress( int done, int total, const QString& phase );
+		void onCompactCancel();
+		void onCompactDone();
+		void onStatistics();
 		void onDeleteAnnot();
 		void adjustColumns();
 		void onOpenIde();
@@ -86,6 +99,10 @@ namespace Ds
 		QMap<quint64,QTreeWidgetItem*> d_map;
 		QString d_lastPath;
 		bool d_loadLock;
+		HistoJob* d_histoJob;
+		QProgressDialog* d_histoDlg;
+		Compactor* d_compactJob;
+		QProgressDialog* d_compactDlg;
 	};
 }
 
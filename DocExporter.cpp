@@ -351,7 +351,7 @@ static void _writeTable( const Sdb::Obj& tbl, QTextStream& out )
 			{
 				if( c.getType() == TypeTableCell )
 				{
-					Stream::DataCell v = c.getValue( AttrObjText );
+					Stream::DataCell v = TypeDefs::getValue( c, AttrObjText );
 					out << "<td>";
 					_writeRich( v, out );
 				}
@@ -404,7 +404,7 @@ static void _writeAttr( const Sdb::Obj& obj, QTextStream& out, const QByteArray&
 	out << "'" << QString::fromLatin1( attrName ) << "' ";
 	out << "</strong>";
 	out << "<dd>";
-	_writeRich( obj.getValue( a ), out );
+	_writeRich( TypeDefs::getValue( obj, a ), out );
 }
 
 
@@ -453,7 +453,7 @@ static void _writeSection3( const Sdb::Obj& sec, QTextStream& out, int level, bo
 			out << "<td>" << _notEmpty(_notNull(o.getValue( AttrObjIdent ) ) );
 			out << "<td><" << _headerLevel( level ) << ">" <<
 				o.getValue( AttrObjNumber ).getStr() << " " <<
-				o.getValue( AttrObjText ).getStr() << 
+				TypeDefs::getValue( o, AttrObjText ).getStr() << 
 				"</" << _headerLevel( level ) << ">";
 			if( annot )
 			{
@@ -466,7 +466,7 @@ static void _writeSection3( const Sdb::Obj& sec, QTextStream& out, int level, bo
 			out << "<tr>";
 			out << "<td>" << _notEmpty(_notNull(o.getValue( AttrObjIdent ) ) );
 			out << "<td>";
-			_writeRich( o.getValue( AttrObjText ), out );
+			_writeRich( TypeDefs::getValue( o, AttrObjText ), out );
 			if( annot )
 			{
 				_writeAnnots( o, out, attr );
@@ -489,7 +489,7 @@ static void _writeSection3( const Sdb::Obj& sec, QTextStream& out, int level, bo
 			out << "<tr>";
 			out << "<td>" << _notEmpty(_notNull(o.getValue( AttrObjIdent ) ) );
 			out << "<td>";
-			_writeImg( o.getValue( AttrPicImage ), out );
+			_writeImg( TypeDefs::getValue( o, AttrPicImage ), out );
 			if( annot )
 			{
 				_writeAnnots( o, out, attr );
@@ -569,7 +569,7 @@ static void _writeRow( const Sdb::Obj& sec, const QList<quint32>& attrs, QTextSt
 			out << o.getValue( AttrObjIdent ).toPrettyString(); // vorher getInt32();
 			for( int i = 0; i < attrs.size(); i++ )
 			{
-				Stream::DataCell v = o.getValue( attrs[i] );
+				Stream::DataCell v = TypeDefs::getValue( o, attrs[i] );
 				out << ",";
 				if( v.isBml() )
 				{
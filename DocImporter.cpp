@@ -799,7 +799,7 @@ static void readHtmlNode( Context& ctx, const QTextHtmlParserNode& p )
 			qDebug() << "************** " << p.tag;
 			r.dump();
 			*/
-			body.setValue( AttrObjText, DataCell().setBml( bml ) );
+			body.setValue( AttrObjText, TypeDefs::pack( DataCell().setBml( bml ) ) );
 		}
 		break;
 	// case Html_center: // gibt es nicht
@@ -811,7 +811,7 @@ static void readHtmlNode( Context& ctx, const QTextHtmlParserNode& p )
 		{
 			Obj body = AppContext::inst()->getTxn()->createObject( TypeSection );
 			_aggr( body, ctx );
-			body.setValue( AttrObjText, DataCell().setHtml( generateHtml( ctx, p ) ) );
+			body.setValue( AttrObjText, TypeDefs::pack( DataCell().setHtml( generateHtml( ctx, p ) ) ) );
 		}
 		break;
 
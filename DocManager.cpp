@@ -17,6 +17,7 @@
 #include "DocManager.h"
 #include "TypeDefs.h"
 #include "AppContext.h"
+#include "ReadConnection.h"
 #include <Stream/DataReader.h>
 #include <Stream/DataWriter.h>
 #include <Sdb/Transaction.h>
@@ -25,6 +26,10 @@
 #include <QFile>
 #include <QDateTime>
 #include <QImage>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QThread>
+#include <QtEndian>
 #include <QtDebug>
 #include <bitset>
 #include <cassert>
@@ -158,7 +163,7 @@ static inline void _put2( QMap<QByteArray,quint8>& h, const char** s )
 	}
 }
 
-DocManager::DocManager()
+DocManager::DocManager():d_cancel(false)
 {
 	_put( d_cache, s_ContentObject );
 	_put( d_cache, s_Document );
@@ -178,6 +183,7 @@ Sdb::Obj DocManager::importStream( const QString& path )
 {
 	d_error.clear();
 	d_nrToOid.clear();
+	d_bulk.clear();
 	d_customObjAttr.clear();
 	d_customModAttr.clear();
 
@@ -276,6 +282,9 @@ Sdb::Obj DocManager::importStream( const QString& path )
 			t = in.nextToken();
 		}
 
+		d_bulk.flush( doc.getTxn() );
+		updateHashes( doc );
+
 		DataWriter w;
 		QSet<quint32>::const_iterator i;
 		for( i = d_customObjAttr.begin(); i != d_customObjAttr.end(); ++i )
@@ -294,12 +303,14 @@ Sdb::Obj DocManager::importStream( const QString& path )
 	{
 		d_error += tr("invalid stream file format\n");
 		d_error += e.getCodeString() + " " + e.getMsg();
+		d_bulk.clear();
 		AppContext::inst()->getTxn()->rollback();
 		lock.rollback();
 		return Obj();
 	}catch( std::exception& e )
 	{
 		d_error += e.what();
+		d_bulk.clear();
 		AppContext::inst()->getTxn()->rollback();
 		lock.rollback();
 		return Obj();
@@ -328,6 +339,8 @@ bool DocManager::readAttr( Stream::DataReader& in, Sdb::Obj& obj, quint32 id )
 		v.setAtom( getHistAttr( v.getStr().toLatin1() ) );
 	else if( id == AttrHistType )
 		v.setUInt8( d_cache2.value( v.getStr().toLatin1() ) );
+	if( TypeDefs::isPackable( id ) )
+		v = TypeDefs::pack( v );
 	obj.setValue( id, v ); 
 	if( id == AttrObjIdent )
 		d_nrToOid[v.getInt32()] = obj.getId();
@@ -365,17 +378,17 @@ bool DocManager::readObjAttr( Stream::DataReader& in, Sdb::Obj& o )
 	return readAttr( in, o, id );
 }
 
-static inline void _aggr( Sdb::Obj& obj, Sdb::Obj& super, const Sdb::Obj& doc )
+static inline void _aggr( Sdb::Obj& obj, Sdb::Obj& super, const Sdb::Obj& doc, BulkIndex& bulk )
 {
 	obj.aggregateTo( super );
-	obj.setValue( AttrObjDocId, doc.getValue( AttrDocId ) );
+	bulk.setDocId( obj, doc.getValue( AttrDocId ) );
 	obj.setValue( AttrObjHomeDoc, doc );
 }
 
 bool DocManager::readPic( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 {
 	Obj obj = AppContext::inst()->getTxn()->createObject( TypePicture );
-	_aggr( obj, super, doc );
+	_aggr( obj, super, doc, d_bulk );
 	DataReader::Token t = in.nextToken();
 	while( DataReader::isUseful( t ) )
 	{
@@ -385,7 +398,7 @@ bool DocManager::readPic( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 			{
 				QImage img;
 				in.readValue().getImage( img );
-				obj.setValue( AttrPicImage, DataCell().setImage( img ) );
+				obj.setValue( AttrPicImage, TypeDefs::pack( DataCell().setImage( img ) ) );
 			}else
 			{
 				if( !readObjAttr( in, obj ) )
@@ -409,7 +422,7 @@ bool DocManager::readPic( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 bool DocManager::readTbl( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 {
 	Obj tbl = AppContext::inst()->getTxn()->createObject( TypeTable );
-	_aggr( tbl, super, doc );
+	_aggr( tbl, super, doc, d_bulk );
 	enum State { ReadingHead, ReadingRow, ReadingCell };
 	State state = ReadingHead;
 	Obj row; 
@@ -430,7 +443,7 @@ bool DocManager::readTbl( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 				if( name == "row" )
 				{
 					row = AppContext::inst()->getTxn()->createObject( TypeTableRow );
-					_aggr( row, tbl, doc );
+					_aggr( row, tbl, doc, d_bulk );
 					state = ReadingRow;
 				}else
 				{
@@ -453,7 +466,7 @@ bool DocManager::readTbl( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 				if( name == "cell" )
 				{
 					cell = AppContext::inst()->getTxn()->createObject( TypeTableCell );
-					_aggr( cell, row, doc );
+					_aggr( cell, row, doc, d_bulk );
 					state = ReadingCell;
 				}else
 				{
@@ -503,7 +516,7 @@ Obj DocManager::splitTitleBody( Sdb::Obj& title, const Sdb::Obj& doc )
 		// das erste Subobject von Titel ist.
 		body = AppContext::inst()->getTxn()->createObject( TypeSection );
 		d_nrToOid[ title.getValue( AttrObjIdent ).getInt32() ] = body.getId();
-		_aggr( body, title, doc );
+		_aggr( body, title, doc, d_bulk );
 		body.setValue( AttrObjText, title.getValue( AttrObjText ) );
 		title.setValue( AttrObjText, title.getValue( AttrStubTitle ) );
 		title.setValue( AttrStubTitle, DataCell().setNull() );
@@ -515,7 +528,6 @@ Obj DocManager::splitTitleBody( Sdb::Obj& title, const Sdb::Obj& doc )
 		body.setValue( AttrObjDeleted, title.getValue( AttrObjDeleted ) );
 		body.setValue( AttrObjHomeDoc, title.getValue( AttrObjHomeDoc ) );
 		body.setValue( AttrObjNumber, title.getValue( AttrObjNumber ) );
-		body.setValue( AttrObjDocId, title.getValue( AttrObjDocId ) );
 
 		body.setValue( AttrCreatedBy, title.getValue( AttrCreatedBy ) );
 		body.setValue( AttrCreatedOn, title.getValue( AttrCreatedOn ) );
@@ -537,7 +549,7 @@ Obj DocManager::splitTitleBody( Sdb::Obj& title, const Sdb::Obj& doc )
 bool DocManager::readObj( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 {
 	Obj title = AppContext::inst()->getTxn()->createObject( TypeTitle );
-	_aggr( title, super, doc );
+	_aggr( title, super, doc, d_bulk );
 	Obj body = title;
 	DataReader::Token t = in.nextToken();
 	bool titleBodyChecked = false;
@@ -598,7 +610,7 @@ bool DocManager::readObj( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 bool DocManager::readStub( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 {
 	Obj obj = AppContext::inst()->getTxn()->createObject( TypeStub );
-	_aggr( obj, super, doc );
+	_aggr( obj, super, doc, d_bulk );
 	DataReader::Token t = in.nextToken();
 	while( DataReader::isUseful( t ) )
 	{
@@ -623,7 +635,7 @@ bool DocManager::readStub( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc
 bool DocManager::readLout( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 {
 	Obj lnk = AppContext::inst()->getTxn()->createObject( TypeOutLink );
-	_aggr( lnk, super, doc );
+	_aggr( lnk, super, doc, d_bulk );
 	DataReader::Token t = in.nextToken();
 	while( DataReader::isUseful( t ) )
 	{
@@ -656,7 +668,7 @@ bool DocManager::readLout( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc
 bool DocManager::readLin( DataReader& in, Sdb::Obj& super, const Sdb::Obj& doc )
 {
 	Obj lnk = AppContext::inst()->getTxn()->createObject( TypeInLink );
-	_aggr( lnk, super, doc );
+	_aggr( lnk, super, doc, d_bulk );
 	DataReader::Token t = in.nextToken();
 	while( DataReader::isUseful( t ) )
 	{
@@ -1153,7 +1165,7 @@ QByteArray DocManager::transformBml( const QByteArray& bml )
 		return out.getStream();
 }
 
-bool DocManager::deleteHistoOfObj( Sdb::Obj obj )
+static void _deleteHistoSlots( Sdb::Obj obj )
 {
 	Sdb::Qit i = obj.getFirstSlot(); 
 	if( !i.isNull() ) do
@@ -1167,6 +1179,11 @@ bool DocManager::deleteHistoOfObj( Sdb::Obj obj )
 	}while( i.next() );
 	obj.setValue( AttrObjAttrChanged, DataCell() );
 	obj.setValue( AttrObjTextChanged, DataCell() );
+}
+
+bool DocManager::deleteHistoOfObj( Sdb::Obj obj )
+{
+	_deleteHistoSlots( obj );
 	Sdb::Obj o = obj.getFirstObj();
 	if( !o.isNull() ) do
 	{
@@ -1193,24 +1210,242 @@ bool DocManager::deleteHisto( Sdb::Obj doc )
 	return true;
 }
 
-static inline qint32 _pred( Sdb::Obj o )
+static QVector<bool> _lis( const QVector<int>& seq )
+{
+	// Longest Increasing Subsequence in O(n log n); true fr die Elemente, die darin liegen
+	QVector<int> tails; // Index des kleinsten Endes einer Folge der Lnge i+1
+	QVector<int> prev( seq.size(), -1 );
+	for( int i = 0; i < seq.size(); i++ )
+	{
+		int lo = 0;
+		int hi = tails.size();
+		while( lo < hi )
+		{
+			const int mid = ( lo + hi ) / 2;
+			if( seq[ tails[mid] ] < seq[i] )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if( lo > 0 )
+			prev[i] = tails[lo - 1];
+		if( lo == tails.size() )
+			tails.append( i );
+		else
+			tails[lo] = i;
+	}
+	QVector<bool> res( seq.size(), false );
+	int i = ( tails.isEmpty() ) ? -1 : tails.last();
+	while( i >= 0 )
+	{
+		res[i] = true;
+		i = prev[i];
+	}
+	return res;
+}
+
+void DocManager::detectMoves( Sdb::Obj super )
+{
+	// Die Unterobjekte, die schon im alten Dokument unter demselben Owner standen, werden
+	// in der neuen Reihenfolge mit ihrer alten Position verglichen. Die lngste aufsteigende
+	// Teilfolge gilt als unverschoben, nur die brigen werden als verschoben markiert.
+	// Einfuegen oder Lschen von Geschwistern verschiebt damit nichts.
+	QVector<quint64> oids;
+	QVector<int> seq;
+	const DataCell ownerId = super.getValue( AttrObjIdent );
+	Sdb::Obj obj = super.getFirstObj();
+	if( !obj.isNull() ) do
+	{
+		const DataCell v = obj.getValue( AttrObjIdent );
+		const quint64 id = ( v.isNull() ) ? 0 : d_nrToOid.value( v.getInt32() );
+		if( id == 0 )
+			continue; // neu erzeugt
+		Sdb::Obj lhs = obj.getTxn()->getObject( id );
+		if( !obj.getValue( AttrTitleSplit ).isNull() && !lhs.getValue( AttrSecSplit ).isNull() )
+			lhs = lhs.getOwner(); // d_nrToOid zeigt bei Split auf den Body
+		if( !lhs.getOwner().getValue( AttrObjIdent ).equals( ownerId ) )
+			continue; // Owner gewechselt, wird von addDiffTask erkannt
+		QHash<quint64,int>::const_iterator j = d_order.find( lhs.getId() );
+		if( j == d_order.end() )
+			continue;
+		oids.append( obj.getId() );
+		seq.append( j.value() );
+	}while( obj.next() );
+	const QVector<bool> keep = _lis( seq );
+	for( int i = 0; i < keep.size(); i++ )
+	{
+		if( !keep[i] )
+			d_moved.insert( oids[i] );
+	}
+}
+
+class _SliceJob : public QThread
+{
+public:
+	typedef void (*Fn)( void* data, int i );
+	Fn d_fn;
+	void* d_data;
+	int d_from;
+	int d_to;
+	_SliceJob( Fn fn, void* data, int from, int to ):d_fn(fn),d_data(data),d_from(from),d_to(to) {}
+protected:
+	void run()
+	{
+		for( int i = d_from; i < d_to; i++ )
+			d_fn( d_data, i );
+	}
+};
+
+static const int s_minSlice = 512; // kleinere Ausschnitte lohnen keinen eigenen Thread
+
+static void _runParallel( _SliceJob::Fn fn, void* data, int count )
+{
+	// fn darf nicht auf die Datenbank zugreifen
+	const int n = qMin( QThread::idealThreadCount(), count / s_minSlice );
+	if( n <= 1 )
+	{
+		for( int i = 0; i < count; i++ )
+			fn( data, i );
+		return;
+	}
+	QList<_SliceJob*> jobs;
+	const int step = ( count + n - 1 ) / n;
+	for( int from = 0; from < count; from += step )
+	{
+		_SliceJob* job = new _SliceJob( fn, data, from, qMin( from + step, count ) );
+		jobs.append( job );
+		job->start();
+	}
+	for( int i = 0; i < jobs.size(); i++ )
+	{
+		jobs[i]->wait();
+		delete jobs[i];
+	}
+}
+
+static inline bool _isHashed( quint32 attr )
 {
-	o.prev();
+	// Genau die Attribute, die AttrSelectDlg zum Vergleich anbietet
+	return attr >= DsMax || attr == AttrCreatedBy || attr == AttrCreatedOn || 
+		attr == AttrModifiedBy || attr == AttrModifiedOn || attr == AttrCreatedThru || 
+		attr == AttrObjNumber || attr == AttrObjShort || attr == AttrObjText;
+}
+
+struct _HashTask
+{
+	quint64 d_oid;
+	QList< QPair<quint32,DataCell> > d_vals; // Kopie der Werte, damit der Thread nicht auf die Db zugreift
+	QByteArray d_hash;
+};
+
+static void _hashTask( void* data, int i )
+{
+	_HashTask& t = static_cast<_HashTask*>( data )[i];
+	QMap<quint32,quint64> map;
+	for( int j = 0; j < t.d_vals.size(); j++ )
+	{
+		DataWriter w;
+		w.writeSlot( TypeDefs::unpack( t.d_vals[j].second ) ); // Hash unabhaengig von der Speicherform
+		const QByteArray md5 = QCryptographicHash::hash( w.getStream(), QCryptographicHash::Md5 );
+		map[ t.d_vals[j].first ] = qFromLittleEndian<quint64>( (const uchar*)md5.constData() );
+	}
+	t.d_vals.clear();
+	QDataStream out( &t.d_hash, QIODevice::WriteOnly );
+	out << map;
+}
+
+static void _snapshot( const Sdb::Obj& o, _HashTask& t )
+{
+	t.d_oid = o.getOid();
+	Sdb::Obj::Names n = o.getNames();
+	Sdb::Obj::Names::const_iterator i;
+	for( i = n.begin(); i != n.end(); ++i )
+	{
+		if( _isHashed( *i ) )
+			t.d_vals.append( qMakePair( quint32(*i), o.getValue( *i ) ) );
+	}
+}
+
+QByteArray DocManager::getHash( const Sdb::Obj& o )
+{
+	const DataCell v = o.getValue( AttrObjHash );
+	if( !v.isNull() )
+		return v.getArr();
+	_HashTask t;
+	_snapshot( o, t );
+	_hashTask( &t, 0 );
+	return t.d_hash;
+}
+
+static void _collectHash( Sdb::Obj obj, QVector<_HashTask>& tasks )
+{
+	// Dieselben Objekte wie _fillMap
+	Sdb::Obj o = obj.getFirstObj();
 	if( !o.isNull() ) do
 	{
-		DataCell v = o.getValue( AttrObjIdent );
-		if( v.isInt32() )
-			return v.getInt32();
-	}while( o.prev() );
-	return 0;
+		if( o.getType() != TypeStub && !o.getValue( AttrObjIdent ).isNull() )
+		{
+			if( o.getValue( AttrObjHash ).isNull() )
+			{
+				_HashTask t;
+				_snapshot( o, t );
+				tasks.append( t );
+			}
+			_collectHash( o, tasks );
+		}
+	}while( o.next() );
+}
+
+static void _storeHashes( Sdb::Transaction* txn, _HashTask* tasks, int count )
+{
+	_runParallel( _hashTask, tasks, count );
+	for( int i = 0; i < count; i++ )
+	{
+		txn->getObject( tasks[i].d_oid ).setValue( AttrObjHash, DataCell().setLob( tasks[i].d_hash ) );
+		tasks[i].d_hash.clear();
+	}
 }
 
-bool DocManager::createDiff( Sdb::Obj lhs, Sdb::Obj rhs, Sdb::Obj own, const QList<quint32>& attrs )
+void DocManager::updateHashes( Sdb::Obj doc )
+{
+	QVector<_HashTask> tasks;
+	_collectHash( doc, tasks );
+	if( tasks.isEmpty() )
+		return;
+	_storeHashes( doc.getTxn(), tasks.data(), tasks.size() );
+}
+
+struct _CmpCtx
+{
+	DocManager::DiffTask* d_tasks;
+	const QList<quint32>* d_attrs;
+};
+
+static void _cmpTask( void* data, int i )
+{
+	_CmpCtx* ctx = static_cast<_CmpCtx*>( data );
+	DocManager::DiffTask& t = ctx->d_tasks[i];
+	if( t.d_lhs == 0 || t.d_lhsHash == t.d_rhsHash )
+		return; // neu erzeugt oder unverndert
+	QMap<quint32,quint64> l;
+	QMap<quint32,quint64> r;
+	QDataStream in1( t.d_lhsHash );
+	in1 >> l;
+	QDataStream in2( t.d_rhsHash );
+	in2 >> r;
+	for( int j = 0; j < ctx->d_attrs->size(); j++ )
+	{
+		const quint32 a = ctx->d_attrs->at( j );
+		if( l.value( a ) != r.value( a ) ) // 0..Attribut nicht vorhanden
+			t.d_changed.append( a );
+	}
+}
+
+void DocManager::createDiff( Sdb::Obj lhs, Sdb::Obj rhs, Sdb::Obj own, const DiffTask& t )
 {
-	bool diff = false;
 	if( lhs.isNull() )
 	{
-		Sdb::Obj hr = AppContext::inst()->getTxn()->createObject( TypeHistory );
+		Sdb::Obj hr = rhs.getTxn()->createObject( TypeHistory );
 		own.appendSlot( hr );
 		rhs.appendSlot( hr );
 		hr.setValue( AttrHistType, DataCell().setUInt8( HistoryType_createObject ) );
@@ -1219,92 +1454,106 @@ bool DocManager::createDiff( Sdb::Obj lhs, Sdb::Obj rhs, Sdb::Obj own, const QLi
 		hr.setValue( AttrHistDate, rhs.getValue( AttrModifiedOn ) );
 		rhs.setValue( AttrObjAttrChanged, DataCell().setBool( true ) );
 		rhs.setValue( AttrObjTextChanged, DataCell().setBool( true ) );
-		diff = true;
-	}else
+		return;
+	}
+	if( t.d_changed.isEmpty() && !t.d_moved )
+		return;
+	for( int i = 0; i < t.d_changed.size(); i++ )
 	{
-		for( int i = 0; i < attrs.size(); i++ )
-		{
-			DataCell l = lhs.getValue( attrs[i] );
-			DataCell r = rhs.getValue( attrs[i] );
-			if( !l.equals( r ) )
-			{
-				diff = true;
-				Sdb::Obj hr = AppContext::inst()->getTxn()->createObject( TypeHistory );
-				own.appendSlot( hr );
-				rhs.appendSlot( hr );
-				if( attrs[i] == AttrObjText )
-					rhs.setValue( AttrObjTextChanged, DataCell().setBool( true ) );
-
-				hr.setValue( AttrHistType, DataCell().setUInt8( HistoryType_modifyObject ) );
-				hr.setValue( AttrHistObjId, rhs.getValue( AttrObjIdent ) );
-				hr.setValue( AttrHistAttr, DataCell().setAtom( attrs[i] ) );
-				hr.setValue( AttrHistOld, l );
-				hr.setValue( AttrHistNew, r );
-				hr.setValue( AttrHistAuthor, rhs.getValue( AttrModifiedBy ) );
-				hr.setValue( AttrHistDate, rhs.getValue( AttrModifiedOn ) );
-			}
-		}
-		if( !lhs.getOwner().getValue( AttrObjIdent ).equals( rhs.getOwner().getValue( AttrObjIdent ) ) ||
-			_pred( lhs ) != _pred( rhs ) )
-		{
-			Sdb::Obj hr = AppContext::inst()->getTxn()->createObject( TypeHistory );
-			own.appendSlot( hr );
-			rhs.appendSlot( hr );
-			hr.setValue( AttrHistType, DataCell().setUInt8( HistoryType_clipMoveObject ) );
-			hr.setValue( AttrHistObjId, rhs.getValue( AttrObjIdent ) );
-			hr.setValue( AttrHistAuthor, rhs.getValue( AttrModifiedBy ) );
-			hr.setValue( AttrHistDate, rhs.getValue( AttrModifiedOn ) );
-			diff = true;
-		}
-		if( diff )
-		{
-			rhs.setValue( AttrObjAttrChanged, DataCell().setBool( true ) );
-		}
+		const quint32 a = t.d_changed[i];
+		Sdb::Obj hr = rhs.getTxn()->createObject( TypeHistory );
+		own.appendSlot( hr );
+		rhs.appendSlot( hr );
+		if( a == AttrObjText )
+			rhs.setValue( AttrObjTextChanged, DataCell().setBool( true ) );
+
+		hr.setValue( AttrHistType, DataCell().setUInt8( HistoryType_modifyObject ) );
+		hr.setValue( AttrHistObjId, rhs.getValue( AttrObjIdent ) );
+		hr.setValue( AttrHistAttr, DataCell().setAtom( a ) );
+		hr.setValue( AttrHistOld, TypeDefs::pack( lhs.getValue( a ) ) );
+		hr.setValue( AttrHistNew, TypeDefs::pack( rhs.getValue( a ) ) );
+		hr.setValue( AttrHistAuthor, rhs.getValue( AttrModifiedBy ) );
+		hr.setValue( AttrHistDate, rhs.getValue( AttrModifiedOn ) );
+	}
+	if( t.d_moved )
+	{
+		Sdb::Obj hr = rhs.getTxn()->createObject( TypeHistory );
+		own.appendSlot( hr );
+		rhs.appendSlot( hr );
+		hr.setValue( AttrHistType, DataCell().setUInt8( HistoryType_clipMoveObject ) );
+		hr.setValue( AttrHistObjId, rhs.getValue( AttrObjIdent ) );
+		hr.setValue( AttrHistAuthor, rhs.getValue( AttrModifiedBy ) );
+		hr.setValue( AttrHistDate, rhs.getValue( AttrModifiedOn ) );
 	}
-	return diff;
+	rhs.setValue( AttrObjAttrChanged, DataCell().setBool( true ) );
 }
 
-bool DocManager::createHistoOfObj( Sdb::Obj super, Sdb::Obj doc, Sdb::Obj own, const QList<quint32>& attrs )
+void DocManager::addDiffTask( Sdb::Obj lhs, Sdb::Obj rhs, QVector<DiffTask>& tasks )
 {
-	// Jedes Objekt rekursiv durchlaufen und Existenz, Attribute, und Position vergleichen
+	DiffTask t;
+	t.d_rhs = rhs.getOid();
+	if( !lhs.isNull() )
+	{
+		t.d_lhs = lhs.getOid();
+		t.d_lhsHash = getHash( lhs ); // fehlende Hashes setzt erst applyHisto
+		t.d_rhsHash = getHash( rhs );
+		t.d_moved = !lhs.getOwner().getValue( AttrObjIdent ).equals( rhs.getOwner().getValue( AttrObjIdent ) ) ||
+			d_moved.contains( rhs.getId() );
+	}
+	tasks.append( t );
+}
+
+bool DocManager::createHistoOfObj( Sdb::Obj super, QVector<DiffTask>& tasks )
+{
+	// Jedes Objekt rekursiv durchlaufen und Existenz und Position feststellen; 
+	// die Attribute werden danach parallel anhand AttrObjHash verglichen
+	detectMoves( super );
 	Sdb::Obj obj = super.getFirstObj();
 	if( !obj.isNull() ) do
 	{
-		// TODO: Links, Stubs
+		if( !createHistoOfSub( obj, tasks ) )
+			return false;
+	}while( obj.next() );
+	return true;
+}
+
+bool DocManager::createHistoOfSub( Sdb::Obj obj, QVector<DiffTask>& tasks )
+{
+	// TODO: Links, Stubs
 
-		DataCell v = obj.getValue( AttrObjIdent );
-		if( !v.isNull() )
+	DataCell v = obj.getValue( AttrObjIdent );
+	if( !v.isNull() )
+	{
+		QMap<quint32,quint64>::iterator j = d_nrToOid.find( v.getInt32() );
+		if( j == d_nrToOid.end() )
 		{
-			QMap<quint32,quint64>::iterator j = d_nrToOid.find( v.getInt32() );
-			if( j == d_nrToOid.end() )
-			{
-				// Das Objekt wurde neu erzeugt
-				createDiff( Sdb::Obj(), obj, own, attrs );
-			}else if( obj.getValue( AttrTitleSplit ).isNull() )
-			{
-				// Im Falle von Split wird erst Body betrachtet, dann Title
-				if( j.value() == 0 )
-					return false; // Darf nicht vorkommen
-				// Das Objekt existierte bereits
-				Sdb::Obj lhs = obj.getTxn()->getObject( j.value() );
-				if( lhs.getType() != obj.getType() )
-					lhs = Sdb::Obj(); // Nicht Diff zwischen Title und Section
-				createDiff( lhs, obj, own, attrs );
-				j.value() = 0; // Markiere Objekt als konsumiert
-
-				if( !lhs.isNull() && !lhs.getValue( AttrSecSplit ).isNull() && !obj.getValue( AttrSecSplit ).isNull() )
-					// Wenn beide Splits sind, wurde Owner noch nicht verglichen (da AbsNo gleich mit Sub)
-					createDiff( lhs.getOwner(), obj.getOwner(), own, attrs );
-			}
-			createHistoOfObj( obj, doc, own, attrs );
+			// Das Objekt wurde neu erzeugt
+			addDiffTask( Sdb::Obj(), obj, tasks );
+		}else if( obj.getValue( AttrTitleSplit ).isNull() )
+		{
+			// Im Falle von Split wird erst Body betrachtet, dann Title
+			if( j.value() == 0 )
+				return false; // Darf nicht vorkommen
+			// Das Objekt existierte bereits
+			Sdb::Obj lhs = obj.getTxn()->getObject( j.value() );
+			if( lhs.getType() != obj.getType() )
+				lhs = Sdb::Obj(); // Nicht Diff zwischen Title und Section
+			addDiffTask( lhs, obj, tasks );
+			j.value() = 0; // Markiere Objekt als konsumiert
+
+			if( !lhs.isNull() && !lhs.getValue( AttrSecSplit ).isNull() && !obj.getValue( AttrSecSplit ).isNull() )
+				// Wenn beide Splits sind, wurde Owner noch nicht verglichen (da AbsNo gleich mit Sub)
+				addDiffTask( lhs.getOwner(), obj.getOwner(), tasks );
 		}
-	}while( obj.next() );
+		createHistoOfObj( obj, tasks );
+	}
 	return true;
 }
 
-static void _fillMap( QMap<quint32,quint64>& map, Sdb::Obj obj )
+static void _fillMap( QMap<quint32,quint64>& map, QHash<quint64,int>& order, Sdb::Obj obj )
 {
 	// Da Top Down wird jeweils Title durch Body berschrieben im Falle AttrSecSplit
+	// order: Position in Dokumentreihenfolge, fr detectMoves
 	Sdb::Obj i = obj.getFirstObj();
 	if( !i.isNull() ) do
 	{
@@ -1312,47 +1561,200 @@ static void _fillMap( QMap<quint32,quint64>& map, Sdb::Obj obj )
 		if( i.getType() != TypeStub && !v.isNull() )
 		{
 			map[v.getInt32()] = i.getId();
-			_fillMap( map, i );
+			const int pos = order.size();
+			order[i.getId()] = pos;
+			_fillMap( map, order, i );
 		}
 	}while( i.next() );
 }
 
-bool DocManager::createHisto( Sdb::Obj prev, Sdb::Obj doc, const QList<quint32>& attrs )
+static void _compareTasks( QVector<DocManager::DiffTask>& tasks, const QList<quint32>& attrs )
 {
-	if( prev.getType() != TypeDocument )
-		return false;
-	if( !deleteHisto( doc ) )
-		return false;
-	doc.setValue( AttrDocDiffSource, prev );
+	_CmpCtx ctx;
+	ctx.d_tasks = tasks.data();
+	ctx.d_attrs = &attrs;
+	_runParallel( _cmpTask, &ctx, tasks.size() );
+	for( int i = 0; i < tasks.size(); i++ )
+	{
+		// Hashes werden nach dem Vergleich nicht mehr gebraucht
+		tasks[i].d_lhsHash.clear();
+		tasks[i].d_rhsHash.clear();
+	}
+}
+
+// Liest ohne ReadConnection direkt, sonst in einem kurzen Reader-Block
+struct _ReadBlock
+{
+	ReadConnection::Reader* d_lock;
+	_ReadBlock( ReadConnection* s ):d_lock( ( s ) ? new ReadConnection::Reader( *s ) : 0 ) {}
+	~_ReadBlock() { delete d_lock; }
+};
+
+bool DocManager::compareHisto( Sdb::Obj prev, Sdb::Obj doc, const QList<quint32>& attrs, 
+							  HistoDiff& diff, ReadConnection* conn )
+{
+	diff = HistoDiff();
 	d_nrToOid.clear();
-	_fillMap( d_nrToOid, prev );
-	Sdb::Obj own = doc.getObject(AttrDocOwning);
-	if( !createHistoOfObj( doc, doc, own, attrs ) )
-		return false;
-	QMap<quint32,quint64>::iterator j;
-	for( j = d_nrToOid.begin(); j != d_nrToOid.end(); ++j )
+	d_order.clear();
+	d_moved.clear();
+	QList<Sdb::Obj> tops;
 	{
-		if( j.value() != 0 )
+		_ReadBlock lock( conn );
+		if( prev.getType() != TypeDocument || doc.getType() != TypeDocument )
+			return false;
+		_fillMap( d_nrToOid, d_order, prev );
+		detectMoves( doc );
+		Sdb::Obj obj = doc.getFirstObj();
+		if( !obj.isNull() ) do
+		{
+			tops.append( obj );
+		}while( obj.next() );
+	}
+
+	// Pro Hauptabschnitt lesen und danach parallel vergleichen
+	for( int i = 0; i < tops.size(); i++ )
+	{
+		if( d_cancel )
 		{
-			// Objekt existierte im alten aber nicht mehr im neuen Dokument
-			Sdb::Obj hr = AppContext::inst()->getTxn()->createObject( TypeHistory );
-			own.appendSlot( hr );
-			doc.appendSlot( hr );
-			hr.setValue( AttrHistType, DataCell().setUInt8( HistoryType_deleteObject ) );
-			hr.setValue( AttrHistObjId, DataCell().setOid( j.value() ) );
-			hr.setValue( AttrHistAuthor, doc.getValue( AttrModifiedBy ) );
-			hr.setValue( AttrHistDate, doc.getValue( AttrModifiedOn ) );
-			Sdb::Obj o = hr.getTxn()->getObject( j.value() );
-			if( !o.isNull() )
-				hr.setValue( AttrHistInfo, DataCell().setString( 
-					QString( "%1 %2" ).arg( o.getValue( AttrObjNumber ).getStr() ).
-					arg( TypeDefs::elided( o.getValue( AttrObjText ), 0 ) ) ) );
+			d_error = tr("cancelled");
+			return false;
+		}
+		QVector<DiffTask> tasks;
+		{
+			_ReadBlock lock( conn );
+			emit progress( i, tops.size(), QString( "%1 %2" ).arg( tops[i].getValue( AttrObjNumber ).getStr() ).
+				arg( TypeDefs::elided( tops[i].getValue( AttrObjText ), 40 ) ) );
+			if( !createHistoOfSub( tops[i], tasks ) )
+				return false;
 		}
+		_compareTasks( tasks, attrs );
+		diff.d_tasks += tasks;
+	}
+	emit progress( tops.size(), tops.size(), QString() );
+	QMap<quint32,quint64>::const_iterator j;
+	for( j = d_nrToOid.begin(); j != d_nrToOid.end(); ++j )
+	{
+		if( j.value() != 0 )
+			diff.d_deleted.append( j.value() );
 	}
 	d_nrToOid.clear();
+	d_order.clear();
+	d_moved.clear();
 	return true;
 }
 
+static const int s_applyChunk = 1000; // applyHisto: Objekte zwischen zwei progress
+
+bool DocManager::applyProgress( int done, int total, const QString& what )
+{
+	if( d_cancel )
+	{
+		d_error = tr("cancelled");
+		return false;
+	}
+	emit progress( done, total, what );
+	return true;
+}
+
+bool DocManager::applyHisto( Sdb::Obj prev, Sdb::Obj doc, const HistoDiff& diff )
+{
+	// Alles in doc.getTxn(); erst der Commit des Aufrufers ersetzt die alte History. Geschrieben
+	// wird in Portionen; dazwischen kommt progress und cancel() wird geprueft.
+	if( prev.getType() != TypeDocument || doc.getType() != TypeDocument )
+		return false;
+	d_error.clear();
+	Sdb::Transaction* txn = doc.getTxn();
+
+	// Dokumente, die vor AttrObjHash importiert wurden, erhalten hier ihre Hashes
+	QVector<_HashTask> hashes;
+	_collectHash( prev, hashes );
+	_collectHash( doc, hashes );
+	QList<Sdb::Obj> tops;
+	Sdb::Obj obj = doc.getFirstObj();
+	if( !obj.isNull() ) do
+	{
+		tops.append( obj );
+	}while( obj.next() );
+
+	const int total = tops.size() + hashes.size() + diff.d_tasks.size() + diff.d_deleted.size();
+	int done = 0;
+
+	// 1. Bisherige History entfernen, pro Hauptabschnitt
+	_deleteHistoSlots( doc );
+	for( int i = 0; i < tops.size(); i++ )
+	{
+		if( !applyProgress( done, total, tr("Removing old history") ) )
+			return false;
+		if( !deleteHistoOfObj( tops[i] ) )
+			return false;
+		done++;
+	}
+	Sdb::Qit q = doc.getObject(AttrDocOwning).getFirstSlot(); // referenziert alle TypeHistory
+	if( !q.isNull() ) do
+	{
+		q.erase();
+	}while( q.next() );
+
+	// 2. Fehlende Hashes
+	for( int i = 0; i < hashes.size(); i += s_applyChunk )
+	{
+		if( !applyProgress( done, total, tr("Storing object hashes") ) )
+			return false;
+		const int n = qMin( s_applyChunk, hashes.size() - i );
+		_storeHashes( txn, hashes.data() + i, n );
+		done += n;
+	}
+	hashes.clear();
+
+	// 3. History-Records der geaenderten und neuen Objekte
+	Sdb::Obj own = doc.getObject(AttrDocOwning);
+	for( int i = 0; i < diff.d_tasks.size(); i++ )
+	{
+		if( i % s_applyChunk == 0 && !applyProgress( done, total, tr("Creating history records") ) )
+			return false;
+		done++;
+		const DiffTask& t = diff.d_tasks[i];
+		Sdb::Obj rhs = txn->getObject( t.d_rhs );
+		if( rhs.isNull() )
+			continue; // seit dem Vergleich geloescht
+		Sdb::Obj lhs;
+		if( t.d_lhs )
+			lhs = txn->getObject( t.d_lhs );
+		createDiff( lhs, rhs, own, t );
+	}
+
+	// 4. Objekte, die im alten aber nicht mehr im neuen Dokument existieren
+	for( int i = 0; i < diff.d_deleted.size(); i++ )
+	{
+		if( i % s_applyChunk == 0 && !applyProgress( done, total, tr("Creating history records") ) )
+			return false;
+		done++;
+		Sdb::Obj hr = txn->createObject( TypeHistory );
+		own.appendSlot( hr );
+		doc.appendSlot( hr );
+		hr.setValue( AttrHistType, DataCell().setUInt8( HistoryType_deleteObject ) );
+		hr.setValue( AttrHistObjId, DataCell().setOid( diff.d_deleted[i] ) );
+		hr.setValue( AttrHistAuthor, doc.getValue( AttrModifiedBy ) );
+		hr.setValue( AttrHistDate, doc.getValue( AttrModifiedOn ) );
+		Sdb::Obj o = txn->getObject( diff.d_deleted[i] );
+		if( !o.isNull() )
+			hr.setValue( AttrHistInfo, DataCell().setString( 
+				QString( "%1 %2" ).arg( o.getValue( AttrObjNumber ).getStr() ).
+				arg( TypeDefs::elided( o.getValue( AttrObjText ), 0 ) ) ) );
+	}
+	doc.setValue( AttrDocDiffSource, prev );
+	emit progress( total, total, QString() );
+	return true;
+}
+
+bool DocManager::createHisto( Sdb::Obj prev, Sdb::Obj doc, const QList<quint32>& attrs )
+{
+	HistoDiff diff;
+	if( !compareHisto( prev, doc, attrs, diff ) )
+		return false;
+	return applyHisto( prev, doc, diff );
+}
+
 bool DocManager::deleteDoc( Sdb::Obj doc )
 {
 	if( doc.getType() != TypeDocument )
@@ -1471,3 +1873,23 @@ bool DocManager::deleteAnnots( Sdb::Obj doc, bool reset )
 		return false;
 	}
 }
+
+void BulkIndex::setDocId( const Sdb::Obj& obj, const Stream::DataCell& docId )
+{
+	d_pending.append( qMakePair( obj.getOid(), docId ) );
+}
+
+void BulkIndex::flush( Sdb::Transaction* txn )
+{
+	// Sortiert nach dem Schluessel von IdxDocObjId; AttrObjIdent ist hier bereits gesetzt
+	QList<QPair<qint32,int> > order;
+	for( int i = 0; i < d_pending.size(); i++ )
+		order.append( qMakePair( txn->getObject( d_pending[i].first ).getValue( AttrObjIdent ).getInt32(), i ) );
+	qSort( order );
+	for( int i = 0; i < order.size(); i++ )
+	{
+		const QPair<quint64,Stream::DataCell>& p = d_pending[ order[i].second ];
+		txn->getObject( p.first ).setValue( AttrObjDocId, p.second );
+	}
+	d_pending.clear();
+}
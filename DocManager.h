@@ -24,11 +24,28 @@
 #include <QHash>
 #include <QSet>
 #include <QList>
+#include <QVector>
 
 namespace Ds
 {
+	class ReadConnection;
+
+	// Bulk-Load fuer Importe: AttrObjDocId, das fuehrende Feld von IdxDocObjId, wird gesammelt und
+	// erst vor dem Commit nach AttrObjIdent sortiert gesetzt. So entsteht pro Objekt genau ein
+	// Indexeintrag, und zwar in Schluesselreihenfolge statt verstreut ueber die Import-Reihenfolge.
+	class BulkIndex
+	{
+	public:
+		void setDocId( const Sdb::Obj& obj, const Stream::DataCell& docId );
+		void flush( Sdb::Transaction* );
+		void clear() { d_pending.clear(); }
+	private:
+		QList<QPair<quint64,Stream::DataCell> > d_pending;
+	};
+
 	class DocManager : public QObject
 	{
+		Q_OBJECT
 	public:
 		DocManager();
 		~DocManager();
@@ -36,13 +53,44 @@ namespace Ds
 		bool deleteObj( Sdb::Obj );
 		bool deleteHisto( Sdb::Obj doc );
 		bool createHisto( Sdb::Obj prev, Sdb::Obj doc, const QList<quint32>& attrs );
+		void cancel() { d_cancel = true; } // aus beliebigem Thread; compare-/applyHisto brechen mit false ab
+		static void updateHashes( Sdb::Obj doc ); // setzt AttrObjHash, wo noch nicht vorhanden
+		static QByteArray getHash( const Sdb::Obj& ); // AttrObjHash oder berechnet, ohne zu speichern
 		bool deleteAnnots( Sdb::Obj doc, bool resetReviewStatus = true );
 		Sdb::Obj importStream( const QString& path ); // return: doc oder null bei fehler
 		const QString& getError() const { return d_error; }
+	signals:
+		void progress( int done, int total, const QString& section );
+	public:
+		struct DiffTask
+		{
+			quint64 d_lhs; // 0..Objekt neu erzeugt
+			quint64 d_rhs;
+			QByteArray d_lhsHash; // AttrObjHash
+			QByteArray d_rhsHash;
+			QList<quint32> d_changed; // Resultat des Vergleichs
+			bool d_moved;
+			DiffTask():d_lhs(0),d_rhs(0),d_moved(false) {}
+		};
+		struct HistoDiff
+		{
+			QVector<DiffTask> d_tasks;
+			QList<quint64> d_deleted; // im alten, nicht mehr im neuen Dokument
+		};
+		// createHisto in zwei Schritten: compareHisto liest nur und darf mit conn im Hintergrund
+		// laufen; applyHisto schreibt portionenweise mit progress in doc.getTxn(), committen bzw.
+		// nach Abbruch zuruecksetzen muss der Aufrufer.
+		bool compareHisto( Sdb::Obj prev, Sdb::Obj doc, const QList<quint32>& attrs, 
+			HistoDiff&, ReadConnection* conn = 0 );
+		bool applyHisto( Sdb::Obj prev, Sdb::Obj doc, const HistoDiff& );
 	protected:
-		bool createDiff( Sdb::Obj lhs, Sdb::Obj rhs, Sdb::Obj own, const QList<quint32>& attrs );
-		bool createHistoOfObj( Sdb::Obj super, Sdb::Obj doc, Sdb::Obj own, const QList<quint32>& attrs );
+		void createDiff( Sdb::Obj lhs, Sdb::Obj rhs, Sdb::Obj own, const DiffTask& );
+		bool createHistoOfObj( Sdb::Obj super, QVector<DiffTask>& );
+		bool createHistoOfSub( Sdb::Obj obj, QVector<DiffTask>& );
+		void addDiffTask( Sdb::Obj lhs, Sdb::Obj rhs, QVector<DiffTask>& );
+		void detectMoves( Sdb::Obj super );
 		bool deleteHistoOfObj( Sdb::Obj obj );
+		bool applyProgress( int done, int total, const QString& ); // false..abgebrochen
 		bool deleteDoc( Sdb::Obj doc );
 		bool deleteFolder( Sdb::Obj folder );
 		bool readAttr( Stream::DataReader&, Sdb::Obj&, quint32 );
@@ -62,6 +110,10 @@ namespace Ds
 	private:
 		QString d_error;
 		QMap<quint32,quint64> d_nrToOid;
+		BulkIndex d_bulk; // importStream
+		QHash<quint64,int> d_order; // createHisto: Position im alten Dokument
+		QSet<quint64> d_moved; // createHisto: verschobene Objekte im neuen Dokument
+		volatile bool d_cancel;
 		QSet<quint32> d_customObjAttr;
 		QSet<quint32> d_customModAttr;
 		QMap<QByteArray,quint32> d_cache; // QHash::value funktioniert nicht. Er findet nichts
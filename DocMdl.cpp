@@ -31,9 +31,13 @@ using namespace Sdb;
 
 DocMdl::DocMdl(QObject *parent)
 	: QAbstractItemModel(parent), d_root(0), d_filter( TitleAndBody ), 
-	  d_onlyHdrTxtChanges( false ), d_luaFilter(LUA_NOREF)
+	  d_onlyHdrTxtChanges( false ), d_luaFilter(LUA_NOREF), d_luaFilterObj( 0 ),
+	  d_filterPending( false ), d_filterOverBudget( false )
 {
 	AppContext::inst()->getDb()->addObserver( this, SLOT(onDbUpdate( Sdb::UpdateInfo )));
+	connect( AppContext::inst(), SIGNAL(batchFinished()), this, SLOT(onBatchFinished()) );
+	connect( FilterCache::inst(), SIGNAL(evaluated(QByteArray,QString)),
+		this, SLOT(onFilterEvaluated(QByteArray,QString)) );
 	d_root = new Slot();
 }
 
@@ -54,6 +58,7 @@ DocMdl::Slot::~Slot()
 void DocMdl::setDoc( const Sdb::Obj& doc )
 {
 	d_doc = doc;
+	applyFilterCache();
 	refill();
 }
 
@@ -61,16 +66,17 @@ void DocMdl::setDoc( const Sdb::Obj& doc, Filter f )
 {
 	d_filter = f;
 	d_doc = doc;
+	applyFilterCache();
 	refill();
 }
 
 void DocMdl::setFilter( Filter f )
 {
 	d_filter = f;
-	refill();
+	refilter();
 }
 
-bool DocMdl::setLuaFilter(const QByteArray& code, const QByteArray &name)
+bool DocMdl::setLuaFilter(const QByteArray& code, const QByteArray &name, quint64 filter )
 {
 	Lua::Engine2* e = Lua::Engine2::getInst();
 	Q_ASSERT( e != 0 );
@@ -85,32 +91,90 @@ bool DocMdl::setLuaFilter(const QByteArray& code, const QByteArray &name)
 		lua_setfield( e->getCtx(), LUA_REGISTRYINDEX, d_luaFilterName );
 		changed = true;
 	}
+	d_luaFilterCode.clear();
+	d_luaFilterBin.clear();
+	d_luaFilterObj = 0;
+	applyFilterCache();
 	if( code.isEmpty() )
 	{
 		if( changed )
-			refill();
+			refilter();
 		return true;
 	}
-	if( !e->pushFunction( code, name ) )
+	// Gespeicherte Filter nicht bei jeder Auswahl neu uebersetzen
+	const QByteArray bin = ( filter ) ?
+				LuaBinding::getCode( AppContext::inst()->getTxn()->getObject( filter ), name ) : code;
+	if( !e->pushFunction( bin, name ) ) // Syntax-Check; Fehler werden hier sofort gemeldet
 	{
 		if( changed )
-			refill();
+			refilter();
 		return false;
 	}
 
 	lua_pushstring( e->getCtx(), code );
 	lua_setfield( e->getCtx(), LUA_REGISTRYINDEX, name );
 	d_luaFilterName = name;
+	d_luaFilterCode = code;
+	d_luaFilterBin = bin;
+	d_luaFilterObj = filter;
 	d_luaFilter = luaL_ref( e->getCtx(), LUA_REGISTRYINDEX );
-	refill();
+	applyFilterCache();
+	refilter();
 	return true;
 }
 
+void DocMdl::applyFilterCache()
+{
+	d_filterKey.clear();
+	d_filterRes = FilterCache::Result();
+	d_filterPending = false;
+	d_filterOverBudget = false;
+	if( d_luaFilterCode.isEmpty() || d_doc.isNull() )
+		return;
+	d_filterKey = FilterCache::makeKey( d_luaFilterCode, d_doc );
+	if( !FilterCache::inst()->find( d_filterKey, d_filterRes, d_luaFilterObj, d_doc.getOid() ) )
+	{
+		// Bis das Resultat vorliegt, zeigt accept das Dokument ungefiltert; onFilterEvaluated macht refilter
+		d_filterPending = true;
+		FilterCache::inst()->evaluate( d_filterKey, d_luaFilterBin, d_luaFilterName, d_doc, d_luaFilterObj );
+	}
+}
+
+void DocMdl::onFilterEvaluated( const QByteArray& key, const QString& error )
+{
+	if( !d_filterPending || key != d_filterKey )
+		return;
+	d_filterPending = false;
+	FilterCache::inst()->find( d_filterKey, d_filterRes ); // sonst Fallback auf callLuaFilter pro Objekt
+	if( !error.isEmpty() )
+	{
+		try
+		{
+			qDebug() << "DocMdl::onFilterEvaluated:" << error;
+			Lua::Engine2::getInst()->error( error.toLatin1() );
+		}catch( const std::exception& e )
+		{
+			qDebug( "DocMdl::onFilterEvaluated: Error calling host: %s", e.what() );
+		}catch( ... )
+		{
+			qDebug( "DocMdl::onFilterEvaluated: unknown exception while calling host" );
+		}
+	}
+	refilter();
+}
+
 bool DocMdl::hasLuaFilter() const
 {
 	return d_luaFilter != LUA_NOREF;
 }
 
+int DocMdl::getFilterProgress() const
+{
+	if( !d_filterPending )
+		return -1;
+	return FilterCache::inst()->getProgress( d_filterKey );
+}
+
 void DocMdl::addCol( const QString& name, quint32 attr )
 {
 	beginInsertColumns( QModelIndex(), d_cols.size(), d_cols.size() );
@@ -127,6 +191,7 @@ void DocMdl::clearCols()
 
 void DocMdl::refill()
 {
+	d_batchDirty.clear();
 	if( !d_root->d_subs.isEmpty() )
 	{
 		beginRemoveRows( QModelIndex(), 0, d_root->d_subs.size() - 1 );
@@ -141,6 +206,53 @@ void DocMdl::refill()
 	reset();
 }
 
+void DocMdl::refilter()
+{
+	// Statt refill nur die Zeilen entfernen bzw. einfuegen, deren Sichtbarkeit sich geaendert hat;
+	// aufgeklappte Ebenen und Selektion bleiben so erhalten.
+	if( d_doc.isNull() )
+		return;
+	refilterLevel( d_root );
+}
+
+void DocMdl::refilterLevel( Slot* p )
+{
+	// Geprueft wird nur der bereits geladene Teil der Ebene; den Rest holt fetch wie bisher
+	const bool complete = p->d_complete || p->d_empty;
+	if( p->d_subs.isEmpty() && !complete )
+		return;
+	const quint64 last = ( p->d_subs.isEmpty() )? 0 : p->d_subs.last()->d_oid;
+	const QModelIndex parent = indexOf( p );
+	p->d_empty = false;
+	int row = 0;
+	bool done = false;
+	Obj o = d_doc.getTxn()->getObject( p->d_oid ).getFirstObj();
+	if( !o.isNull() ) do
+	{
+		const quint64 oid = o.getOid();
+		Slot* s = ( row < p->d_subs.size() && p->d_subs[row]->d_oid == oid )? p->d_subs[row] : 0;
+		const bool visible = accept( o );
+		if( s != 0 && !visible )
+			removeSlot( s );
+		else if( s != 0 )
+		{
+			refilterLevel( s );
+			row++;
+		}else if( visible )
+		{
+			beginInsertRows( parent, row, row );
+			loadSlot( createSlot( p, oid, o.getType(), row ), o );
+			endInsertRows();
+			row++;
+		}
+		done = !complete && oid == last;
+	}while( !done && o.next() );
+	while( row < p->d_subs.size() )
+		removeSlot( p->d_subs.last() ); // liegt nicht mehr in der Ebene
+	if( complete && p->d_subs.isEmpty() )
+		p->d_empty = true;
+}
+
 Qt::ItemFlags DocMdl::flags(const QModelIndex &index) const
 {
 	return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsEditable;
@@ -182,8 +294,7 @@ QModelIndex DocMdl::parent(const QModelIndex & index) const
 		Slot* p = s->d_super;
 		if( p != d_root ) // im Fall p == 0 msste s == d_root sein
 		{
-			Slot* pp = p->d_super;
-			const int row = pp->d_subs.indexOf( p );
+			const int row = rowOf( p );
 			Q_ASSERT( row >= 0 );
 			return createIndex( row, index.column(), p );
 		}
@@ -252,9 +363,9 @@ QVariant DocMdl::data ( const QModelIndex & index, int role ) const
 				Obj o = d_doc.getTxn()->getObject( s->d_oid );
 				if( s->d_level > 0 ) // Title
 					return o.getValue( AttrObjNumber ).toString(true) + " " + // TODO: AttrObjNumber kann leer sein
-						o.getValue( AttrObjText ).toString(true);
+						TypeDefs::getValue( o, AttrObjText ).toString(true);
 				else
-					return o.getValue( AttrObjText ).getStr(); // kann auch html sein
+					return TypeDefs::getValue( o, AttrObjText ).getStr(); // kann auch html sein
 			}
 			break;
 		case Qt::ToolTipRole:
@@ -318,41 +429,72 @@ bool DocMdl::canFetchMore ( const QModelIndex & parent ) const
 	}
 	if( !o.isNull() ) do
 	{
-		const quint32 type = o.getType();
-		switch( d_filter )
-		{
-		case TitleAndBody:
-			if( ( type == TypeSection || type == TypeTitle ||
-				  type == TypeTable || type == TypePicture ) && callLuaFilter( o ) )
-				return true;
-			break;
-		case TitleOnly:
-			if( type == TypeTitle && callLuaFilter( o ) )
-				return true;
-			break;
-		case BodyOnly:
-			if( ( type == TypeSection || type == TypeTable || type == TypePicture ) && callLuaFilter( o ) )
-				return true;
-			break;
-		}
+		if( accept( o ) )
+			return true;
 	}while( o.next() );
 	return false;
 }
 
-DocMdl::Slot* DocMdl::createSlot( Slot* p, quint64 oid, quint32 type )
+bool DocMdl::accept( const Obj& o ) const
+{
+	const quint32 type = o.getType();
+	switch( d_filter )
+	{
+	case TitleAndBody:
+		if( type == TypeSection || type == TypeTitle || type == TypeTable || type == TypePicture )
+			return callLuaFilter( o );
+		break;
+	case TitleOnly:
+		if( type == TypeTitle )
+			return callLuaFilter( o );
+		break;
+	case BodyOnly:
+		if( type == TypeSection || type == TypeTable || type == TypePicture )
+			return callLuaFilter( o );
+		break;
+	}
+	return false;
+}
+
+DocMdl::Slot* DocMdl::createSlot( Slot* p, quint64 oid, quint32 type, int row )
 {
 	Slot* s = new Slot();
 	s->d_oid = oid;
 	s->d_super = p;
-	p->d_subs.append( s );
+	if( row < 0 || row >= p->d_subs.size() )
+	{
+		s->d_row = p->d_subs.size();
+		p->d_subs.append( s );
+	}else
+	{
+		s->d_row = row;
+		p->d_subs.insert( row, s );
+	}
 	d_map[ s->d_oid ] = s;
 	s->d_level = ( type == TypeTitle )? p->d_level + 1 : 0;
 	return s;
 }
 
+void DocMdl::loadSlot( Slot* s, const Obj& o )
+{
+	switch( o.getType() )
+	{
+	case TypeSection:
+	case TypeTitle:
+		fetchText( s, o );
+		break;
+	case TypeTable:
+		fetchTable( s, o );
+		break;
+	case TypePicture:
+		fetchPic( s, o );
+		break;
+	}
+}
+
 void DocMdl::fetchPic( Slot* s, const Obj& o )
 {
-	Stream::DataCell v = o.getValue( AttrPicImage );
+	Stream::DataCell v = TypeDefs::getValue( o, AttrPicImage );
 	if( v.isImg() )
 	{
 		s->d_text = new TextDocument( this );
@@ -365,7 +507,7 @@ void DocMdl::fetchPic( Slot* s, const Obj& o )
 
 void DocMdl::fetchText( Slot* s, const Obj& o )
 {
-	Stream::DataCell v = o.getValue( AttrObjText );
+	Stream::DataCell v = TypeDefs::getValue( o, AttrObjText );
 	if( v.isBml() )
 	{
 		Txt::TextInStream in;
@@ -420,7 +562,7 @@ void DocMdl::fetchTable( Slot* s, const Obj& o )
 					if( c.getType() == TypeTableCell )
 					{
 						cur.gotoRowCol( row, col );
-						Stream::DataCell v = c.getValue( AttrObjText );
+						Stream::DataCell v = TypeDefs::getValue( c, AttrObjText );
 						if( v.isBml() )
 						{
 							Txt::TextInStream in;
@@ -453,47 +595,26 @@ int DocMdl::fetch( Slot* p, bool all )
 		if( !o.isNull() )
 		{
 			if( !o.next() )
+			{
+				p->d_complete = true;
 				return 0;
+			}
 		}
 	}
 
 	const int maxBatch = 20; // RISK
 	int n = 0;
+	bool more = false;
 	if( !o.isNull() ) do
 	{
-		const quint32 type = o.getType();
-		switch( type )
+		if( accept( o ) )
 		{
-		case TypeSection:
-			if( ( d_filter == TitleAndBody || d_filter == BodyOnly ) && callLuaFilter( o ) )
-			{
-				fetchText( createSlot( p, o.getOid(), type ), o );
-				n++;
-			}
-			break;
-		case TypeTitle:
-			if( ( d_filter == TitleAndBody || d_filter == TitleOnly ) && callLuaFilter( o ) )
-			{
-				fetchText( createSlot( p, o.getOid(), type ), o );
-				n++;
-			}
-			break;
-		case TypeTable:
-			if( ( d_filter == TitleAndBody || d_filter == BodyOnly ) && callLuaFilter( o ) )
-			{
-				fetchTable( createSlot( p, o.getOid(), type ), o );
-				n++;
-			}
-			break;
-		case TypePicture:
-			if( ( d_filter == TitleAndBody || d_filter == BodyOnly ) && callLuaFilter( o ) )
-			{
-				fetchPic( createSlot( p, o.getOid(), type ), o );
-				n++;
-			}
-			break;
+			loadSlot( createSlot( p, o.getOid(), o.getType() ), o );
+			n++;
 		}
-	}while( o.next() && ( all || n < maxBatch ) );
+	}while( ( more = o.next() ) && ( all || n < maxBatch ) );
+	if( !more )
+		p->d_complete = true;
 	return n;
 }
 
@@ -501,13 +622,23 @@ bool DocMdl::callLuaFilter(const Obj & o) const
 {
 	if( d_luaFilter == LUA_NOREF )
 		return true;
+	if( d_filterRes.covers( o.getOid() ) )
+		return d_filterRes.isVisible( o.getOid() );
+	if( d_filterPending )
+		return true; // Bitmap kommt aus dem FilterJob; Lua im GUI-Thread wuerde den Viewer blockieren
+	// Objekt nicht in der Bitmap, z.B. nach dem Import neu erzeugt
+	if( d_filterOverBudget )
+		return true; // Fehler wurde bereits gemeldet; der Viewer soll nicht blockieren
 	Lua::Engine2* e = Lua::Engine2::getInst();
 	Q_ASSERT( e != 0 );
 	lua_rawgeti( e->getCtx(), LUA_REGISTRYINDEX, d_luaFilter );
 	LuaBinding::pushObject( e->getCtx(), o );
 	LuaBinding::pushObject( e->getCtx(), d_doc );
+	FilterBudget budget( e->getCtx(), 250, 2000000 ); // im GUI-Thread knapper als im FilterJob
 	if( !e->runFunction( 2, 1 ) )
 	{
+		if( budget.isExceeded() )
+			d_filterOverBudget = true;
 		try
 		{
 			qDebug() << "DocMdl::callLuaFilter:" << e->getLastError();
@@ -574,19 +705,172 @@ void DocMdl::onDbUpdate( Sdb::UpdateInfo info )
 		setDoc( Obj() );
 		break;
 	case UpdateInfo::ValueChanged:
-		if( d_map.contains( info.d_id ) && 
-			( info.d_name == AttrReviewStatus || info.d_name == AttrAnnotated ) )
 		{
-			Slot* s = d_map.value( info.d_id ); 
-			const int row = s->d_super->d_subs.indexOf( s );
-			Q_ASSERT( row >= 0 );
-			const QModelIndex i = createIndex( row, 0, s );
-			emit dataChanged( i, i );
+			Slot* s = d_map.value( info.d_id );
+			if( s != 0 )
+			{
+				if( info.d_name == AttrObjText || info.d_name == AttrPicImage )
+					reloadSlot( s, d_doc.getTxn()->getObject( info.d_id ) );
+				else if( AppContext::inst()->isBatch() )
+					d_batchDirty.insert( s->d_oid );
+				else
+				{
+					const QModelIndex i = indexOf( s );
+					emit dataChanged( i, i.sibling( i.row(), d_cols.size() ) );
+				}
+			}else if( info.d_name == AttrObjText )
+			{
+				// Zellen haben keinen eigenen Slot, sondern werden in den Text der Tabelle gerendert
+				Obj o = d_doc.getTxn()->getObject( info.d_id );
+				if( o.getType() == TypeTableCell )
+				{
+					o = o.getOwner().getOwner();
+					s = d_map.value( o.getOid() );
+					if( s != 0 )
+						reloadSlot( s, o );
+				}
+			}
+		}
+		break;
+	case UpdateInfo::Aggregated:
+		{
+			Slot* p = ( info.d_id2 == d_root->d_oid )? d_root : d_map.value( info.d_id2 );
+			Slot* s = d_map.value( info.d_id );
+			if( s != 0 )
+			{
+				if( s->d_super == p )
+					break; // bereits bekannt, z.B. ber fetch
+				removeSlot( s ); // verschoben
+			}
+			if( p == 0 )
+				break;
+			Obj o = d_doc.getTxn()->getObject( info.d_id );
+			if( !o.isNull() && accept( o ) )
+				insertObj( p, o );
+		}
+		break;
+	case UpdateInfo::ObjectErased:
+		if( info.d_id == d_root->d_oid )
+			setDoc( Obj() );
+		else
+		{
+			Slot* s = d_map.value( info.d_id );
+			if( s != 0 )
+				removeSlot( s );
 		}
 		break;
 	}
 }
 
+void DocMdl::onBatchFinished()
+{
+	if( d_batchDirty.isEmpty() )
+		return;
+	// Ein dataChanged pro Ebene ueber den Bereich der zurueckgestellten Status- und Annotationsaenderungen
+	QMap<Slot*, QPair<int,int> > ranges;
+	QSet<quint64>::const_iterator i;
+	for( i = d_batchDirty.constBegin(); i != d_batchDirty.constEnd(); ++i )
+	{
+		Slot* s = d_map.value( *i );
+		if( s == 0 )
+			continue; // inzwischen entfernt
+		const int row = rowOf( s );
+		QMap<Slot*, QPair<int,int> >::iterator r = ranges.find( s->d_super );
+		if( r == ranges.end() )
+			ranges.insert( s->d_super, qMakePair( row, row ) );
+		else
+		{
+			r.value().first = qMin( r.value().first, row );
+			r.value().second = qMax( r.value().second, row );
+		}
+	}
+	d_batchDirty.clear();
+	QMap<Slot*, QPair<int,int> >::const_iterator r;
+	for( r = ranges.constBegin(); r != ranges.constEnd(); ++r )
+	{
+		const QModelIndex p = indexOf( r.key() );
+		emit dataChanged( index( r.value().first, 0, p ), index( r.value().second, d_cols.size(), p ) );
+	}
+}
+
+QModelIndex DocMdl::indexOf( Slot* s ) const
+{
+	if( s == d_root || s->d_super == 0 )
+		return QModelIndex();
+	const int row = rowOf( s );
+	Q_ASSERT( row >= 0 );
+	return createIndex( row, 0, s );
+}
+
+int DocMdl::rowOf( Slot* s ) const
+{
+	// Nach einem Einfuegen oder Entfernen davor verschiebt sich die Zeile meist nur um eins;
+	// erst wenn auch das nicht stimmt, wird die Ebene durchsucht.
+	const QList<Slot*>& subs = s->d_super->d_subs;
+	const int n = subs.size();
+	if( s->d_row >= 0 && s->d_row < n && subs[s->d_row] == s )
+		return s->d_row;
+	if( s->d_row + 1 >= 0 && s->d_row + 1 < n && subs[s->d_row + 1] == s )
+		s->d_row++;
+	else if( s->d_row - 1 >= 0 && s->d_row - 1 < n && subs[s->d_row - 1] == s )
+		s->d_row--;
+	else
+		s->d_row = subs.indexOf( s );
+	return s->d_row;
+}
+
+void DocMdl::unmap( Slot* s )
+{
+	d_map.remove( s->d_oid );
+	for( int i = 0; i < s->d_subs.size(); i++ )
+		unmap( s->d_subs[i] );
+}
+
+void DocMdl::insertObj( Slot* p, const Obj& o )
+{
+	// Suche den nchsten bereits geladenen Vorgnger auf gleicher Ebene; ohne Filteraufrufe
+	int row = 0;
+	Obj prev = o;
+	while( prev.prev() )
+	{
+		Slot* s = d_map.value( prev.getOid() );
+		if( s != 0 && s->d_super == p )
+		{
+			row = rowOf( s ) + 1;
+			break;
+		}
+	}
+	if( row == p->d_subs.size() && !p->d_complete && !p->d_empty )
+		return; // Das Objekt liegt im noch nicht geladenen Rest der Ebene; fetch holt es spter
+	beginInsertRows( indexOf( p ), row, row );
+	loadSlot( createSlot( p, o.getOid(), o.getType(), row ), o );
+	p->d_empty = false;
+	endInsertRows();
+}
+
+void DocMdl::removeSlot( Slot* s )
+{
+	Slot* p = s->d_super;
+	Q_ASSERT( p != 0 );
+	const int row = rowOf( s );
+	Q_ASSERT( row >= 0 );
+	beginRemoveRows( indexOf( p ), row, row );
+	p->d_subs.removeAt( row );
+	unmap( s );
+	delete s;
+	endRemoveRows();
+}
+
+void DocMdl::reloadSlot( Slot* s, const Obj& o )
+{
+	if( s->d_text )
+		delete s->d_text;
+	s->d_text = 0;
+	loadSlot( s, o );
+	const QModelIndex i = indexOf( s );
+	emit dataChanged( i, i.sibling( i.row(), d_cols.size() ) );
+}
+
 QVariant DocMdl::headerData ( int section, Qt::Orientation orientation, int role ) const
 {
 	if( orientation == Qt::Horizontal && ( role == Qt::DisplayRole || role == Qt::ToolTipRole ) )
@@ -636,7 +920,7 @@ QModelIndex DocMdl::findIndex( quint64 oid, bool title )
 			while( s && s->d_super && s->d_super->d_super && s->d_level == 0 )
 				s = s->d_super;
 		}
-		const int row = s->d_super->d_subs.indexOf( s );
+		const int row = rowOf( s );
 		Q_ASSERT( row >= 0 );
 		return createIndex( row, 0, s );
 	}
@@ -23,6 +23,8 @@
 #include <QList>
 #include <QTextDocument>
 #include <QMap>
+#include <QSet>
+#include "FilterCache.h"
 
 namespace Ds
 {
@@ -56,8 +58,10 @@ namespace Ds
 		void setDoc( const Sdb::Obj& doc, Filter f );
 		void setFilter( Filter );
 		Filter getFilter() const { return d_filter; }
-		bool setLuaFilter( const QByteArray &code = QByteArray(), const QByteArray &name = QByteArray());
+		bool setLuaFilter( const QByteArray &code = QByteArray(), const QByteArray &name = QByteArray(),
+						   quint64 filter = 0 ); // filter: TypeLuaFilter zum Speichern des Resultats
 		bool hasLuaFilter() const;
+		int getFilterProgress() const; // Prozent der Auswertung im Hintergrund oder -1
 		void addCol( const QString&,quint32 );
 		void clearCols();
 		const Sdb::Obj& getDoc() const { return d_doc; }
@@ -85,6 +89,8 @@ namespace Ds
 		bool setData ( const QModelIndex & index, const QVariant & value, int role );
 	protected slots:
 		void onDbUpdate( Sdb::UpdateInfo );
+		void onFilterEvaluated( const QByteArray& key, const QString& error );
+		void onBatchFinished();
 	private:
 		Sdb::Obj d_doc;
 		struct Slot
@@ -93,9 +99,11 @@ namespace Ds
 			quint64 d_oid;
 			QList<Slot*> d_subs;
 			Slot* d_super;
+			int d_row; // zuletzt bekannte Zeile in d_super, siehe rowOf
 			quint8 d_level;
 			bool d_empty;
-			Slot():d_super(0),d_text(0),d_oid(0),d_level(0),d_empty(false){}
+			bool d_complete; // fetch hat das Ende der Ebene erreicht
+			Slot():d_super(0),d_text(0),d_oid(0),d_row(0),d_level(0),d_empty(false),d_complete(false){}
 			~Slot();
 		};
 		Slot* d_root;
@@ -104,11 +112,32 @@ namespace Ds
 		Filter d_filter;
 		int d_luaFilter;
 		QByteArray d_luaFilterName;
+		QByteArray d_luaFilterCode;
+		QByteArray d_luaFilterBin; // Bytecode, sonst wie d_luaFilterCode
+		quint64 d_luaFilterObj;
+		QByteArray d_filterKey; // FilterCache
+		FilterCache::Result d_filterRes;
+		bool d_filterPending; // Bitmap wird im Hintergrund berechnet; bis dahin ungefiltert
+		mutable bool d_filterOverBudget; // callLuaFilter hat das Budget ueberschritten
+		QSet<quint64> d_batchDirty; // dataChanged bis AppContext::batchFinished zurueckgestellt
 		bool d_onlyHdrTxtChanges;
 	protected:
 		int fetch( Slot*, bool all = false );
 		bool callLuaFilter( const Sdb::Obj& ) const;
-		Slot* createSlot( Slot* p, quint64 oid, quint32 type );
+		void applyFilterCache();
+		bool accept( const Sdb::Obj& ) const;
+		Slot* createSlot( Slot* p, quint64 oid, quint32 type, int row = -1 );
+		void loadSlot( Slot* s, const Sdb::Obj& o );
+		QModelIndex indexOf( Slot* ) const;
+		int rowOf( Slot* ) const;
+		void unmap( Slot* );
+		// Incremental update on database changes
+		void insertObj( Slot* p, const Sdb::Obj& o );
+		void removeSlot( Slot* );
+		void reloadSlot( Slot*, const Sdb::Obj& o );
+		// Filterwechsel als Zeilen-Diff statt refill
+		void refilter();
+		void refilterLevel( Slot* );
 		void fetchTable( Slot* s, const Sdb::Obj& o );
 		void fetchText( Slot* s, const Sdb::Obj& o );
 		void fetchPic( Slot* s, const Sdb::Obj& o );
@@ -31,6 +31,7 @@
 #include "AppContext.h"
 #include "DocExporter.h"
 #include "Indexer.h"
+#include "Timeline.h"
 #include <Sdb/Transaction.h>
 #include <Sdb/Database.h>
 #include <Sdb/Idx.h>
@@ -52,6 +53,10 @@
 #include <QLabel>
 #include <QTextEdit>
 #include <QComboBox>
+#include <QProgressBar>
+#include <QTimer>
+#include <QSplitter>
+#include <QTreeWidget>
 #include <Txt/TextInStream.h>
 #include "AttrSelectDlg.h"
 #include "LuaFilterDlg.h"
@@ -76,7 +81,8 @@ static inline QDockWidget* createDock( QMainWindow* parent, const QString& title
 
 DocViewer::DocViewer(const Sdb::Obj& doc, QWidget *parent)
 	: QMainWindow(parent), d_lockTocSelect( false ), d_expandLinks(false),
-	  d_expandHist(false),d_expandAnnot(false),d_expandProps(false),d_fullScreen(false)
+	  d_expandHist(false),d_expandAnnot(false),d_expandProps(false),d_fullScreen(false),
+	  d_showTimeline(false)
 {
 	setAttribute( Qt::WA_DeleteOnClose );
 	s_wins.append( this );
@@ -267,6 +273,16 @@ void DocViewer::setupFilter(QWidget * parent)
 	import->setAutoRaise( true );
 	connect( import, SIGNAL( clicked() ), this, SLOT( onFilterImport() ) );
 
+	d_filterProgress = new QProgressBar( pane );
+	d_filterProgress->setRange( 0, 100 );
+	d_filterProgress->setMaximumWidth( 150 );
+	d_filterProgress->setFormat( tr("Filtering %p%") );
+	d_filterProgress->setVisible( false );
+	hbox->addWidget( d_filterProgress );
+	d_filterTimer = new QTimer( this );
+	d_filterTimer->setInterval( 250 );
+	connect( d_filterTimer, SIGNAL( timeout() ), this, SLOT( onFilterProgress() ) );
+
 	hbox->addStretch();
 }
 
@@ -438,7 +454,7 @@ void DocViewer::setAttrView( Sdb::Obj& o, quint32 attr, bool create )
 
 	e->clear();
 	e->setTextColor( Qt::black );
-	Stream::DataCell v = o.getValue( attr );
+	Stream::DataCell v = TypeDefs::getValue( o, attr );
 	if( v.isBml() )
 	{
 		Txt::TextInStream in;
@@ -499,9 +515,20 @@ void DocViewer::setupLinks()
 	pop->addCommand( tr("Expand Links"), this, SLOT(onExpLinks()) )->setCheckable(true);
 	pop->addCommand( tr("Plain Text"), this, SLOT(onPlainBodyLinks()) )->setCheckable(true);
 
-	QDockWidget* dock = createDock( this, tr("Links" ), true );
-	dock->setWidget( d_linksTree );
-	addDockWidget( Qt::RightDockWidgetArea, dock );
+	d_linksDock = createDock( this, tr("Links" ), true );
+	d_linksDock->setWidget( d_linksTree );
+	addDockWidget( Qt::RightDockWidgetArea, d_linksDock );
+	connect( d_links, SIGNAL(countsChanged()), this, SLOT(onLinkCounts()) );
+}
+
+void DocViewer::onLinkCounts()
+{
+	const int in = d_links->getInCount();
+	const int out = d_links->getOutCount();
+	if( in == 0 && out == 0 )
+		d_linksDock->setWindowTitle( tr("Links") );
+	else
+		d_linksDock->setWindowTitle( tr("Links (%1 in, %2 out)").arg( in ).arg( out ) );
 }
 
 void DocViewer::setupHist()
@@ -528,12 +555,117 @@ void DocViewer::setupHist()
 	pop->addCommand( tr("Show Document Changes" ), this, SLOT(onShowDocAttr()) );
 	pop->addSeparator();
 	pop->addCommand( tr("Expand Changes"), this, SLOT(onExpHist()) )->setCheckable(true);
+	pop->addCommand( tr("Show Timeline of all Versions"), this, SLOT(onShowTimeline()) )->setCheckable(true);
+
+	// nderungen ber alle Versionen des Dokuments, siehe Timeline
+	d_timeTree = new QTreeWidget( this );
+	d_timeTree->setHeaderHidden( true );
+	d_timeTree->setAlternatingRowColors( true );
+	d_timeTree->setPalette( pal );
+	d_timeTree->setIndentation( 10 );
+	d_timeTree->setToolTip( tr("Double-click to open the object in this version") );
+	connect( d_timeTree, SIGNAL( itemDoubleClicked( QTreeWidgetItem*, int ) ),
+		this, SLOT( onTimelineClicked( QTreeWidgetItem*, int ) ) );
+	d_showTimeline = AppContext::inst()->getSet()->value("DocViewer/Flags/Timeline" ).toBool();
+	d_timeTree->setVisible( d_showTimeline );
+	d_timelineTimer = new QTimer( this );
+	d_timelineTimer->setInterval( 250 );
+	connect( d_timelineTimer, SIGNAL( timeout() ), this, SLOT( onTimelineProgress() ) );
+	connect( TimelineCache::inst(), SIGNAL( built() ), this, SLOT( onTimelineBuilt() ) );
+
+	QSplitter* split = new QSplitter( Qt::Vertical, this );
+	split->addWidget( d_histTree );
+	split->addWidget( d_timeTree );
 
 	QDockWidget* dock = createDock( this, tr("Change History" ), true );
-	dock->setWidget( d_histTree );
+	dock->setWidget( split );
 	addDockWidget( Qt::RightDockWidgetArea, dock );
 }
 
+static QString _versionName( const Sdb::Obj& doc )
+{
+	QString name = doc.getValue( AttrDocVer ).toString();
+	if( name.isEmpty() )
+		name = TypeDefs::formatDate( doc.getValue( AttrDocImported ).getDateTime() );
+	return name;
+}
+
+void DocViewer::fillTimeline( const Sdb::Obj& o )
+{
+	d_timeTree->clear();
+	d_timelineTimer->stop();
+	if( !d_showTimeline || o.isNull() )
+		return;
+	bool pending;
+	QString error;
+	const Timeline* t = TimelineCache::inst()->get( d_doc, pending, &error ); // beim ersten Mal im Hintergrund
+	if( pending )
+	{
+		new QTreeWidgetItem( d_timeTree, QStringList() << tr("<comparing versions...>") );
+		d_timelineTimer->start(); // bis onTimelineBuilt
+		return;
+	}
+	if( !error.isEmpty() )
+	{
+		new QTreeWidgetItem( d_timeTree, QStringList() << tr("<error: %1>").arg( error ) );
+		return;
+	}
+	if( t == 0 )
+	{
+		new QTreeWidgetItem( d_timeTree, QStringList() << tr("<no other versions>") );
+		return;
+	}
+	const Timeline::Entry* e = t->find( o );
+	if( e == 0 )
+	{
+		new QTreeWidgetItem( d_timeTree, QStringList() << 
+			tr("<unchanged in %1 versions>").arg( t->getVersions().size() ) );
+		return;
+	}
+	QMap<QString,QTreeWidgetItem*> tops;
+	for( int i = 0; i < e->d_changes.size(); i++ )
+	{
+		const Timeline::Change& c = e->d_changes[i];
+		const QString name = ( c.d_kind == Timeline::Modified ) ?
+			QString( TypeDefs::getPrettyName( c.d_attr, d_doc.getDb() ) ) : tr("Object");
+		QTreeWidgetItem* top = tops.value( name );
+		if( top == 0 )
+		{
+			top = new QTreeWidgetItem();
+			tops[name] = top;
+		}
+		const Sdb::Obj ver = d_doc.getTxn()->getObject( t->getVersions()[c.d_version] );
+		quint64 oid = e->d_oids[c.d_version];
+		if( oid == 0 && c.d_version > 0 )
+			oid = e->d_oids[c.d_version - 1]; // gelscht, zeige letzte Version
+		const Sdb::Obj obj = d_doc.getTxn()->getObject( oid );
+		QTreeWidgetItem* sub = new QTreeWidgetItem( top );
+		QString text = QString( "%1 %2" ).arg( _versionName( ver ) ).arg( Timeline::kindName( c.d_kind ) );
+		if( c.d_kind == Timeline::Modified )
+		{
+			text += ": " + TypeDefs::elided( obj.getValue( c.d_attr ) );
+			sub->setToolTip( 0, TypeDefs::elided( obj.getValue( c.d_attr ), 0 ) );
+		}
+		if( ver.getId() == d_doc.getId() )
+		{
+			QFont f = sub->font( 0 );
+			f.setBold( true );
+			sub->setFont( 0, f );
+		}
+		sub->setText( 0, text );
+		sub->setData( 0, Qt::UserRole, oid );
+	}
+	QMap<QString,QTreeWidgetItem*>::const_iterator j;
+	for( j = tops.begin(); j != tops.end(); ++j )
+	{
+		j.value()->setText( 0, tr("%1: %2 of %3 versions").arg( j.key() ).
+			arg( j.value()->childCount() ).arg( t->getVersions().size() ) );
+		d_timeTree->addTopLevelItem( j.value() );
+	}
+	if( d_expandHist )
+		d_timeTree->expandAll();
+}
+
 void DocViewer::setupAnnot()
 {
 	d_annot = new AnnotMdl( this );
@@ -871,6 +1003,7 @@ void DocViewer::onElementClicked(const QModelIndex & index,const QModelIndex &)
 	d_hist->setObj( o );
 	if( d_expandHist )
 		d_histTree->expandAll();
+	fillTimeline( o );
 	selectAnnot( o );
 	selectAttrs( o );
 	d_tocTree->setCurrentIndex( d_toc->findIndex( oid, true ) );
@@ -1278,6 +1411,39 @@ void DocViewer::onExpHist()
 		d_histTree->expandAll();
 }
 
+void DocViewer::onShowTimeline()
+{
+	CHECKED_IF( true, d_showTimeline );
+	d_showTimeline = !d_showTimeline;
+	AppContext::inst()->getSet()->setValue("DocViewer/Flags/Timeline", d_showTimeline );
+	d_timeTree->setVisible( d_showTimeline );
+	fillTimeline( d_doc.getTxn()->getObject( d_mdl->getOid( d_tree->currentIndex() ) ) );
+}
+
+void DocViewer::onTimelineProgress()
+{
+	const int p = TimelineCache::inst()->getProgress();
+	if( p >= 0 && d_timeTree->topLevelItemCount() > 0 )
+		d_timeTree->topLevelItem( 0 )->setText( 0, tr("<comparing versions... %1%>").arg( p ) );
+}
+
+void DocViewer::onTimelineBuilt()
+{
+	if( d_timelineTimer->isActive() ) // Platzhalter wird angezeigt
+		fillTimeline( d_doc.getTxn()->getObject( d_mdl->getOid( d_tree->currentIndex() ) ) );
+}
+
+void DocViewer::onTimelineClicked(QTreeWidgetItem* item,int)
+{
+	const quint64 oid = item->data( 0, Qt::UserRole ).toULongLong();
+	if( oid == 0 )
+		return;
+	Sdb::Obj o = d_doc.getTxn()->getObject( oid );
+	DocViewer* v = showDoc( o.getObject( AttrObjHomeDoc ) );
+	if( v )
+		v->gotoObject( oid );
+}
+
 void DocViewer::onExpProps()
 {
 	CHECKED_IF( true, d_expandProps );
@@ -1530,14 +1696,30 @@ void DocViewer::onFilter()
 {
 	fillFilterList();
 	d_filters->parentWidget()->setVisible( true );
+	d_filterTimer->start();
 }
 
 void DocViewer::onCloseFilter()
 {
 	d_filters->parentWidget()->setVisible( false );
+	d_filterTimer->stop();
+	d_filterProgress->setVisible( false );
 	d_mdl->setLuaFilter();
 }
 
+void DocViewer::onFilterProgress()
+{
+	// Filter laufen im Hintergrund (FilterCache); bis zum Resultat bleibt das Dokument ungefiltert
+	const int p = d_mdl->getFilterProgress();
+	if( p < 0 )
+		d_filterProgress->setVisible( false );
+	else
+	{
+		d_filterProgress->setValue( p );
+		d_filterProgress->setVisible( true );
+	}
+}
+
 void DocViewer::onFilterChanged(int i)
 {
 	if( i < 0 )
@@ -1552,7 +1734,8 @@ void DocViewer::onFilterChanged(int i)
 		if( id.isEmpty() )
 			id = QString::number( d_doc.getOid(), 16 );
 		const QString name = tr("[%1] %2").arg(id).arg( filter.getValue( AttrScriptName ).getStr() );
-		if( !d_mdl->setLuaFilter( filter.getValue( AttrScriptSource ).getStr().toLatin1(), name.toLatin1() ) )
+		if( !d_mdl->setLuaFilter( filter.getValue( AttrScriptSource ).getStr().toLatin1(), name.toLatin1(),
+								  filter.getOid() ) )
 		{
 			QMessageBox::critical( this, tr("Error in Filter Function"), Lua::Engine2::getInst()->getLastError() );
 		}
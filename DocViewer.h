@@ -28,6 +28,11 @@ class QLineEdit;
 class QLabel;
 class QTextEdit;
 class QComboBox;
+class QProgressBar;
+class QTimer;
+class QDockWidget;
+class QTreeWidget;
+class QTreeWidgetItem;
 
 namespace Ds
 {
@@ -88,9 +93,14 @@ namespace Ds
 		void onNeedToHave();
 		void onNiceToHave();
 		void onExpHist();
+		void onShowTimeline();
+		void onTimelineClicked(QTreeWidgetItem*,int);
+		void onTimelineProgress();
+		void onTimelineBuilt();
 		void onExpProps();
 		void onExpLinks();
 		void onPlainBodyLinks();
+		void onLinkCounts();
 		void onExpAnnot();
 		void onGotoAnnot();
 		void onExpHtml();
@@ -113,6 +123,7 @@ namespace Ds
 		void onFilterEdit();
 		void onFilterRemove();
 		void onFilterImport();
+		void onFilterProgress();
 	protected:
 		DocViewer(const Sdb::Obj& doc, QWidget *parent = 0);
 		void setDoc( const Sdb::Obj& );
@@ -122,6 +133,7 @@ namespace Ds
 		void setupProps();
 		void setupLinks();
 		void setupHist();
+		void fillTimeline( const Sdb::Obj& );
 		void setupAnnot();
 		void setupSearch( QWidget* );
 		void setupFilter( QWidget* );
@@ -148,14 +160,19 @@ namespace Ds
 		QTreeView* d_propsTree;
 		LinksMdl* d_links;
 		QTreeView* d_linksTree;
+		QDockWidget* d_linksDock;
 		HistMdl* d_hist;
 		QTreeView* d_histTree;
+		QTreeWidget* d_timeTree;
+		QTimer* d_timelineTimer; // pollt TimelineCache, solange der Platzhalter angezeigt wird
 		AnnotMdl* d_annot;
 		QTreeView* d_annotTree;
 		QLineEdit* d_search;
 		QLabel* d_searchInfo1;
 		QLabel* d_searchInfo2;
 		QComboBox* d_filters;
+		QProgressBar* d_filterProgress;
+		QTimer* d_filterTimer; // pollt FilterCache, solange der Filterbereich offen ist
 		QString d_oldNotFound;
 		QMap<quint32,QTextEdit*> d_attrViews;
 		Sdb::Obj d_doc;
@@ -168,6 +185,7 @@ namespace Ds
 		bool d_expandAnnot;
 		bool d_expandProps;
 		bool d_fullScreen;
+		bool d_showTimeline;
 	};
 }
 
@@ -75,7 +75,17 @@ HEADERS += ./AnnotDeleg.h \
     ../NAF/Gui/ListView.h \
     LuaFilterDlg.h \
     ScriptSelectDlg.h \
-    ReqIfImport.h
+    ReqIfImport.h \
+    FilterCache.h \
+    Timeline.h \
+    ReadConnection.h \
+    Compactor.h \
+    Statistics.h \
+    ObjectQuery.h \
+    LuaProfiler.h \
+    ScriptJob.h \
+    ResultView.h \
+    Stopwatch.h
 
 #Source files
 SOURCES += ./AnnotDeleg.cpp \
@@ -118,7 +128,16 @@ SOURCES += ./AnnotDeleg.cpp \
     LuaFilterDlg.cpp \
     ScriptSelectDlg.cpp \
 	ReqIfParser.cpp \
-    ReqIfImport.cpp
+    ReqIfImport.cpp \
+    FilterCache.cpp \
+    Timeline.cpp \
+    ReadConnection.cpp \
+    Compactor.cpp \
+    Statistics.cpp \
+    ObjectQuery.cpp \
+    LuaProfiler.cpp \
+    ScriptJob.cpp \
+    ResultView.cpp
 
 include(../Sqlite3/Sqlite3.pri)
 include(../Stream/Stream.pri)
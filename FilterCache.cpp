@@ -0,0 +1,556 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "FilterCache.h"
+#include "TypeDefs.h"
+#include "AppContext.h"
+#include "LuaBinding.h"
+#include "ReadConnection.h"
+#include <Sdb/Database.h>
+#include <Sdb/Transaction.h>
+#include <Sdb/Exceptions.h>
+#include <Script/Lua.h>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QMap>
+#include <QThread>
+#include <QTimer>
+#include <QtDebug>
+using namespace Ds;
+
+namespace Ds
+{
+	class FilterJob : public QThread
+	{
+	public:
+		QByteArray d_key;
+		QByteArray d_code;
+		QByteArray d_name;
+		QString d_path; // eigene Verbindung, siehe ReadConnection
+		quint64 d_root;
+		quint64 d_doc;
+		quint64 d_filter;
+		FilterCache::Result d_res;
+		QString d_error;
+		volatile bool d_cancel;
+		volatile int d_done; // ausgewertete Objekte, fuer getProgress
+		volatile int d_total;
+		bool d_incomplete; // Budget ueberschritten oder waehrenddessen committed
+
+		FilterJob( QObject* p ):QThread(p),d_root(0),d_doc(0),d_filter(0),d_cancel(false),
+			d_done(0),d_total(0),d_incomplete(false) {}
+	protected:
+		void run();
+	};
+}
+
+static FilterCache* s_inst = 0;
+static const int s_batch = 256; // Objekte pro Lese-Lock
+static const int s_hookStep = 1000; // Instruktionen pro Hook-Aufruf
+static const int s_maxMs = 2000; // Budget pro Objekt im Hintergrund
+static const int s_maxInstructions = 20000000;
+static char s_budgetKey = 0;
+
+FilterBudget::FilterBudget( lua_State* L, int maxMs, int maxInstructions, volatile bool* cancel ):
+	d_L( L ),d_maxMs( maxMs ),d_maxSteps( maxInstructions / s_hookStep ),d_steps( 0 ),
+	d_cancel( cancel ),d_exceeded( false ),d_active( false )
+{
+	if( lua_gethook( L ) != 0 )
+		return;
+	lua_pushlightuserdata( L, &s_budgetKey );
+	lua_pushlightuserdata( L, this );
+	lua_rawset( L, LUA_REGISTRYINDEX );
+	lua_sethook( L, hook, LUA_MASKCOUNT, s_hookStep );
+	d_active = true;
+	d_timer.start();
+}
+
+FilterBudget::~FilterBudget()
+{
+	if( !d_active )
+		return;
+	lua_sethook( d_L, 0, 0, 0 );
+	lua_pushlightuserdata( d_L, &s_budgetKey );
+	lua_pushnil( d_L );
+	lua_rawset( d_L, LUA_REGISTRYINDEX );
+}
+
+void FilterBudget::restart()
+{
+	d_steps = 0;
+	d_timer.restart();
+}
+
+void FilterBudget::hook( lua_State* L, lua_Debug* )
+{
+	lua_pushlightuserdata( L, &s_budgetKey );
+	lua_rawget( L, LUA_REGISTRYINDEX );
+	FilterBudget* b = static_cast<FilterBudget*>( lua_touserdata( L, -1 ) );
+	lua_pop( L, 1 );
+	if( b == 0 )
+		return;
+	if( b->d_cancel && *b->d_cancel )
+		luaL_error( L, "filter cancelled" );
+	if( ++b->d_steps > b->d_maxSteps || b->d_timer.elapsed() > b->d_maxMs )
+	{
+		b->d_exceeded = true;
+		luaL_error( L, "filter exceeds budget of %d instructions or %d ms per object",
+					b->d_maxSteps * s_hookStep, b->d_maxMs );
+	}
+}
+
+static inline bool _isFilterable( quint32 type )
+{
+	// Alle Typen, die DocMdl::accept dem Lua-Filter vorlegen kann
+	return type == TypeTitle || type == TypeSection || type == TypeTable || type == TypePicture;
+}
+
+static void _collect( const Sdb::Obj& p, QList<quint64>& oids )
+{
+	Sdb::Obj o = p.getFirstObj();
+	if( !o.isNull() ) do
+	{
+		if( _isFilterable( o.getType() ) )
+		{
+			oids.append( o.getOid() );
+			_collect( o, oids );
+		}
+	}while( o.next() );
+}
+
+void FilterJob::run()
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs( L );
+	LuaBinding::install( L );
+	try
+	{
+		ReadConnection conn( d_path );
+		LuaBinding::setRoot( L, conn.getObject( d_root ) );
+
+		QList<quint64> oids;
+		{
+			ReadConnection::Reader lock( conn );
+			_collect( conn.getObject( d_doc ), oids );
+		}
+		if( oids.isEmpty() )
+		{
+			lua_close( L );
+			return;
+		}
+		quint64 maxOid = 0;
+		d_res.d_base = oids.first();
+		for( int i = 0; i < oids.size(); i++ )
+		{
+			d_res.d_base = qMin( d_res.d_base, oids[i] );
+			maxOid = qMax( maxOid, oids[i] );
+		}
+		d_res.d_bits.resize( maxOid - d_res.d_base + 1 );
+
+		// Der Filter wird nur einmal kompiliert und dann fuer jedes Objekt aufgerufen
+		if( luaL_loadbuffer( L, d_code, d_code.size(), d_name ) != 0 )
+		{
+			d_error = QString::fromLatin1( lua_tostring( L, -1 ) );
+			d_res = FilterCache::Result();
+			lua_close( L );
+			return;
+		}
+		const int chunk = lua_gettop( L );
+		d_total = oids.size();
+		FilterBudget budget( L, s_maxMs, s_maxInstructions, &d_cancel );
+		int i = 0;
+		while( i < oids.size() && !d_cancel && !budget.isExceeded() )
+		{
+			ReadConnection::Reader lock( conn );
+			const Sdb::Obj doc = conn.getObject( d_doc );
+			const int end = qMin( i + s_batch, oids.size() );
+			for( ; i < end; i++ )
+			{
+				lua_pushvalue( L, chunk );
+				LuaBinding::pushObject( L, conn.getObject( oids[i] ) );
+				LuaBinding::pushObject( L, doc );
+				bool visible = true; // wie DocMdl::callLuaFilter: bei Fehlern anzeigen
+				budget.restart();
+				if( lua_pcall( L, 2, 1, 0 ) != 0 )
+				{
+					if( d_error.isEmpty() || budget.isExceeded() )
+						d_error = QString::fromLatin1( lua_tostring( L, -1 ) );
+				}else
+					visible = lua_toboolean( L, -1 );
+				lua_pop( L, 1 ); // result oder error
+				d_res.d_bits.setBit( oids[i] - d_res.d_base, visible );
+				d_done = i + 1;
+				if( budget.isExceeded() )
+				{
+					d_incomplete = true;
+					// Abbruch; der Rest bleibt sichtbar, damit DocMdl nicht pro Objekt im
+					// GUI-Thread nachrechnet
+					for( i++; i < oids.size(); i++ )
+						d_res.d_bits.setBit( oids[i] - d_res.d_base, true );
+					break;
+				}
+			}
+		}
+		if( conn.isChanged() )
+			d_incomplete = true; // Objekte aus verschiedenen Staenden; nicht cachen
+	}catch( const Sdb::DatabaseException& e )
+	{
+		d_error = QString( "%1: %2" ).arg( e.getCodeString() ).arg( e.getMsg() );
+		d_res = FilterCache::Result();
+	}catch( const std::exception& e )
+	{
+		d_error = QString::fromLatin1( e.what() );
+		d_res = FilterCache::Result();
+	}
+	lua_close( L );
+}
+
+FilterCache::FilterCache( QObject* p ):QObject( p ),d_persistScheduled( false )
+{
+	d_cache.setMaxCost( 16 * 1024 * 1024 ); // Bytes
+	AppContext::inst()->getDb()->addObserver( this, SLOT(onDbUpdate( Sdb::UpdateInfo )));
+}
+
+FilterCache::~FilterCache()
+{
+	cancelAll();
+	if( s_inst == this )
+		s_inst = 0;
+}
+
+FilterCache* FilterCache::inst()
+{
+	if( s_inst == 0 )
+		s_inst = new FilterCache( AppContext::inst() );
+	return s_inst;
+}
+
+QByteArray FilterCache::makeKey( const QByteArray& code, const Sdb::Obj& doc )
+{
+	QByteArray key = QCryptographicHash::hash( code, QCryptographicHash::Md5 ).toHex();
+	key += ':';
+	key += QByteArray::number( doc.getOid() );
+	key += ':';
+	key += doc.getValue( AttrDocImported ).getDateTime().toString( Qt::ISODate ).toLatin1();
+	key += ':';
+	key += QByteArray::number( doc.getValue( AttrDocFilterStamp ).getUInt32() );
+	return key;
+}
+
+// AttrFilterResults: Anzahl, dann pro Dokument OID, makeKey, d_base und d_bits. Pro Dokument
+// bleibt nur das Resultat des aktuellen Stands; mehrere Dokumente verdraengen sich nicht.
+typedef QMap<quint64,QPair<QByteArray,FilterCache::Result> > _Stored;
+
+static _Stored _readStored( const Sdb::Obj& f )
+{
+	_Stored res;
+	const QByteArray data = f.getValue( AttrFilterResults ).getArr();
+	if( data.isEmpty() )
+		return res;
+	QDataStream in( data );
+	quint32 n = 0;
+	in >> n;
+	for( quint32 i = 0; i < n && in.status() == QDataStream::Ok; i++ )
+	{
+		quint64 doc;
+		QPair<QByteArray,FilterCache::Result> r;
+		in >> doc >> r.first >> r.second.d_base >> r.second.d_bits;
+		if( in.status() == QDataStream::Ok )
+			res[doc] = r;
+	}
+	return res;
+}
+
+static QByteArray _writeStored( const _Stored& s )
+{
+	QByteArray data;
+	QDataStream out( &data, QIODevice::WriteOnly );
+	out << quint32( s.size() );
+	_Stored::const_iterator i;
+	for( i = s.begin(); i != s.end(); ++i )
+		out << i.key() << i.value().first << i.value().second.d_base << i.value().second.d_bits;
+	return data;
+}
+
+bool FilterCache::find( const QByteArray& key, Result& res, quint64 filter, quint64 doc )
+{
+	const Result* r = d_cache.object( key );
+	if( r != 0 )
+	{
+		res = *r;
+		return true;
+	}
+	QHash<QByteArray,Result>::const_iterator j = d_incomplete.find( key );
+	if( j != d_incomplete.end() )
+	{
+		res = j.value();
+		return true;
+	}
+	if( filter == 0 || doc == 0 )
+		return false;
+	// Im Repository gespeichertes Resultat einer frueheren Sitzung oder eines anderen Viewers
+	Sdb::Obj f = AppContext::inst()->getTxn()->getObject( filter );
+	if( f.getType() != TypeLuaFilter )
+		return false;
+	const _Stored stored = _readStored( f );
+	_Stored::const_iterator i = stored.find( doc );
+	if( i == stored.end() || i.value().first != key || i.value().second.d_bits.isEmpty() )
+		return false;
+	d_cache.insert( key, new Result( i.value().second ), i.value().second.d_bits.size() / 8 + 1 );
+	d_resultDocs.insert( doc );
+	res = i.value().second;
+	return true;
+}
+
+void FilterCache::store( quint64 filter, quint64 doc, const QByteArray& key, const Result& res )
+{
+	Pending p;
+	p.d_filter = filter;
+	p.d_doc = doc;
+	p.d_key = key;
+	p.d_res = res;
+	d_toStore.append( p );
+	schedulePersist();
+}
+
+bool FilterCache::canWrite()
+{
+	// onPersist schreibt mit eigener Transaktion; waehrend eines Batch trotzdem warten, damit die
+	// Observer ihre Einzelupdates nicht mitten in der Sammelklammer erhalten
+	return !AppContext::inst()->isBatch();
+}
+
+static bool _hasStored( const Sdb::Obj& owner, quint64 doc )
+{
+	Sdb::Obj sub = owner.getFirstObj();
+	if( !sub.isNull() ) do
+	{
+		if( sub.getType() == TypeLuaFilter && _readStored( sub ).contains( doc ) )
+			return true;
+	}while( sub.next() );
+	return false;
+}
+
+bool FilterCache::hasResults( const Sdb::Obj& doc )
+{
+	// Gespeicherte Resultate frueherer Sitzungen liegen in den Filtern des Dokuments oder der Wurzel;
+	// pro Dokument und Sitzung nur einmal nachsehen
+	const quint64 oid = doc.getOid();
+	if( d_resultDocs.contains( oid ) )
+		return true;
+	if( d_scannedDocs.contains( oid ) )
+		return false;
+	d_scannedDocs.insert( oid );
+	if( _hasStored( doc, oid ) || _hasStored( AppContext::inst()->getRoot(), oid ) )
+	{
+		d_resultDocs.insert( oid );
+		return true;
+	}
+	return false;
+}
+
+void FilterCache::schedulePersist( int ms )
+{
+	if( d_persistScheduled )
+		return;
+	d_persistScheduled = true;
+	QTimer::singleShot( ms, this, SLOT(onPersist()) ); // erst nach dem laufenden Commit
+}
+
+void FilterCache::evaluate( const QByteArray& key, const QByteArray& code, const QByteArray& name,
+							const Sdb::Obj& doc, quint64 filter )
+{
+	if( d_jobs.contains( key ) || d_cache.contains( key ) || doc.isNull() )
+		return;
+	FilterJob* job = new FilterJob( this );
+	job->d_key = key;
+	job->d_code = code;
+	job->d_name = name;
+	job->d_path = doc.getDb()->getFilePath();
+	job->d_root = AppContext::inst()->getRoot().getOid();
+	job->d_doc = doc.getOid();
+	job->d_filter = filter;
+	d_resultDocs.insert( job->d_doc ); // ab hier haengt das Resultat vom Stempel ab
+	connect( job, SIGNAL(finished()), this, SLOT(onJobFinished()) );
+	d_jobs[key] = job;
+	job->start( QThread::LowPriority );
+}
+
+void FilterCache::onJobFinished()
+{
+	FilterJob* job = static_cast<FilterJob*>( sender() );
+	const QByteArray key = d_jobs.key( job ); // job nicht dereferenzieren, evtl. bereits abgebrochen
+	if( key.isNull() )
+		return;
+	d_jobs.remove( key );
+	const QString error = job->d_error;
+	const bool complete = !job->d_incomplete && error.isEmpty();
+	if( !job->d_cancel && !job->d_res.d_bits.isEmpty() )
+	{
+		if( complete )
+		{
+			d_cache.insert( key, new Result( job->d_res ), job->d_res.d_bits.size() / 8 + 1 );
+			if( job->d_filter )
+				store( job->d_filter, job->d_doc, key, job->d_res );
+		}else
+			// Unvollstaendig oder mit Fehlern: nur die wartenden Viewer erhalten das Resultat
+			d_incomplete.insert( key, job->d_res );
+	}
+	job->deleteLater();
+	emit evaluated( key, error );
+	d_incomplete.remove( key );
+}
+
+int FilterCache::getProgress( const QByteArray& key ) const
+{
+	const FilterJob* job = d_jobs.value( key );
+	if( job == 0 )
+		return -1;
+	const int total = job->d_total;
+	if( total <= 0 )
+		return 0;
+	return qint64( job->d_done ) * 100 / total;
+}
+
+void FilterCache::cancelAll()
+{
+	QHash<QByteArray,FilterJob*>::const_iterator i;
+	for( i = d_jobs.begin(); i != d_jobs.end(); ++i )
+		i.value()->d_cancel = true;
+	for( i = d_jobs.begin(); i != d_jobs.end(); ++i )
+	{
+		i.value()->wait();
+		delete i.value();
+	}
+	d_jobs.clear();
+}
+
+void FilterCache::clear()
+{
+	cancelAll();
+	d_cache.clear();
+}
+
+static bool _affectsFilters( quint32 name )
+{
+	// Filter koennen vom Review-Status und von Annotationen abhaengen
+	switch( name )
+	{
+	case AttrReviewStatus:
+	case AttrConsRevStat:
+	case AttrAnnotated:
+	case AttrAnnNr:
+	case AttrAnnAttr:
+	case AttrAnnPos:
+	case AttrAnnLen:
+	case AttrAnnText:
+	case AttrAnnHomeDoc:
+	case AttrAnnPrio:
+	case AttrAnnOldNr:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void FilterCache::onDbUpdate( Sdb::UpdateInfo info )
+{
+	switch( info.d_kind )
+	{
+	case Sdb::UpdateInfo::DbClosing:
+		clear();
+		d_dirtyDocs.clear();
+		d_toStore.clear();
+		d_resultDocs.clear();
+		d_scannedDocs.clear();
+		break;
+	case Sdb::UpdateInfo::ValueChanged:
+		if( _affectsFilters( info.d_name ) )
+		{
+			Sdb::Obj o = AppContext::inst()->getTxn()->getObject( info.d_id );
+			Sdb::Obj doc;
+			switch( o.getType() )
+			{
+			case TypeDocument:
+				doc = o;
+				break;
+			case TypeAnnotation:
+				doc = o.getObject( AttrAnnHomeDoc );
+				break;
+			default:
+				doc = o.getObject( AttrObjHomeDoc );
+				break;
+			}
+			if( doc.isNull() || !hasResults( doc ) )
+				break; // ohne Resultate ist der Stempel egal; das naechste makeKey nimmt den aktuellen
+			d_dirtyDocs.insert( doc.getOid() );
+			schedulePersist();
+		}
+		break;
+	}
+}
+
+void FilterCache::onPersist()
+{
+	d_persistScheduled = false;
+	if( d_dirtyDocs.isEmpty() && d_toStore.isEmpty() )
+		return;
+	if( !canWrite() )
+	{
+		schedulePersist( 500 );
+		return;
+	}
+	// Eigene Transaktion; die von AppContext gehoert der GUI und wird hier weder committed noch
+	// zurueckgesetzt
+	Sdb::Transaction txn( AppContext::inst()->getDb() );
+	try
+	{
+		foreach( quint64 id, d_dirtyDocs )
+		{
+			Sdb::Obj doc = txn.getObject( id );
+			if( doc.getType() == TypeDocument )
+				doc.setValue( AttrDocFilterStamp, Stream::DataCell().setUInt32(
+					doc.getValue( AttrDocFilterStamp ).getUInt32() + 1 ) );
+		}
+		for( int i = 0; i < d_toStore.size(); i++ )
+		{
+			const Pending& p = d_toStore[i];
+			Sdb::Obj f = txn.getObject( p.d_filter );
+			if( f.getType() != TypeLuaFilter )
+				continue;
+			_Stored stored = _readStored( f );
+			stored[p.d_doc] = qMakePair( p.d_key, p.d_res );
+			_Stored::iterator j = stored.begin();
+			while( j != stored.end() )
+			{
+				// Resultate geloeschter Dokumente verwerfen
+				const Sdb::Obj doc = txn.getObject( j.key() );
+				if( doc.isNull() || doc.isDeleted() || doc.getType() != TypeDocument )
+					j = stored.erase( j );
+				else
+					++j;
+			}
+			f.setValue( AttrFilterResults, Stream::DataCell().setLob( _writeStored( stored ) ) );
+		}
+		txn.commit();
+	}catch( const Sdb::DatabaseException& e )
+	{
+		qWarning() << "FilterCache::onPersist:" << e.getCodeString() << e.getMsg();
+		txn.rollback();
+	}
+	d_dirtyDocs.clear();
+	d_toStore.clear();
+}
@@ -0,0 +1,117 @@
+#ifndef FILTERCACHE_H
+#define FILTERCACHE_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QBitArray>
+#include <QCache>
+#include <QHash>
+#include <QSet>
+#include <Sdb/Obj.h>
+#include <Sdb/UpdateInfo.h>
+#include "Stopwatch.h"
+
+struct lua_State;
+struct lua_Debug;
+
+namespace Ds
+{
+	class FilterJob;
+
+	// Begrenzt Filteraufrufe ueber einen Count-Hook auf Instruktionen und Zeit pro Objekt und bricht
+	// bei Ueberschreitung oder cancel mit einem Lua-Fehler ab. Ist bereits ein Hook gesetzt (Debugger,
+	// Profiler), gilt kein Budget.
+	class FilterBudget
+	{
+	public:
+		FilterBudget( lua_State*, int maxMs, int maxInstructions, volatile bool* cancel = 0 );
+		~FilterBudget();
+		void restart(); // vor jedem Objekt
+		bool isExceeded() const { return d_exceeded; }
+	private:
+		static void hook( lua_State*, lua_Debug* );
+		lua_State* d_L;
+		Stopwatch d_timer;
+		int d_maxMs;
+		int d_maxSteps;
+		int d_steps;
+		volatile bool* d_cancel;
+		bool d_exceeded;
+		bool d_active;
+	};
+
+	// Wertet Lua-Filter im Hintergrund in einem eigenen lua_State ueber das ganze Dokument aus
+	// und haelt das Resultat als Sichtbarkeits-Bitmap pro (Filter-Hash, Dokument, Importdatum,
+	// AttrDocFilterStamp). Das letzte Resultat pro Dokument wird zudem im TypeLuaFilter-Objekt
+	// gespeichert. Geschrieben wird nur aus der obersten Event-Schleife ausserhalb von Batches
+	// (siehe canWrite), damit kein fremder, offener Stand von AppContext::getTxn mitcommitted wird.
+	class FilterCache : public QObject
+	{
+		Q_OBJECT
+	public:
+		struct Result
+		{
+			quint64 d_base; // kleinste OID der Bitmap
+			QBitArray d_bits; // ein Bit pro OID ab d_base
+			Result():d_base(0) {}
+			bool covers( quint64 oid ) const { return oid >= d_base && ( oid - d_base ) < quint64( d_bits.size() ); }
+			bool isVisible( quint64 oid ) const { return d_bits.testBit( oid - d_base ); }
+		};
+
+		static FilterCache* inst();
+		static QByteArray makeKey( const QByteArray& code, const Sdb::Obj& doc );
+
+		bool find( const QByteArray& key, Result&, quint64 filter = 0, quint64 doc = 0 );
+		void evaluate( const QByteArray& key, const QByteArray& code, const QByteArray& name,
+					   const Sdb::Obj& doc, quint64 filter = 0 );
+		bool isPending( const QByteArray& key ) const { return d_jobs.contains( key ); }
+		int getProgress( const QByteArray& key ) const; // Prozent oder -1, wenn nicht pendent
+		void clear();
+	signals:
+		void evaluated( const QByteArray& key, const QString& error );
+	protected slots:
+		void onJobFinished();
+		void onDbUpdate( Sdb::UpdateInfo );
+		void onPersist();
+	private:
+		FilterCache( QObject* );
+		~FilterCache();
+		void cancelAll();
+		void store( quint64 filter, quint64 doc, const QByteArray& key, const Result& );
+		void schedulePersist( int ms = 0 );
+		bool hasResults( const Sdb::Obj& doc );
+		static bool canWrite();
+		struct Pending
+		{
+			quint64 d_filter;
+			quint64 d_doc;
+			QByteArray d_key;
+			Result d_res;
+		};
+		QCache<QByteArray,Result> d_cache;
+		QHash<QByteArray,FilterJob*> d_jobs;
+		QSet<quint64> d_dirtyDocs; // AttrDocFilterStamp noch zu erhoehen
+		QSet<quint64> d_resultDocs; // Dokumente mit gecachten, laufenden oder gespeicherten Resultaten
+		QSet<quint64> d_scannedDocs; // auf gespeicherte Resultate geprueft, siehe hasResults
+		QList<Pending> d_toStore; // noch nicht im TypeLuaFilter-Objekt
+		QHash<QByteArray,Result> d_incomplete; // nur waehrend evaluated, weder gecached noch gespeichert
+		bool d_persistScheduled;
+	};
+}
+
+#endif // FILTERCACHE_H
@@ -25,12 +25,67 @@
 #include <QtDebug>
 #include <QTextDocument>
 #include <QTextCursor>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QCache>
 using namespace Ds;
 using namespace Sdb;
 using namespace Stream;
 
 Q_DECLARE_METATYPE( QTextDocument* ) 
 
+typedef QPair<quint64,quint64> _DiffKey; // first, last History-Record
+
+struct _DiffRes
+{
+	QString d_old;
+	QString d_new;
+	StringDiff::Items d_items;
+};
+// Diffs pro (first, last), gemeinsam fr alle Viewer; Kosten in Zeichen
+static QCache<_DiffKey,_DiffRes> s_diffs( 4 * 1024 * 1024 );
+static QMutex s_diffLock; // s_diffs, HistMdl::d_jobs und DiffJob::d_mdl; der Worker schreibt in s_diffs
+
+static const int s_syncLimit = 2000; // krzere Texte werden direkt im GUI-Thread verglichen
+static const int s_maxCost = 500; // D der mittleren Schlange in Tokens, d.h. etwa 1000 nderungen; darber wird der Abschnitt als Ganzes ersetzt
+
+namespace Ds
+{
+	class DiffJob : public QRunnable
+	{
+	public:
+		_DiffKey d_key;
+		_DiffRes d_res;
+		HistMdl* d_mdl; // 0 nach HistMdl::cancelJobs
+		DiffJob( HistMdl* m ):d_mdl(m) {}
+		void run()
+		{
+			{
+				QMutexLocker lock( &s_diffLock );
+				if( d_mdl == 0 )
+					return; // Zeile verschwunden, solange der Auftrag noch wartete
+			}
+			d_res.d_items = StringDiff::Diff( d_res.d_old, d_res.d_new, StringDiff::Tokens, s_maxCost );
+			QMutexLocker lock( &s_diffLock );
+			s_diffs.insert( d_key, new _DiffRes( d_res ), d_res.d_old.size() + d_res.d_new.size() + 1 );
+			if( d_mdl )
+			{
+				d_mdl->d_jobs.remove( this );
+				QMetaObject::invokeMethod( d_mdl, "onDiffDone", Qt::QueuedConnection );
+			}
+		}
+	};
+}
+
+static QThreadPool* _diffPool()
+{
+	// Ein Worker mit Warteschlange fuer alle Viewer statt eines Threads pro gezeichneter Zeile
+	static QThreadPool s_pool;
+	s_pool.setMaxThreadCount( 1 );
+	return &s_pool;
+}
+
 HistMdl::HistMdl(QObject *parent)
 	: QAbstractItemModel(parent)
 {
@@ -39,7 +94,16 @@ HistMdl::HistMdl(QObject *parent)
 
 HistMdl::~HistMdl()
 {
+	cancelJobs();
+}
 
+void HistMdl::cancelJobs()
+{
+	// Wartende Auftraege entfallen; ein laufender fuellt nur noch den Cache
+	QMutexLocker lock( &s_diffLock );
+	foreach( DiffJob* job, d_jobs )
+		job->d_mdl = 0;
+	d_jobs.clear();
 }
 
 void HistMdl::setObj( const Sdb::Obj& o )
@@ -52,6 +116,7 @@ void HistMdl::setObj( const Sdb::Obj& o )
 
 void HistMdl::refill()
 {
+	cancelJobs(); // die bisherigen Zeilen werden nicht mehr angezeigt
 	if( !d_rows.isEmpty() )
 	{
 		beginRemoveRows( QModelIndex(), 0, d_rows.size() - 1 );
@@ -239,6 +304,12 @@ QModelIndex HistMdl::parent(const QModelIndex & index) const
 }
 
 void HistMdl::printDiff( QTextCursor& cur, const QString& newText, const QString& oldText )
+{
+    printDiff( cur, newText, oldText, StringDiff::Diff( oldText, newText, StringDiff::Tokens, s_maxCost ) );
+}
+
+void HistMdl::printDiff( QTextCursor& cur, const QString& newText, const QString& oldText,
+						 const StringDiff::Items& res )
 {
     QTextCharFormat normal = Txt::Styles::inst()->getCharFormat( Txt::Styles::PAR );
     QTextCharFormat fNew = normal;
@@ -247,45 +318,29 @@ void HistMdl::printDiff( QTextCursor& cur, const QString& newText, const QString
     QTextCharFormat fDel = normal;
     fDel.setFontStrikeOut( true );
     fDel.setForeground( Qt::blue );
-    StringDiff::Items res = StringDiff::Diff( oldText, newText );
     int pos = 0;
     for( int i = 0; i < res.size(); i++ )
     {
-        StringDiff::Item& it = res[i];
-
-        // TODO: folgendes ist noch nicht maximal effizient
+        const StringDiff::Item& it = res[i];
 
         // write unchanged chars
-        QString str;
-        while( ( pos < it.StartB ) && ( pos < newText.size() ) )
+        const int unchanged = qMin( it.StartB, newText.size() ) - pos;
+        if( unchanged > 0 )
         {
-            str += newText[pos];
-            pos++;
-        } // while
-        if( !str.isEmpty() )
-            cur.insertText( str, normal );
-        str.clear();
+            cur.insertText( newText.mid( pos, unchanged ), normal );
+            pos += unchanged;
+        }
 
         // write deleted chars
         if( it.deletedA > 0 )
-        {
-            for( int m = 0; m < it.deletedA; m++ )
-                str += oldText[it.StartA + m];
-            if( !str.isEmpty() )
-                cur.insertText( str, fDel );
-            str.clear();
-        }
+            cur.insertText( oldText.mid( it.StartA, it.deletedA ), fDel );
 
         // write inserted chars
-        if( pos < ( it.StartB + it.insertedB ) )
+        const int inserted = it.StartB + it.insertedB - pos;
+        if( inserted > 0 )
         {
-            while( pos < ( it.StartB + it.insertedB ) )
-            {
-                str += newText[pos];
-                pos++;
-            }
-            if( !str.isEmpty() )
-                cur.insertText(str,fNew);
+            cur.insertText( newText.mid( pos, inserted ), fNew );
+            pos += inserted;
         }
     }
 
@@ -306,14 +361,14 @@ void HistMdl::calcDiff( int row ) const
 			last = d_obj.getTxn()->getObject( d_rows[row].d_last );
 
 		QString oldVal, newVal;
-		DataCell v = first.getValue( AttrHistOld ); 
+		DataCell v = TypeDefs::getValue( first, AttrHistOld ); 
 		if( v.isBml() )
 		{
 			DataReader r( v );
 			oldVal = r.extractString();
 		}else if( !v.isNull() )
 			oldVal = v.toPrettyString();
-		v = last.getValue( AttrHistNew );
+		v = TypeDefs::getValue( last, AttrHistNew );
 		if( v.isBml() )
 		{
 			DataReader r( v );
@@ -321,9 +376,89 @@ void HistMdl::calcDiff( int row ) const
 		}else if( !v.isNull() )
 			newVal = v.toPrettyString();
 
-		d_rows[row].d_doc = new QTextDocument( const_cast<HistMdl*>(this) );
-		QTextCursor cur( d_rows[row].d_doc );
-        printDiff( cur, newVal, oldVal );
+		const _DiffKey key( d_rows[row].d_first, d_rows[row].d_last );
+		_DiffRes res; // Kopie; der Worker kann den Eintrag im Cache jederzeit verdraengen
+		bool found = false;
+		{
+			QMutexLocker lock( &s_diffLock );
+			_DiffRes* r = s_diffs.object( key );
+			if( r != 0 && ( r->d_old != oldVal || r->d_new != newVal ) )
+			{
+				// OIDs werden wiederverwendet (neue History, Compactor, anderes Repository)
+				s_diffs.remove( key );
+				r = 0;
+			}
+			if( r != 0 )
+			{
+				res = *r;
+				found = true;
+			}
+		}
+		if( !found && oldVal.size() + newVal.size() <= s_syncLimit )
+		{
+			res.d_old = oldVal;
+			res.d_new = newVal;
+			res.d_items = StringDiff::Diff( oldVal, newVal, StringDiff::Tokens, s_maxCost );
+			showDiff( row, newVal, oldVal, res.d_items );
+			QMutexLocker lock( &s_diffLock );
+			s_diffs.insert( key, new _DiffRes( res ), oldVal.size() + newVal.size() + 1 );
+		}else if( found )
+			showDiff( row, res.d_new, res.d_old, res.d_items );
+		else
+		{
+			// Platzhalter bis onDiffDone
+			d_rows[row].d_doc = new QTextDocument( const_cast<HistMdl*>(this) );
+			d_rows[row].d_doc->setDefaultFont( Txt::Styles::inst()->getFont( 0 ) );
+			d_rows[row].d_doc->setPlainText( tr("<computing differences...>") );
+			d_rows[row].d_pending = true;
+			QMutexLocker lock( &s_diffLock );
+			foreach( DiffJob* job, d_jobs )
+			{
+				if( job->d_key == key && job->d_res.d_old == oldVal && job->d_res.d_new == newVal )
+					return; // bereits unterwegs
+			}
+			DiffJob* job = new DiffJob( const_cast<HistMdl*>(this) );
+			job->d_key = key;
+			job->d_res.d_old = oldVal;
+			job->d_res.d_new = newVal;
+			d_jobs.insert( job );
+			_diffPool()->start( job ); // autoDelete
+		}
+	}
+}
+
+void HistMdl::showDiff( int row, const QString& newText, const QString& oldText,
+						const StringDiff::Items& items ) const
+{
+	if( d_rows[row].d_doc )
+		delete d_rows[row].d_doc;
+	d_rows[row].d_pending = false;
+	d_rows[row].d_doc = new QTextDocument( const_cast<HistMdl*>(this) );
+	QTextCursor cur( d_rows[row].d_doc );
+	printDiff( cur, newText, oldText, items );
+}
+
+void HistMdl::onDiffDone()
+{
+	// Der Worker hat das Resultat in s_diffs abgelegt; alle wartenden Zeilen dort nachschlagen
+	for( int row = 0; row < d_rows.size(); row++ )
+	{
+		if( !d_rows[row].d_pending )
+			continue;
+		_DiffRes res;
+		{
+			QMutexLocker lock( &s_diffLock );
+			const _DiffRes* r = s_diffs.object( _DiffKey( d_rows[row].d_first, d_rows[row].d_last ) );
+			if( r == 0 )
+				continue;
+			res = *r;
+		}
+		showDiff( row, res.d_new, res.d_old, res.d_items );
+		const QModelIndex parent = index( row, 0 );
+		const QModelIndex value = index( 0, 0, parent );
+		emit dataChanged( parent, parent );
+		if( value.isValid() )
+			emit dataChanged( value, value );
 	}
 }
 
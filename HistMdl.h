@@ -20,12 +20,16 @@
 #include <QAbstractItemModel>
 #include <Sdb/Obj.h>
 #include <QList>
+#include <QSet>
+#include "StringDiff.h"
 
 class QTextDocument;
 class QTextCursor;
 
 namespace Ds
 {
+	class DiffJob;
+
 	class HistMdl : public QAbstractItemModel
 	{
 		Q_OBJECT
@@ -43,7 +47,10 @@ namespace Ds
 
 		void setObj( const Sdb::Obj& );
 		void refill();
+        // Vergleicht Tokens (nicht Zeichen) mit s_maxCost; so auch Lua toHtmlDiff
         static void printDiff( QTextCursor&, const QString& newText, const QString& oldText );
+        static void printDiff( QTextCursor&, const QString& newText, const QString& oldText,
+							   const StringDiff::Items& );
 
 		// Overrides
 		int columnCount( const QModelIndex & parent = QModelIndex() ) const { return 1; }
@@ -51,8 +58,13 @@ namespace Ds
 		QVariant data ( const QModelIndex & index, int role = Qt::DisplayRole ) const;
 		QModelIndex index ( int row, int column, const QModelIndex & parent = QModelIndex() ) const;
 		QModelIndex parent(const QModelIndex &) const;
+	protected slots:
+		void onDiffDone();
 	protected:
 		void calcDiff( int row ) const;
+		void cancelJobs();
+		void showDiff( int row, const QString& newText, const QString& oldText,
+					   const StringDiff::Items& ) const;
 	private:
 		Sdb::Obj d_obj;
 		struct Slot
@@ -61,10 +73,13 @@ namespace Ds
 			quint64 d_last;
 			QTextDocument* d_doc;
 			quint8 d_type;
-			Slot():d_first(0),d_last(0),d_doc(0),d_type(0){}
-			Slot(quint64 id, quint8 t):d_first(id),d_last(id),d_doc(0),d_type(t){}
+			bool d_pending; // d_doc ist Platzhalter, Diff wird im Hintergrund berechnet
+			Slot():d_first(0),d_last(0),d_doc(0),d_type(0),d_pending(false){}
+			Slot(quint64 id, quint8 t):d_first(id),d_last(id),d_doc(0),d_type(t),d_pending(false){}
 		};
 		mutable QList<Slot> d_rows; // First und Last Change per Attribute
+		mutable QSet<DiffJob*> d_jobs; // wartend oder laufend, geschuetzt durch s_diffLock
+		friend class DiffJob;
 	    
 	};
 }
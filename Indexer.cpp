@@ -173,7 +173,7 @@ static bool index( const Sdb::Obj& obj, Dict& dict, QProgressDialog& dlg )
 	if( dlg.wasCanceled() )
 		return false;
 
-	Stream::DataCell v = obj.getValue( AttrObjText );
+	Stream::DataCell v = TypeDefs::getValue( obj, AttrObjText );
 	if( v.isBml() )
 		indexBml( obj.getId(), v.getBml(), dict );
 	else if( v.isHtml() )
@@ -202,7 +202,7 @@ QString Indexer::fetchText( const Sdb::Obj& obj )
 	if( obj.isNull() )
 		return QString();
 	QString res;
-	Stream::DataCell v = obj.getValue( AttrObjText );
+	Stream::DataCell v = TypeDefs::getValue( obj, AttrObjText );
 	if( v.isBml() )
 	{
 		Stream::DataReader r( v.getBml() );
@@ -1,19 +1,71 @@
 #include "LinksMdl.h"
 #include "TypeDefs.h"
 #include "DocManager.h"
+#include "AppContext.h"
 #include <Sdb/Transaction.h>
+#include <QHash>
 using namespace Ds;
 using namespace Stream;
 
+struct _LinkCount
+{
+	int d_in;
+	int d_out;
+	_LinkCount():d_in(0),d_out(0){}
+};
+// Anzahl In- und Out-Links pro Objekt, gemeinsam fr alle Viewer; nachgefhrt von allen LinksMdl
+// in onDbUpdate, auch ohne angezeigtes Objekt, und geleert, wenn kein LinksMdl mehr existiert
+static QHash<quint64,_LinkCount> s_counts;
+static QHash<quint64,quint64> s_owners; // gezhlter Link -> Objekt, fr ObjectErased
+static int s_instances = 0;
+
+static const _LinkCount& _count( const Sdb::Obj& obj )
+{
+	QHash<quint64,_LinkCount>::iterator i = s_counts.find( obj.getOid() );
+	if( i != s_counts.end() )
+		return i.value();
+	_LinkCount c;
+	Sdb::Obj o = obj.getFirstObj();
+	if( !o.isNull() ) do
+	{
+		if( o.getType() == TypeInLink )
+			c.d_in++;
+		else if( o.getType() == TypeOutLink )
+			c.d_out++;
+		else
+			continue;
+		s_owners[o.getOid()] = obj.getOid();
+	}while( o.next() );
+	return s_counts.insert( obj.getOid(), c ).value();
+}
+
+static Sdb::Obj _firstStub( const Sdb::Obj& link )
+{
+	Sdb::Obj o = link.getFirstObj();
+	if( !o.isNull() ) do
+	{
+		if( o.getType() == TypeStub )
+			return o;
+	}while( o.next() );
+	return Sdb::Obj();
+}
+
 LinksMdl::LinksMdl(QObject *parent)
 	: QAbstractItemModel(parent), d_root( 0 ), d_plainText( false )
 {
 	d_root = new Slot();
+	AppContext::inst()->getDb()->addObserver( this, SLOT(onDbUpdate( Sdb::UpdateInfo )));
+	s_instances++;
 }
 
 LinksMdl::~LinksMdl()
 {
-
+	// Ohne Observer wrden nderungen verpasst; der nchste LinksMdl zhlt neu
+	if( --s_instances == 0 )
+	{
+		s_counts.clear();
+		s_owners.clear();
+	}
 }
 
 LinksMdl::Slot::~Slot()
@@ -43,50 +95,147 @@ void LinksMdl::refill()
 		*d_root = Slot();
 	if( !d_obj.isNull() )
 		d_root->d_oid = d_obj.getOid();
-	fetchAll();
+	else
+		d_root->d_fetched = true;
 	reset();
+	emit countsChanged();
+}
+
+int LinksMdl::getInCount() const
+{
+	if( d_obj.isNull() )
+		return 0;
+	return _count( d_obj ).d_in;
+}
+
+int LinksMdl::getOutCount() const
+{
+	if( d_obj.isNull() )
+		return 0;
+	return _count( d_obj ).d_out;
 }
 
-LinksMdl::Slot* LinksMdl::createSlot( Slot* p, quint64 oid, quint8 kind )
+void LinksMdl::invalidateCounts( quint64 owner )
+{
+	s_counts.remove( owner ); // wird bei Bedarf neu gezhlt
+	if( owner == d_root->d_oid )
+		emit countsChanged();
+}
+
+LinksMdl::Slot* LinksMdl::createSlot( Slot* p, quint64 oid, quint8 kind, int row )
 {
 	Slot* s = new Slot();
 	s->d_oid = oid;
 	s->d_kind = kind;
 	s->d_super = p;
-	p->d_subs.append( s );
+	if( row < 0 || row >= p->d_subs.size() )
+		p->d_subs.append( s );
+	else
+		p->d_subs.insert( row, s );
 	d_map[ s->d_oid ] = s;
 	return s;
 }
 
-void LinksMdl::fetchAll()
+int LinksMdl::fetchLinks()
 {
-	if( d_obj.isNull() )
-		return;
-	Sdb::Obj o = d_obj.getFirstObj();
+	if( d_obj.isNull() || d_root->d_fetched )
+		return 0;
+	Sdb::Obj o;
+	if( d_root->d_subs.isEmpty() )
+		o = d_obj.getFirstObj();
+	else
+	{
+		o = d_obj.getTxn()->getObject( d_root->d_subs.last()->d_oid );
+		if( !o.isNull() && !o.next() )
+		{
+			d_root->d_fetched = true;
+			return 0;
+		}
+	}
+	// Stubs werden erst beim Aufklappen eines Links geladen
+	const int maxBatch = 50; // RISK
+	int n = 0;
 	if( !o.isNull() ) do
 	{
+		if( n >= maxBatch )
+			return n;
 		if( o.getType() == TypeOutLink )
 		{
-			Slot* s = createSlot( d_root, o.getOid(), OutLinkKind );
-			fetchStub( s, o );
+			createSlot( d_root, o.getOid(), OutLinkKind );
+			n++;
 		}else if( o.getType() == TypeInLink )
 		{
-			Slot* s = createSlot( d_root, o.getOid(), InLinkKind );
-			fetchStub( s, o );
+			createSlot( d_root, o.getOid(), InLinkKind );
+			n++;
 		}
 	}while( o.next() );
+	d_root->d_fetched = true;
+	return n;
 }
 
-void LinksMdl::fetchStub( Slot* p, const Sdb::Obj& link )
+int LinksMdl::fetchStub( Slot* p, const Sdb::Obj& link )
 {
+	p->d_fetched = true;
+	int n = 0;
 	Sdb::Obj o = link.getFirstObj();
 	if( !o.isNull() ) do
 	{
 		if( o.getType() == TypeStub )
 		{
 			createSlot( p, o.getOid(), StubKind );
+			n++;
 		}
 	}while( o.next() );
+	return n;
+}
+
+LinksMdl::Slot* LinksMdl::getSlot( const QModelIndex & index ) const
+{
+	if( index.isValid() )
+		return static_cast<Slot*>( index.internalPointer() );
+	else
+		return d_root;
+}
+
+bool LinksMdl::hasChildren( const QModelIndex & parent ) const
+{
+	if( d_obj.isNull() )
+		return false;
+	Slot* p = getSlot( parent );
+	if( !p->d_subs.isEmpty() )
+		return true;
+	if( p->d_fetched )
+		return false;
+	if( p == d_root )
+		return getInCount() + getOutCount() > 0;
+	else if( p->d_kind != StubKind )
+		return !_firstStub( d_obj.getTxn()->getObject( p->d_oid ) ).isNull();
+	else
+		return false;
+}
+
+bool LinksMdl::canFetchMore( const QModelIndex & parent ) const
+{
+	if( d_obj.isNull() )
+		return false;
+	Slot* p = getSlot( parent );
+	return !p->d_fetched && p->d_kind != StubKind;
+}
+
+void LinksMdl::fetchMore( const QModelIndex & parent )
+{
+	if( d_obj.isNull() )
+		return;
+	Slot* p = getSlot( parent );
+	int n = 0;
+	if( p == d_root )
+		n = fetchLinks();
+	else if( p->d_kind != StubKind && !p->d_fetched )
+		n = fetchStub( p, d_obj.getTxn()->getObject( p->d_oid ) );
+	if( n == 0 )
+		return;
+	beginInsertRows( parent, p->d_subs.size() - n, p->d_subs.size() - 1 );
+	endInsertRows();
 }
 
 quint64 LinksMdl::getOid( const QModelIndex & index ) const
@@ -194,7 +343,7 @@ QVariant LinksMdl::data ( const QModelIndex & index, int role ) const
 				else
 				{
 					Sdb::Obj o = d_obj.getTxn()->getObject( s->d_oid );
-					DataCell v = o.getValue( AttrObjText );
+					DataCell v = TypeDefs::getValue( o, AttrObjText );
 					if( v.isNull() )
 						return QVariant();
 					else if( v.isBml() )
@@ -206,20 +355,19 @@ QVariant LinksMdl::data ( const QModelIndex & index, int role ) const
 			break;
 		case BodyTextRole:
 			{
-				Slot* t = s;
+				Sdb::Obj o = d_obj.getTxn()->getObject( s->d_oid );
 				if( s->d_kind != StubKind )
 				{
-					if( !s->d_subs.empty() )
-						t = s->d_subs.first();
-					else
+					// Stubs evtl. noch nicht geladen
+					o = _firstStub( o );
+					if( o.isNull() )
 						return "";
 				}
 				QString str;
-				Sdb::Obj o = d_obj.getTxn()->getObject( t->d_oid );
 				Stream::DataCell v = o.getValue( AttrStubTitle );
 				if( v.isStr() && !v.getStr().isEmpty() )
 					str = o.getValue( AttrObjNumber ).toString(true) + " " + v.toString(true) + "\r\n";
-				v = o.getValue( AttrObjText );
+				v = TypeDefs::getValue( o, AttrObjText );
 				if( v.isBml() )
 				{
 					Stream::DataReader r( v );
@@ -274,10 +422,174 @@ QVariant LinksMdl::data ( const QModelIndex & index, int role ) const
 	return QVariant();
 }
 
-QModelIndex LinksMdl::findIndex( quint64 oid ) const
+QModelIndex LinksMdl::findIndex( quint64 oid )
 {
-	for( int row = 0; row < d_root->d_subs.size(); row++ )
-		if( d_root->d_subs[row]->d_oid == oid )
-			return index( row, 0 );
+	int row = 0;
+	do
+	{
+		for( ; row < d_root->d_subs.size(); row++ )
+			if( d_root->d_subs[row]->d_oid == oid )
+				return index( row, 0 );
+		if( !canFetchMore( QModelIndex() ) )
+			break;
+		fetchMore( QModelIndex() );
+	}while( row < d_root->d_subs.size() );
 	return QModelIndex();
 }
+
+QModelIndex LinksMdl::indexOf( Slot* s ) const
+{
+	if( s == d_root || s->d_super == 0 )
+		return QModelIndex();
+	const int row = s->d_super->d_subs.indexOf( s );
+	Q_ASSERT( row >= 0 );
+	return createIndex( row, 0, s );
+}
+
+void LinksMdl::insertObj( Slot* p, const Sdb::Obj& o )
+{
+	quint8 kind;
+	const quint32 type = o.getType();
+	if( p == d_root && type == TypeOutLink )
+		kind = OutLinkKind;
+	else if( p == d_root && type == TypeInLink )
+		kind = InLinkKind;
+	else if( p != d_root && type == TypeStub )
+		kind = StubKind;
+	else
+		return;
+	if( !p->d_fetched && ( p != d_root || p->d_subs.isEmpty() ) )
+	{
+		// Stubs werden beim Aufklappen geladen; ein leerer Root beim nchsten fetchMore
+		if( p != d_root )
+		{
+			const QModelIndex i = indexOf( p );
+			emit dataChanged( i, i );
+		}
+		return;
+	}
+	// Position des nchsten geladenen Vorgngers suchen
+	int row = 0;
+	Sdb::Obj prev = o;
+	while( prev.prev() )
+	{
+		Slot* s = d_map.value( prev.getOid() );
+		if( s != 0 && s->d_super == p )
+		{
+			row = p->d_subs.indexOf( s ) + 1;
+			break;
+		}
+	}
+	if( !p->d_fetched && row == p->d_subs.size() )
+		return; // liegt im noch nicht geladenen Rest; fetchLinks holt es spter
+	beginInsertRows( indexOf( p ), row, row );
+	createSlot( p, o.getOid(), kind, row );
+	endInsertRows();
+	if( kind == StubKind )
+	{
+		// BodyTextRole des Links hngt vom ersten Stub ab
+		const QModelIndex i = indexOf( p );
+		emit dataChanged( i, i );
+	}
+}
+
+void LinksMdl::removeSlot( Slot* s )
+{
+	Slot* p = s->d_super;
+	Q_ASSERT( p != 0 );
+	const int row = p->d_subs.indexOf( s );
+	Q_ASSERT( row >= 0 );
+	beginRemoveRows( indexOf( p ), row, row );
+	p->d_subs.removeAt( row );
+	d_map.remove( s->d_oid );
+	for( int i = 0; i < s->d_subs.size(); i++ )
+		d_map.remove( s->d_subs[i]->d_oid );
+	delete s;
+	endRemoveRows();
+}
+
+void LinksMdl::onDbUpdate( Sdb::UpdateInfo info )
+{
+	// Zuerst den gemeinsamen Zhler-Cache, unabhngig vom angezeigten Objekt
+	switch( info.d_kind )
+	{
+	case Sdb::UpdateInfo::DbClosing:
+		s_counts.clear();
+		s_owners.clear();
+		break;
+	case Sdb::UpdateInfo::Aggregated:
+		// Neuer Owner und, falls der Link bereits gezhlt war, der bisherige
+		s_counts.remove( info.d_id2 );
+		if( s_owners.contains( info.d_id ) )
+			s_counts.remove( s_owners.take( info.d_id ) );
+		break;
+	case Sdb::UpdateInfo::ObjectErased:
+		s_counts.remove( info.d_id );
+		if( s_owners.contains( info.d_id ) )
+		{
+			const quint64 owner = s_owners.take( info.d_id );
+			s_counts.remove( owner );
+			if( !d_obj.isNull() && owner == d_root->d_oid )
+				emit countsChanged();
+		}
+		break;
+	default:
+		break;
+	}
+	if( d_obj.isNull() )
+		return;
+	switch( info.d_kind )
+	{
+	case Sdb::UpdateInfo::DbClosing:
+		setObj( Sdb::Obj() );
+		break;
+	case Sdb::UpdateInfo::ValueChanged:
+		{
+			Slot* s = d_map.value( info.d_id );
+			if( s != 0 )
+			{
+				QModelIndex i = indexOf( s );
+				emit dataChanged( i, i );
+				if( s->d_kind == StubKind )
+				{
+					i = indexOf( s->d_super );
+					emit dataChanged( i, i );
+				}
+			}
+		}
+		break;
+	case Sdb::UpdateInfo::Aggregated:
+		{
+			Slot* p = ( info.d_id2 == d_root->d_oid )? d_root : d_map.value( info.d_id2 );
+			Slot* s = d_map.value( info.d_id );
+			if( s != 0 )
+			{
+				if( s->d_super == p )
+					break;
+				if( s->d_super == d_root )
+					invalidateCounts( d_root->d_oid );
+				removeSlot( s ); // verschoben
+			}
+			Sdb::Obj o = d_obj.getTxn()->getObject( info.d_id );
+			if( o.getType() == TypeInLink || o.getType() == TypeOutLink )
+				invalidateCounts( info.d_id2 );
+			if( p != 0 )
+				insertObj( p, o );
+		}
+		break;
+	case Sdb::UpdateInfo::ObjectErased:
+		if( info.d_id == d_root->d_oid )
+			setObj( Sdb::Obj() );
+		else
+		{
+			Slot* s = d_map.value( info.d_id );
+			if( s != 0 )
+			{
+				if( s->d_super == d_root )
+					invalidateCounts( d_root->d_oid );
+				removeSlot( s );
+			}
+		}
+		break;
+	}
+}
@@ -47,7 +47,9 @@ namespace Ds
 		void setObj( const Sdb::Obj& );
 		void refill();
 		quint64 getOid( const QModelIndex & ) const;
-		QModelIndex findIndex( quint64 oid ) const;
+		QModelIndex findIndex( quint64 oid ); // fetches more links if needed
+		int getInCount() const; // ohne die Links zu laden
+		int getOutCount() const;
 		void setPlainText( bool on ) { d_plainText = on; }
 		bool getPlainText() const { return d_plainText; }
 
@@ -57,6 +59,13 @@ namespace Ds
 		QVariant data ( const QModelIndex & index, int role = Qt::DisplayRole ) const;
 		QModelIndex index ( int row, int column, const QModelIndex & parent = QModelIndex() ) const;
 		QModelIndex parent(const QModelIndex &) const;
+		bool hasChildren( const QModelIndex & parent = QModelIndex() ) const;
+		bool canFetchMore ( const QModelIndex & parent ) const;
+		void fetchMore ( const QModelIndex & parent );
+	signals:
+		void countsChanged();
+	protected slots:
+		void onDbUpdate( Sdb::UpdateInfo );
 	private:
 		Sdb::Obj d_obj;
 		struct Slot
@@ -65,16 +74,22 @@ namespace Ds
 			QList<Slot*> d_subs;
 			Slot* d_super;
 			quint8 d_kind;
-			Slot():d_super(0),d_oid(0),d_kind(0){}
+			bool d_fetched; // Root: alle Links geladen; Link: Stubs geladen
+			Slot():d_super(0),d_oid(0),d_kind(0),d_fetched(false){}
 			~Slot();
 		};
 		Slot* d_root;
 		QMap<quint64,Slot*> d_map;
 		bool d_plainText;
 	protected:
-		void fetchAll();
-		void fetchStub( Slot* p, const Sdb::Obj& link );
-		Slot* createSlot( Slot* p, quint64 oid, quint8 kind );
+		int fetchLinks();
+		int fetchStub( Slot* p, const Sdb::Obj& link );
+		Slot* getSlot( const QModelIndex & ) const;
+		void invalidateCounts( quint64 owner );
+		Slot* createSlot( Slot* p, quint64 oid, quint8 kind, int row = -1 );
+		QModelIndex indexOf( Slot* ) const;
+		void insertObj( Slot* p, const Sdb::Obj& o );
+		void removeSlot( Slot* );
 	    
 	};
 }
@@ -26,21 +26,32 @@
 #include <QFileDialog>
 #include <QApplication>
 #include <QSettings>
+#include <QThread>
+#include <QSet>
+#include <QCryptographicHash>
+#include <QPointer>
+#include <QCache>
+#include <QMutex>
+#include <QDateTime>
+#include <QtDebug>
+#include <Sdb/Exceptions.h>
 #include <Script2/QtValue.h>
 #include "TypeDefs.h"
 #include "HistMdl.h"
+#include "Timeline.h"
+#include "Statistics.h"
+#include "ObjectQuery.h"
+#include "ScriptJob.h"
+#include "ResultView.h"
+#include "Stopwatch.h"
 #include "DocSelectorDlg.h"
 #include "AppContext.h"
 using namespace Lua;
 using namespace Ds;
 
 /* TODO
-    Annotation Handling
-    Set Review Status
     guarded Pointer to History und Annotations
     Document Indexer
-    Object List in Viewer, deren Inhalt mit einem Lua-Statement gefllt werden kann
-    Allgemeine Ergebnisliste mit Doppelklick-Navigation und ev. entfernen aus der Liste
     Spter:
     Table Aggregation (kann man auch selber in Lua)
     Attr Selector Dlg
@@ -214,6 +225,49 @@ struct _SpecialValue
         lua_pushinteger( L, t.second() );
         return 3;
     }
+    static QString renderHtml( const Stream::DataCell& v, bool fragment, const QByteArray& charset )
+    {
+        if( v.isHtml() )
+        {
+            if( fragment )
+            {
+                QTextDocument doc;
+                doc.setHtml( v.getStr() );
+                QTextDocumentFragment f( &doc );
+                return f.toHtml( charset );
+            }else
+                return v.getStr();
+        }else if( v.isBml() )
+        {
+            QTextDocument doc;
+            Txt::TextInStream in;
+            in.readFromTo( v, &doc );
+            Txt::TextOutHtml out( &doc );
+            return out.toHtml( fragment, charset );
+        }else if( v.isDate() || v.isTime() || v.isDateTime() )
+        {
+            if( fragment )
+                return QString::fromAscii(toIsoDate( v ));
+            else
+                return QString( "<html><body>%1</body></html>" ).arg(
+                                    QString::fromLatin1( toIsoDate( v ) ) );
+        }else if( v.isImg() )
+        {
+            if( fragment )
+                return QString( "<img src=\"data:image/png;base64,%1\"/>" ).arg(
+                        QLatin1String( v.getArr().toBase64() ) );
+            else
+                return QString(
+                    "<html><body><img src=\"data:image/png;base64,%1\"/></body></html>" ).arg(
+                        QLatin1String( v.getArr().toBase64() ) );
+        }else
+        {
+            if( fragment )
+                return v.toString();
+            else
+                return QString( "<html><body>%1</body></html>" ).arg( v.toString() );
+        }
+    }
     static int toHtml( lua_State* L )
     {
         if( lua_isuserdata(L, 1 ) )
@@ -224,46 +278,7 @@ struct _SpecialValue
             QByteArray charset = "latin-1";
             if( lua_isstring( L, 3 ) )
                 charset = lua_tostring( L, 3 );
-            if( obj->d_value.isHtml() )
-            {
-                if( lua_toboolean( L, 2 ) )
-                {
-                    QTextDocument doc;
-                    doc.setHtml( obj->d_value.getStr() );
-                    QTextDocumentFragment f( &doc );
-					*str = f.toHtml( charset );
-                }else
-					*str = obj->d_value.getStr();
-            }else if( obj->d_value.isBml() )
-            {
-                QTextDocument doc;
-                Txt::TextInStream in;
-                in.readFromTo( obj->d_value, &doc );
-                Txt::TextOutHtml out( &doc );
-				*str = out.toHtml( lua_toboolean( L, 2 ), charset );
-            }else if( obj->d_value.isDate() || obj->d_value.isTime() || obj->d_value.isDateTime() )
-            {
-                if( lua_toboolean( L, 2 ) )
-					*str = QString::fromAscii(toIsoDate( obj->d_value ));
-                else
-					*str = QString( "<html><body>%1</body></html>" ).arg(
-                                        QString::fromLatin1( toIsoDate( obj->d_value ) ) );
-            }else if( obj->d_value.isImg() )
-            {
-                if( lua_toboolean( L, 2 ) )
-					*str = QString( "<img src=\"data:image/png;base64,%1\"/>" ).arg(
-                            QLatin1String( obj->d_value.getArr().toBase64() ) );
-                else
-					*str = QString(
-                        "<html><body><img src=\"data:image/png;base64,%1\"/></body></html>" ).arg(
-                            QLatin1String( obj->d_value.getArr().toBase64() ) );
-            }else
-            {
-                if( lua_toboolean( L, 2 ) )
-					*str = obj->d_value.toString();
-                else
-					*str = QString( "<html><body>%1</body></html>" ).arg( obj->d_value.toString() );
-            }
+            *str = renderHtml( obj->d_value, lua_toboolean( L, 2 ), charset );
         }else
         {
 			_String* str = QtValue<_String>::create( L );
@@ -320,6 +335,81 @@ static const luaL_reg SpecialValue_reg[] =
     { 0, 0 }
 };
 
+// Cache pro lua_State in der Registry: Objekttyp -> { Feldname -> Atom oder false } und Atom -> Name.
+// Lua-Strings sind interniert, ein Treffer kostet damit keine QByteArray- und QHash-Zugriffe.
+// setRoot leert den Cache, da die Atome zur Datenbank gehoeren.
+static char s_atomCache = 0;
+static char s_nameCache = 0;
+
+static void _pushCache( lua_State *L, void* key )
+{
+    lua_pushlightuserdata( L, key );
+    lua_rawget( L, LUA_REGISTRYINDEX );
+    if( !lua_istable( L, -1 ) )
+    {
+        lua_pop( L, 1 );
+        lua_newtable( L );
+        lua_pushlightuserdata( L, key );
+        lua_pushvalue( L, -2 );
+        lua_rawset( L, LUA_REGISTRYINDEX );
+    }
+}
+
+static void _pushTypeCache( lua_State *L, quint32 type )
+{
+    _pushCache( L, &s_atomCache );
+    lua_rawgeti( L, -1, type );
+    if( !lua_istable( L, -1 ) )
+    {
+        lua_pop( L, 1 );
+        lua_newtable( L );
+        lua_pushvalue( L, -1 );
+        lua_rawseti( L, -3, type );
+    }
+    lua_remove( L, -2 );
+}
+
+static qint64 _cachedAtom( lua_State *L, quint32 type, int name )
+{
+    // -1: nicht im Cache, 0: kein Atom (Methode oder unbekannt)
+    _pushTypeCache( L, type );
+    lua_pushvalue( L, name );
+    lua_rawget( L, -2 );
+    qint64 res = -1;
+    if( lua_isnumber( L, -1 ) )
+        res = qint64( lua_tonumber( L, -1 ) );
+    else if( lua_isboolean( L, -1 ) )
+        res = 0;
+    lua_pop( L, 2 );
+    return res;
+}
+
+static void _cacheAtom( lua_State *L, quint32 type, int name, quint32 atom )
+{
+    _pushTypeCache( L, type );
+    lua_pushvalue( L, name );
+    if( atom )
+        lua_pushnumber( L, atom );
+    else
+        lua_pushboolean( L, false );
+    lua_rawset( L, -3 );
+    lua_pop( L, 1 );
+}
+
+static void _pushAtomName( lua_State *L, quint32 atom, Sdb::Database* db )
+{
+    _pushCache( L, &s_nameCache );
+    lua_rawgeti( L, -1, atom );
+    if( lua_isnil( L, -1 ) )
+    {
+        lua_pop( L, 1 );
+        lua_pushstring( L, TypeDefs::getSimpleName( atom, db ) );
+        lua_pushvalue( L, -1 );
+        lua_rawseti( L, -3, atom );
+    }
+    lua_remove( L, -2 );
+}
+
 struct _ContentObject
 {
     Sdb::Obj d_obj;
@@ -336,11 +426,28 @@ struct _ContentObject
         _ContentObject* obj = ValueBinding<_ContentObject>::check( L, 1 );
         obj->checkValid(L);
         const char* fieldName = luaL_checkstring( L, 2 );
-        const quint32 atom = TypeDefs::findAtom( obj->d_obj.getDb(), fieldName, obj->d_obj.getType() );
-        if( atom )
+        const quint32 type = obj->d_obj.getType();
+        qint64 atom = _cachedAtom( L, type, 2 );
+        if( atom < 0 )
+        {
+            atom = TypeDefs::findAtom( obj->d_obj.getDb(), fieldName, type );
+            _cacheAtom( L, type, 2, atom );
+        }
+        if( atom > 0 )
             return pushValue( L, atom, obj->d_obj );
-        else
-			return ValueBinding<_ContentObject>::fetch( L, true, true );
+        const int n = ValueBinding<_ContentObject>::fetch( L, true, true );
+        if( n == 0 || lua_isnil( L, -1 ) )
+        {
+            // Keine Methode; das Attribut kann seit dem Caching angelegt worden sein (Import)
+            const quint32 a = TypeDefs::findAtom( obj->d_obj.getDb(), fieldName, type );
+            if( a )
+            {
+                lua_pop( L, n );
+                _cacheAtom( L, type, 2, a );
+                return pushValue( L, a, obj->d_obj );
+            }
+        }
+        return n;
     }
     static int newindex(lua_State *L)
     {
@@ -363,7 +470,7 @@ struct _ContentObject
         else
         {
             // Reprsentiert HTML, BML RichText, Date, DateTime, Time, Image
-            const Stream::DataCell v = obj.getValue( atom );
+            const Stream::DataCell v = TypeDefs::getValue( obj, atom );
             switch( v.getType() )
             {
             case Stream::DataCell::TypeNull:
@@ -397,7 +504,7 @@ struct _ContentObject
 				LuaBinding::pushObject( L, obj.getObject( atom ) );
                 break;
             case Stream::DataCell::TypeAtom:
-                lua_pushstring( L, TypeDefs::getSimpleName( atom, obj.getDb() ) );
+                _pushAtomName( L, v.getAtom(), obj.getDb() );
                 break;
             default:
                 {
@@ -413,6 +520,8 @@ struct _ContentObject
     static int getDocuments(lua_State *L);
     static int getContent( lua_State *L);
     static int getAnnotations( lua_State *L);
+    static int objects( lua_State *L);
+    static int annotations( lua_State *L);
     static int getValues(lua_State *L)
     {
         _ContentObject* obj = ValueBinding<_ContentObject>::check( L, 1 );
@@ -422,7 +531,7 @@ struct _ContentObject
         const int table = lua_gettop( L );
         foreach( Sdb::Atom a, names )
         {
-            lua_pushstring( L, TypeDefs::getSimpleName( a, obj->d_obj.getDb() ));
+            _pushAtomName( L, a, obj->d_obj.getDb() );
             pushValue( L, a, obj->d_obj );
             lua_rawset( L, table );
         }
@@ -448,6 +557,7 @@ struct _ContentObject
         }while( o.next() );
         return 1;
     }
+    static int iterateObjectsOfType( lua_State *L, const TypeList& types ); // wie getObjectsOfType, ohne Tabelle
     static int getHistory( lua_State *L );
     static int getParent(lua_State *L)
     {
@@ -466,6 +576,8 @@ static const luaL_reg ContentObject_reg[] =
     { "getValues", _ContentObject::getValues },
     { "getFolders", _ContentObject::getFolders },
     { "getDocuments", _ContentObject::getDocuments },
+    { "objects", _ContentObject::objects },
+    { "annotations", _ContentObject::annotations },
     { 0, 0 }
 };
 static const luaL_reg Meta_reg[] =
@@ -504,27 +616,508 @@ int _ContentObject::getContent(lua_State *L)
                              << TypeTable << TypeTableRow << TypeTableCell );
 }
 
+struct _ObjectIterator
+{
+    // Zustand von ContentObject:objects; pro Ebene nur ein Cursor auf das naechste Geschwister,
+    // die Objekte werden erst beim Abholen in Lua erzeugt
+    QList<Sdb::Obj> d_stack;
+    QSet<quint32> d_types; // leer: alle
+    bool d_recursive;
+    _ObjectIterator():d_recursive(false) {}
+
+    static quint32 typeFromName( const char* name )
+    {
+        // Gleiche Namen wie die Klassen in LuaBinding::install
+        static const struct { const char* d_name; quint32 d_type; } s_types[] =
+        {
+            { "Folder", TypeFolder }, { "Document", TypeDocument }, { "Title", TypeTitle },
+            { "Section", TypeSection }, { "Table", TypeTable }, { "TableRow", TypeTableRow },
+            { "TableCell", TypeTableCell }, { "Picture", TypePicture }, { "Annotation", TypeAnnotation },
+            { "OutLink", TypeOutLink }, { "InLink", TypeInLink }, { "StubObject", TypeStub },
+            { 0, 0 }
+        };
+        for( int i = 0; s_types[i].d_name; i++ )
+            if( qstrcmp( s_types[i].d_name, name ) == 0 )
+                return s_types[i].d_type;
+        return 0;
+    }
+    void addType( lua_State *L, int index )
+    {
+        const char* name = luaL_checkstring( L, index );
+        const quint32 t = typeFromName( name );
+        if( t == 0 )
+            luaL_error( L, "unknown object type '%s'", name );
+        d_types.insert( t );
+    }
+    static int next(lua_State *L)
+    {
+        _ObjectIterator* it = ValueBinding<_ObjectIterator>::check( L, lua_upvalueindex( 1 ) );
+        while( !it->d_stack.isEmpty() )
+        {
+            const Sdb::Obj o = it->d_stack.last();
+            if( o.isNull() || o.isDeleted() )
+            {
+                it->d_stack.removeLast();
+                continue;
+            }
+            Sdb::Obj n = o;
+            if( !n.next() )
+                n = Sdb::Obj();
+            it->d_stack.last() = n;
+            if( it->d_recursive )
+            {
+                const Sdb::Obj sub = o.getFirstObj();
+                if( !sub.isNull() )
+                    it->d_stack.append( sub ); // Tiefe zuerst, Dokumentreihenfolge
+            }
+            if( it->d_types.isEmpty() || it->d_types.contains( o.getType() ) )
+            {
+                LuaBinding::pushObject( L, o );
+                return 1;
+            }
+        }
+        lua_pushnil( L );
+        return 1;
+    }
+    static int start( lua_State *L, int state, const Sdb::Obj& super )
+    {
+        // state: Index des _ObjectIterator; gibt die Iterator-Funktion zurueck
+        _ObjectIterator* it = ValueBinding<_ObjectIterator>::check( L, state );
+        const Sdb::Obj first = super.getFirstObj();
+        if( !first.isNull() )
+            it->d_stack.append( first );
+        lua_pushvalue( L, state );
+        lua_pushcclosure( L, next, 1 );
+        return 1;
+    }
+};
+
+int _ContentObject::iterateObjectsOfType( lua_State *L, const TypeList& types )
+{
+    _ContentObject* obj = ValueBinding<_ContentObject>::check( L, 1 );
+    obj->checkValid(L);
+    _ObjectIterator* it = ValueBinding<_ObjectIterator>::create( L );
+    foreach( Sdb::Atom t, types )
+        it->d_types.insert( t );
+    return _ObjectIterator::start( L, lua_gettop( L ), obj->d_obj );
+}
+
+int _ContentObject::annotations(lua_State *L)
+{
+    // for a in obj:annotations() do ... end
+    return iterateObjectsOfType( L, TypeList() << TypeAnnotation );
+}
+
+int _ContentObject::objects(lua_State *L)
+{
+    // for o in obj:objects{ recursive = true, types = { "Title", "Section" } } do ... end
+    // Ohne Argumente nur die direkten Unterobjekte aller Typen; types darf auch ein einzelner Name sein
+    _ContentObject* obj = ValueBinding<_ContentObject>::check( L, 1 );
+    obj->checkValid(L);
+    _ObjectIterator* it = ValueBinding<_ObjectIterator>::create( L );
+    const int state = lua_gettop( L );
+    if( lua_istable( L, 2 ) )
+    {
+        lua_getfield( L, 2, "recursive" );
+        it->d_recursive = lua_toboolean( L, -1 );
+        lua_pop( L, 1 );
+        lua_getfield( L, 2, "types" );
+        const int types = lua_gettop( L );
+        if( lua_istable( L, types ) )
+        {
+            for( int i = 1; i <= int( lua_objlen( L, types ) ); i++ )
+            {
+                lua_rawgeti( L, types, i );
+                it->addType( L, -1 );
+                lua_pop( L, 1 );
+            }
+        }else if( !lua_isnil( L, types ) )
+            it->addType( L, types );
+        lua_pop( L, 1 );
+    }else if( !lua_isnoneornil( L, 2 ) )
+        luaL_argerror( L, 2, "expecting table" );
+    return _ObjectIterator::start( L, state, obj->d_obj );
+}
+
+static void _checkGuiThread( lua_State *L )
+{
+    // Filter koennen in einem Hintergrund-Thread laufen (siehe FilterCache); dort keine Dialoge.
+    // Scripts in einem ScriptJob fragen stattdessen ueber den Job im GUI-Thread nach.
+    if( QThread::currentThread() != QApplication::instance()->thread() )
+        luaL_error( L, "function not available in background filters" );
+}
+
+static int s_writes = 0; // Schreiboperationen seit Start, fuer Repository:batch
+
+static Sdb::Transaction* _checkWritable( lua_State *L, const Sdb::Obj& o )
+{
+    // Nur die Transaktion von AppContext schreibt; Verbindungen von ScriptJob sind read-only
+    _checkGuiThread(L);
+    if( o.getTxn() != AppContext::inst()->getTxn() )
+        luaL_error( L, "object is read-only" );
+    return o.getTxn();
+}
+
+static void _written( Sdb::Transaction* txn )
+{
+    // Ausserhalb von Repository:batch wird jede Aenderung einzeln committed
+    s_writes++;
+    if( !AppContext::inst()->isBatch() )
+        txn->commit();
+}
+
+struct _QueryResult
+{
+    // Ergebnis von Repository:query; die Objekte werden erst beim Abholen in Lua erzeugt
+    QList<quint64> d_oids;
+    Sdb::Obj d_anchor; // fuer die Transaktion
+    int d_pos;
+    _QueryResult():d_pos(0) {}
+
+    static int next(lua_State *L)
+    {
+        _QueryResult* res = ValueBinding<_QueryResult>::check( L, lua_upvalueindex( 1 ) );
+        while( res->d_pos < res->d_oids.size() )
+        {
+            const Sdb::Obj o = res->d_anchor.getTxn()->getObject( res->d_oids[ res->d_pos++ ] );
+            if( !o.isNull() && !o.isDeleted() )
+            {
+                LuaBinding::pushObject( L, o );
+                return 1;
+            }
+        }
+        lua_pushnil( L );
+        return 1;
+    }
+};
+
+struct _ResultList
+{
+    // Griff auf ein ResultView-Fenster; der Benutzer kann es jederzeit schliessen
+    QPointer<ResultView> d_view;
+
+    static ResultView* checkView( lua_State *L )
+    {
+        _ResultList* obj = ValueBinding<_ResultList>::check( L, 1 );
+        _checkGuiThread(L);
+        if( obj->d_view.isNull() )
+            luaL_error( L, "result list was closed" );
+        return obj->d_view;
+    }
+    static QString toString( lua_State *L, int index )
+    {
+        switch( lua_type( L, index ) )
+        {
+        case LUA_TNIL:
+        case LUA_TNONE:
+            return QString();
+        case LUA_TBOOLEAN:
+            return ( lua_toboolean( L, index ) ) ? "true" : "false";
+        case LUA_TNUMBER:
+        case LUA_TSTRING:
+            return QString::fromLatin1( lua_tostring( L, index ) );
+        }
+        QString res;
+        if( luaL_callmeta( L, index, "__tostring" ) )
+        {
+            res = QString::fromLatin1( lua_tostring( L, -1 ) );
+            lua_pop( L, 1 );
+        }else
+            res = luaL_typename( L, index );
+        return res;
+    }
+    static int add(lua_State *L)
+    {
+        // list:add( obj, spalte1, spalte2, ... ); Werte werden mit tostring dargestellt
+        ResultView* v = checkView( L );
+        _ContentObject* obj = ValueBinding<_ContentObject>::check( L, 2 );
+        obj->checkValid(L);
+        QStringList cols;
+        const int top = lua_gettop( L );
+        for( int i = 3; i <= top; i++ )
+            cols.append( toString( L, i ) );
+        v->addRow( obj->d_obj.getOid(), cols );
+        return 0;
+    }
+    static int clear(lua_State *L)
+    {
+        checkView( L )->clear();
+        return 0;
+    }
+    static int count(lua_State *L)
+    {
+        lua_pushinteger( L, checkView( L )->count() );
+        return 1;
+    }
+};
+static const luaL_reg _ResultList_reg[] =
+{
+    { "add", _ResultList::add },
+    { "clear", _ResultList::clear },
+    { "count", _ResultList::count },
+    { 0, 0 }
+};
+
 struct _Repository : public _ContentObject
 {
+    static void addQueryDoc( lua_State *L, int index, ObjectQuery& q )
+    {
+        _Document* doc = ValueBinding<_Document>::cast( L, index );
+        if( doc == 0 )
+            luaL_error( L, "query: doc expects Document objects" );
+        doc->checkValid(L);
+        q.addDoc( doc->d_obj );
+    }
+    static void addQueryType( lua_State *L, int index, ObjectQuery& q )
+    {
+        const char* name = luaL_checkstring( L, index );
+        const quint32 t = _ObjectIterator::typeFromName( name );
+        if( t == 0 )
+            luaL_error( L, "unknown object type '%s'", name );
+        q.addType( t );
+    }
+    static int query(lua_State *L)
+    {
+        // for o in repo:query{ doc = Document | { Document, ... }, type = "Section" | { "Title", ... },
+        //      where = { Priority = "High", ... }, text = "brake", search = "Lucene-Query" } do ... end
+        // where vergleicht auf Gleichheit, text sucht Teilstrings ohne Gross-/Kleinschreibung
+        _Repository* obj = ValueBinding<_Repository>::check( L, 1 );
+        obj->checkValid(L);
+        luaL_checktype( L, 2, LUA_TTABLE );
+        ObjectQuery q( obj->d_obj.getTxn() );
+
+        lua_getfield( L, 2, "doc" );
+        if( lua_istable( L, -1 ) )
+        {
+            for( int i = 1; i <= int( lua_objlen( L, -1 ) ); i++ )
+            {
+                lua_rawgeti( L, -1, i );
+                addQueryDoc( L, -1, q );
+                lua_pop( L, 1 );
+            }
+        }else if( !lua_isnil( L, -1 ) )
+            addQueryDoc( L, -1, q );
+        lua_pop( L, 1 );
+
+        lua_getfield( L, 2, "type" );
+        if( lua_istable( L, -1 ) )
+        {
+            for( int i = 1; i <= int( lua_objlen( L, -1 ) ); i++ )
+            {
+                lua_rawgeti( L, -1, i );
+                addQueryType( L, -1, q );
+                lua_pop( L, 1 );
+            }
+        }else if( !lua_isnil( L, -1 ) )
+            addQueryType( L, -1, q );
+        lua_pop( L, 1 );
+
+        lua_getfield( L, 2, "where" );
+        const int where = lua_gettop( L );
+        if( lua_istable( L, where ) )
+        {
+            lua_pushnil( L );
+            while( lua_next( L, where ) != 0 )
+            {
+                if( lua_type( L, -2 ) != LUA_TSTRING )
+                    luaL_error( L, "query: where expects attribute names as keys" );
+                const QByteArray name = lua_tostring( L, -2 );
+                switch( lua_type( L, -1 ) )
+                {
+                case LUA_TBOOLEAN:
+                    q.addWhere( name, bool( lua_toboolean( L, -1 ) ) );
+                    break;
+                case LUA_TNUMBER:
+                    q.addWhere( name, double( lua_tonumber( L, -1 ) ) );
+                    break;
+                case LUA_TSTRING:
+                    q.addWhere( name, QString::fromLatin1( lua_tostring( L, -1 ) ) );
+                    break;
+                default:
+                    luaL_error( L, "query: invalid value for '%s'", name.constData() );
+                }
+                lua_pop( L, 1 );
+            }
+        }else if( !lua_isnil( L, where ) )
+            luaL_error( L, "query: where expects a table" );
+        lua_pop( L, 1 );
+
+        lua_getfield( L, 2, "text" );
+        if( lua_isstring( L, -1 ) )
+            q.setText( QString::fromLatin1( lua_tostring( L, -1 ) ) );
+        lua_pop( L, 1 );
+
+        lua_getfield( L, 2, "search" );
+        if( lua_isstring( L, -1 ) )
+        {
+            _checkGuiThread(L); // Indexer arbeitet mit der Transaktion von AppContext
+            q.setSearch( QString::fromLatin1( lua_tostring( L, -1 ) ) );
+        }
+        lua_pop( L, 1 );
+
+        _QueryResult* res = ValueBinding<_QueryResult>::create( L );
+        res->d_anchor = obj->d_obj;
+        if( !q.exec( res->d_oids ) )
+            luaL_error( L, "query: %s", q.getError().toLatin1().constData() );
+        lua_pushcclosure( L, _QueryResult::next, 1 );
+        return 1;
+    }
+    static int batch(lua_State *L)
+    {
+        // local n, ms = repo:batch( function() ... obj:setReviewStatus( "accepted" ) ... end )
+        // Alle Aenderungen in einer Transaktion; die Views aktualisieren erst am Ende einmal.
+        // Bei einem Fehler wird alles zurueckgenommen und der Fehler weitergereicht.
+        _Repository* obj = ValueBinding<_Repository>::check( L, 1 );
+        obj->checkValid(L);
+        luaL_checktype( L, 2, LUA_TFUNCTION );
+        Sdb::Transaction* txn = _checkWritable( L, obj->d_obj );
+        // GUI und Scripts ausserhalb eines Batch committen jede Aenderung sofort; offene Aenderungen
+        // in der Transaktion gibt es also nur innerhalb eines laufenden Batch. Das Rollback unten
+        // darf keine fremden Aenderungen verwerfen, darum kein Batch in einem Batch.
+        if( AppContext::inst()->isBatch() )
+            luaL_error( L, "batch: the transaction has pending changes of another batch" );
+        AppContext::inst()->askUserName( QApplication::activeWindow() ); // einmal vor dem Lauf
+        Stopwatch t;
+        t.start();
+        const int writes = s_writes;
+        AppContext::inst()->beginBatch();
+        lua_pushvalue( L, 2 );
+        const int err = lua_pcall( L, 0, 0, 0 );
+        QByteArray msg; // luaL_error springt per longjmp; nicht aus einem catch-Block heraus
+        try
+        {
+            if( err == 0 )
+                txn->commit();
+            else
+                txn->rollback();
+        }catch( const Sdb::DatabaseException& e )
+        {
+            txn->rollback();
+            msg = QString( "%1 %2" ).arg( e.getCodeString() ).arg( e.getMsg() ).toLatin1();
+        }
+        AppContext::inst()->endBatch();
+        if( !msg.isEmpty() )
+            luaL_error( L, "batch: %s", msg.constData() );
+        if( err != 0 )
+            lua_error( L ); // Meldung liegt auf dem Stack
+        lua_pushinteger( L, s_writes - writes );
+        lua_pushnumber( L, t.elapsed() );
+        return 2;
+    }
+    static int createResultList(lua_State *L)
+    {
+        // local list = DoorScope:createResultList( title [, { "Spalte", ... }] )
+        // Zeigt ein neues Fenster; Doppelklick oeffnet das Objekt im DocViewer
+        _Repository* obj = ValueBinding<_Repository>::check( L, 1 );
+        obj->checkValid(L);
+        _checkGuiThread(L);
+        const QString title = QString::fromLatin1( luaL_optstring( L, 2, "Script Results" ) );
+        QStringList cols;
+        if( lua_istable( L, 3 ) )
+        {
+            for( int i = 1; i <= int( lua_objlen( L, 3 ) ); i++ )
+            {
+                lua_rawgeti( L, 3, i );
+                cols.append( _ResultList::toString( L, -1 ) );
+                lua_pop( L, 1 );
+            }
+        }else if( !lua_isnoneornil( L, 3 ) )
+            luaL_argerror( L, 3, "expecting table" );
+        _ResultList* res = ValueBinding<_ResultList>::create( L );
+        res->d_view = new ResultView( title + " - DoorScope", cols );
+        res->d_view->show();
+        return 1;
+    }
     static int selectDocument(lua_State *L)
     {
         _Repository* obj = ValueBinding<_Repository>::check( L, 1 );
         obj->checkValid(L);
-        DocSelectorDlg dlg( QApplication::activeWindow() );
         QString title = "Script: Select Document - DoorScope";
         if( lua_isstring( L, 2 ) )
             title = lua_tostring( L, 2 );
-        dlg.setWindowTitle( title );
-        dlg.resize( AppContext::inst()->getSet()->value(
-                        "DocSelectorDlg/Size", QSize( 400, 400 ) ).toSize() ); // RISK
-        const quint64 res = dlg.select( obj->d_obj );
-		LuaBinding::pushObject( L, AppContext::inst()->getTxn()->getObject( res ) );
+        quint64 res = 0;
+        if( ScriptJob* job = ScriptJob::current() )
+            res = job->selectDocument( title ); // Dialog im GUI-Thread
+        else
+        {
+            _checkGuiThread(L);
+            DocSelectorDlg dlg( QApplication::activeWindow() );
+            dlg.setWindowTitle( title );
+            dlg.resize( AppContext::inst()->getSet()->value(
+                            "DocSelectorDlg/Size", QSize( 400, 400 ) ).toSize() ); // RISK
+            res = dlg.select( obj->d_obj );
+        }
+		LuaBinding::pushObject( L, obj->d_obj.getTxn()->getObject( res ) );
+        return 1;
+    }
+    static int getStatistics(lua_State *L)
+    {
+        // Pro Dokument (siehe Statistics), nach Speicherbedarf absteigend:
+        // { document = Document, bytes, objects, imageBytes, history, annotations, indexEntries, indexBytes,
+        //   types = { [Typname] = Anzahl }, attributes = { [Attributname] = Bytes } }
+        _Repository* obj = ValueBinding<_Repository>::check( L, 1 );
+        obj->checkValid(L);
+        _checkGuiThread(L); // Statistics ist global
+        Statistics::inst()->refresh();
+        const Statistics::Docs& docs = Statistics::inst()->getDocs();
+        QMultiMap<qint64,quint64> sort;
+        Statistics::Docs::const_iterator i;
+        for( i = docs.begin(); i != docs.end(); ++i )
+            sort.insert( -i.value().d_bytes, i.key() );
+        lua_newtable( L );
+        const int table = lua_gettop( L );
+        Sdb::Database* db = obj->d_obj.getDb();
+        int n = 1;
+        QMultiMap<qint64,quint64>::const_iterator j;
+        for( j = sort.begin(); j != sort.end(); ++j )
+        {
+            const Statistics::Doc& d = docs[ j.value() ];
+            lua_newtable( L );
+            const int rec = lua_gettop( L );
+            LuaBinding::pushObject( L, obj->d_obj.getTxn()->getObject( j.value() ) );
+            lua_setfield( L, rec, "document" );
+            lua_pushnumber( L, d.d_bytes );
+            lua_setfield( L, rec, "bytes" );
+            lua_pushinteger( L, d.d_objects );
+            lua_setfield( L, rec, "objects" );
+            lua_pushnumber( L, d.d_imageBytes );
+            lua_setfield( L, rec, "imageBytes" );
+            lua_pushinteger( L, d.d_history );
+            lua_setfield( L, rec, "history" );
+            lua_pushinteger( L, d.d_annotations );
+            lua_setfield( L, rec, "annotations" );
+            lua_pushinteger( L, d.d_indexEntries );
+            lua_setfield( L, rec, "indexEntries" );
+            lua_pushnumber( L, d.d_indexBytes );
+            lua_setfield( L, rec, "indexBytes" );
+            lua_newtable( L );
+            QMap<quint32,int>::const_iterator t;
+            for( t = d.d_types.begin(); t != d.d_types.end(); ++t )
+            {
+                lua_pushinteger( L, t.value() );
+                lua_setfield( L, -2, TypeDefs::getSimpleName( t.key(), db ) );
+            }
+            lua_setfield( L, rec, "types" );
+            lua_newtable( L );
+            QMap<quint32,qint64>::const_iterator a;
+            for( a = d.d_attrBytes.begin(); a != d.d_attrBytes.end(); ++a )
+            {
+                lua_pushnumber( L, a.value() );
+                lua_setfield( L, -2, TypeDefs::getSimpleName( a.key(), db ) );
+            }
+            lua_setfield( L, rec, "attributes" );
+            lua_rawseti( L, table, n++ );
+        }
         return 1;
     }
 };
 static const luaL_reg _Repository_reg[] =
 {
     { "selectDocument", _Repository::selectDocument },
+    { "getStatistics", _Repository::getStatistics },
+    { "query", _Repository::query },
+    { "batch", _Repository::batch },
+    { "createResultList", _Repository::createResultList },
     { 0, 0 }
 };
 struct _Annotation : public _ContentObject
@@ -533,14 +1126,137 @@ struct _Annotation : public _ContentObject
 };
 struct _Object : public _ContentObject
 {
+    static quint8 reviewStatus( lua_State *L, int index )
+    {
+        if( lua_isnoneornil( L, index ) )
+            return ReviewStatus_None;
+        if( lua_type( L, index ) == LUA_TNUMBER )
+        {
+            const int s = lua_tointeger( L, index );
+            if( s < ReviewStatus_None || s > ReviewStatus_Rejected )
+                luaL_argerror( L, index, "invalid review status" );
+            return s;
+        }
+        static const char* names[] = { "none", "pending", "recheck", "accepted",
+                                       "acceptedWithChanges", "rejected", 0 };
+        return luaL_checkoption( L, index, 0, names );
+    }
+    static int setReviewStatus(lua_State *L)
+    {
+        // obj:setReviewStatus( "accepted" | "acceptedWithChanges" | "rejected" | "recheck" | "pending"
+        //      | "none" | Zahl ); "none" bzw. nil setzt zurueck wie im DocViewer
+        _Object* obj = ValueBinding<_Object>::check( L, 1 );
+        obj->checkValid(L);
+        const quint8 status = reviewStatus( L, 2 );
+        Sdb::Transaction* txn = _checkWritable( L, obj->d_obj );
+        Sdb::Obj& o = obj->d_obj;
+        if( status == ReviewStatus_None )
+        {
+            if( o.getValue( AttrReviewNeeded ).getBool() )
+                o.setValue( AttrReviewStatus, Stream::DataCell().setUInt8( ReviewStatus_Pending ) );
+            else
+                o.setValue( AttrReviewStatus, Stream::DataCell().setNull() );
+            o.setValue( AttrReviewer, Stream::DataCell().setNull() );
+            o.setValue( AttrStatusDate, Stream::DataCell().setNull() );
+        }else
+        {
+            o.setValue( AttrReviewStatus, Stream::DataCell().setUInt8( status ) );
+            o.setValue( AttrReviewer, Stream::DataCell().setString(
+                            AppContext::inst()->askUserName( QApplication::activeWindow() ) ) );
+            o.setValue( AttrStatusDate, Stream::DataCell().setDateTime( QDateTime::currentDateTime() ) );
+        }
+        _written( txn );
+        return 0;
+    }
+    static int annotate(lua_State *L)
+    {
+        // obj:annotate( text [, prio] ) -> Annotation; prio 0..3 wie im DocViewer
+        _Object* obj = ValueBinding<_Object>::check( L, 1 );
+        obj->checkValid(L);
+        const QString text = QString::fromLatin1( luaL_checkstring( L, 2 ) );
+        const int prio = luaL_optinteger( L, 3, AnnPrio_None );
+        if( prio < AnnPrio_None || prio > AnnPrio_Urgent )
+            luaL_argerror( L, 3, "invalid priority" );
+        Sdb::Transaction* txn = _checkWritable( L, obj->d_obj );
+        Sdb::Obj& p = obj->d_obj;
+        Sdb::Obj doc = p.getObject( AttrObjHomeDoc );
+        if( doc.isNull() )
+            luaL_error( L, "object has no document" );
+        Sdb::Obj a = txn->createObject( TypeAnnotation );
+        a.setValue( AttrAnnHomeDoc, doc );
+        a.setValue( AttrAnnText, Stream::DataCell().setString( text ) );
+        if( prio != AnnPrio_None )
+            a.setValue( AttrAnnPrio, Stream::DataCell().setUInt8( prio ) );
+        const quint32 nr = doc.getValue( AttrDocMaxAnnot ).getUInt32() + 1;
+        a.setValue( AttrAnnNr, Stream::DataCell().setUInt32( nr ) );
+        doc.setValue( AttrDocMaxAnnot, Stream::DataCell().setUInt32( nr ) );
+        const QString user = AppContext::inst()->askUserName( QApplication::activeWindow() );
+        a.setValue( AttrCreatedBy, Stream::DataCell().setString( user ) );
+        a.setValue( AttrModifiedBy, Stream::DataCell().setString( user ) );
+        Stream::DataCell d;
+        d.setDateTime( QDateTime::currentDateTime() );
+        a.setValue( AttrCreatedOn, d );
+        a.setValue( AttrModifiedOn, d );
+        a.aggregateTo( p );
+        // Wie DocViewer::createAnnot: nur der Zaehler des annotierten Objekts
+        p.setValue( AttrAnnotated, Stream::DataCell().setInt32( p.getValue( AttrAnnotated ).getInt32() + 1 ) );
+        _written( txn );
+        LuaBinding::pushObject( L, a );
+        return 1;
+    }
     static int getLinks(lua_State *L)
     {
         return getObjectsOfType( L, TypeList() << TypeOutLink << TypeInLink );
     }
+    static int links(lua_State *L)
+    {
+        // for l in obj:links() do ... end
+        return iterateObjectsOfType( L, TypeList() << TypeOutLink << TypeInLink );
+    }
+    static int getTimeline(lua_State *L)
+    {
+        // Aenderungen ueber alle Versionen des Dokuments (siehe Timeline), aelteste zuerst:
+        // { version = Document, kind = "created"|"modified"|"deleted", attr = Name, old = Wert, new = Wert }
+        _Object* obj = ValueBinding<_Object>::check( L, 1 );
+        obj->checkValid(L);
+        _checkGuiThread(L); // Timeline wird global gecached
+        lua_newtable( L );
+        const int table = lua_gettop( L );
+        const Timeline* t = Timeline::get( obj->d_obj.getObject( AttrObjHomeDoc ) );
+        const Timeline::Entry* e = ( t ) ? t->find( obj->d_obj ) : 0;
+        if( e == 0 )
+            return 1;
+        Sdb::Transaction* txn = obj->d_obj.getTxn();
+        for( int i = 0; i < e->d_changes.size(); i++ )
+        {
+            const Timeline::Change& c = e->d_changes[i];
+            lua_newtable( L );
+            const int rec = lua_gettop( L );
+            LuaBinding::pushObject( L, txn->getObject( t->getVersions()[c.d_version] ) );
+            lua_setfield( L, rec, "version" );
+            lua_pushstring( L, Timeline::kindName( c.d_kind ) );
+            lua_setfield( L, rec, "kind" );
+            if( c.d_kind == Timeline::Modified )
+            {
+                lua_pushstring( L, TypeDefs::getSimpleName( c.d_attr, obj->d_obj.getDb() ) );
+                lua_setfield( L, rec, "attr" );
+                pushValue( L, c.d_attr, txn->getObject( e->d_oids[c.d_version - 1] ) );
+                lua_setfield( L, rec, "old" );
+                pushValue( L, c.d_attr, txn->getObject( e->d_oids[c.d_version] ) );
+                lua_setfield( L, rec, "new" );
+            }
+            lua_rawseti( L, table, i + 1 );
+        }
+        return 1;
+    }
 };
 static const luaL_reg _Object_reg[] =
 {
     { "getLinks", _Object::getLinks },
+    { "links", _Object::links },
+    { "setReviewStatus", _Object::setReviewStatus },
+    { "annotate", _Object::annotate },
+    { "getTimeline", _Object::getTimeline },
     { 0, 0 }
 };
 struct _Title : public _Object
@@ -619,35 +1335,120 @@ int _ContentObject::getHistory( lua_State *L )
     return 1;
 }
 
-QByteArray _escape(const QByteArray& plain)
-{
-    // Adaption von Qt::escape aus qtextdocument.cpp
-    QByteArray rich;
-    rich.reserve(int(plain.length() * 1.1));
-    for (int i = 0; i < plain.length(); ++i) {
-        if (plain.at(i) == '<')
-            rich += "&lt;";
-        else if (plain.at(i) == '>')
-            rich += "&gt;";
-        else if (plain.at(i) == '&')
-            rich += "&amp;";
-        else
-            rich += plain.at(i);
-    }
-    return rich;
-}
-
 struct _File
 {
+    // Geschrieben wird ueber einen eigenen Puffer; escapt wird direkt beim Kopieren in den Puffer,
+    // ohne Zwischen-QByteArray. Werte (writeValue, writeHtml) gehen ohne Umweg ueber Lua-Strings.
+    enum { BufSize = 64 * 1024 };
     QFile d_file;
+    QByteArray d_buf;
+    bool d_failed; // ein flush ist fehlgeschlagen
+    _File():d_failed(false) {}
+    ~_File() { flush(); }
     _File& operator=( const _File& rhs ) { return *this; } // Dummy-Operator
 
+    void flush()
+    {
+        if( d_buf.isEmpty() )
+            return;
+        if( d_file.write( d_buf ) != d_buf.size() )
+            d_failed = true;
+        d_buf.clear();
+    }
+    void put( const char* data, int len )
+    {
+        if( d_buf.size() + len > BufSize )
+            flush();
+        if( len >= BufSize )
+        {
+            if( d_file.write( data, len ) != len )
+                d_failed = true;
+        }else
+        {
+            if( d_buf.capacity() < BufSize )
+                d_buf.reserve( BufSize );
+            d_buf.append( data, len );
+        }
+    }
+    int putEscaped( const char* data, int len )
+    {
+        // Wie Qt::escape, aber unveraenderte Abschnitte werden am Stueck kopiert
+        int n = len;
+        int start = 0;
+        for( int i = 0; i < len; i++ )
+        {
+            const char* rep;
+            switch( data[i] )
+            {
+            case '<':
+                rep = "&lt;";
+                break;
+            case '>':
+                rep = "&gt;";
+                break;
+            case '&':
+                rep = "&amp;";
+                break;
+            default:
+                continue;
+            }
+            put( data + start, i - start );
+            const int rl = qstrlen( rep );
+            put( rep, rl );
+            n += rl - 1;
+            start = i + 1;
+        }
+        put( data + start, len - start );
+        return n;
+    }
+    int putString( const QString& str, bool escape )
+    {
+        const QByteArray data = str.toLatin1(); // wie __tostring
+        if( escape )
+            return putEscaped( data.constData(), data.size() );
+        put( data.constData(), data.size() );
+        return data.size();
+    }
+    int putValue( lua_State *L, int index, bool escape )
+    {
+        // Lua-Strings und Zahlen direkt, String und SpecialValue ohne Lua-Zwischenstring
+        if( lua_type( L, index ) == LUA_TSTRING || lua_type( L, index ) == LUA_TNUMBER )
+        {
+            size_t len = 0;
+            const char* data = lua_tolstring( L, index, &len );
+            if( escape )
+                return putEscaped( data, len );
+            put( data, len ); // Es wird ohne Nullzeichen geschrieben!
+            return len;
+        }
+        if( _SpecialValue* v = ValueBinding<_SpecialValue>::cast( L, index ) )
+            return putString( _SpecialValue::renderString( v->d_value ), escape );
+        if( lua_isuserdata( L, index ) )
+            return putString( *QtValue<_String>::check( L, index ), escape );
+        luaL_argerror( L, index, "expecting a string, number, String or SpecialValue" );
+        return 0;
+    }
+    static _File* checkWriting( lua_State *L )
+    {
+        _File* obj = ValueBinding<_File>::check( L );
+        if( !obj->d_file.isWritable() || obj->d_failed )
+            luaL_error( L, "cannot write to file: %s", qPrintable( obj->d_file.fileName() ) );
+        return obj;
+    }
+
     static int openForWriting(lua_State *L)
     {
         QString title( "Script: Open File - DoorScope" );
         if( lua_isstring( L, 1 ) )
             title = QString::fromLatin1( lua_tostring( L, 1 ) );
-        QString path = QFileDialog::getSaveFileName( QApplication::activeWindow(), title );
+        QString path;
+        if( ScriptJob* job = ScriptJob::current() )
+            path = job->getFileName( title, true );
+        else
+        {
+            _checkGuiThread(L);
+            path = QFileDialog::getSaveFileName( QApplication::activeWindow(), title );
+        }
         if( path.isEmpty() )
         {
             lua_pushnil( L );
@@ -664,7 +1465,14 @@ struct _File
         QString title( "Script: Open File - DoorScope" );
         if( lua_isstring( L, 1 ) )
             title = QString::fromLatin1( lua_tostring( L, 1 ) );
-        QString path = QFileDialog::getOpenFileName( QApplication::activeWindow(), title );
+        QString path;
+        if( ScriptJob* job = ScriptJob::current() )
+            path = job->getFileName( title, false );
+        else
+        {
+            _checkGuiThread(L);
+            path = QFileDialog::getOpenFileName( QApplication::activeWindow(), title );
+        }
         if( path.isEmpty() )
         {
             lua_pushnil( L );
@@ -678,21 +1486,88 @@ struct _File
     }
     static int write(lua_State *L)
     {
-        _File* obj = ValueBinding<_File>::check( L );
-        if( !obj->d_file.isWritable() )
-            luaL_error( L, "cannot write to file: %s", qPrintable( obj->d_file.fileName() ) );
+        _File* obj = checkWriting( L );
         size_t len = 0;
         const char* data = lua_tolstring( L, 2, &len );
         if( !data )
             luaL_argerror ( L, 2, "expecting a string value" );
         if( lua_toboolean( L, 3 ) )
             // Escape String
-            len = obj->d_file.write( _escape( QByteArray::fromRawData( data, len ) ) );
+            len = obj->putEscaped( data, len );
         else
-            len = obj->d_file.write( data, len ); // Es wird ohne Nullzeichen geschrieben!
+            obj->put( data, len ); // Es wird ohne Nullzeichen geschrieben!
         lua_pushinteger( L, len );
         return 1;
     }
+    static int writef(lua_State *L)
+    {
+        // file:writef( format, ... ) wie string.format
+        _File* obj = checkWriting( L );
+        luaL_checkstring( L, 2 );
+        lua_getfield( L, LUA_GLOBALSINDEX, "string" );
+        lua_getfield( L, -1, "format" );
+        lua_replace( L, -2 );
+        lua_insert( L, 2 );
+        lua_call( L, lua_gettop( L ) - 2, 1 );
+        size_t len = 0;
+        const char* data = lua_tolstring( L, -1, &len );
+        obj->put( data, len );
+        lua_pushinteger( L, len );
+        return 1;
+    }
+    static int writeAll(lua_State *L)
+    {
+        // file:writeAll( table [, separator [, escape]] ); Elemente 1..#table wie bei writeValue
+        _File* obj = checkWriting( L );
+        luaL_checktype( L, 2, LUA_TTABLE );
+        size_t seplen = 0;
+        const char* sep = luaL_optlstring( L, 3, "", &seplen );
+        const bool escape = lua_toboolean( L, 4 );
+        const int n = lua_objlen( L, 2 );
+        int len = 0;
+        for( int i = 1; i <= n; i++ )
+        {
+            if( i > 1 )
+            {
+                obj->put( sep, seplen );
+                len += seplen;
+            }
+            lua_rawgeti( L, 2, i );
+            len += obj->putValue( L, lua_gettop( L ), escape );
+            lua_pop( L, 1 );
+        }
+        lua_pushinteger( L, len );
+        return 1;
+    }
+    static int writeValue(lua_State *L)
+    {
+        // file:writeValue( value [, escape] ); value ist String, Zahl, String oder SpecialValue
+        _File* obj = checkWriting( L );
+        lua_pushinteger( L, obj->putValue( L, 2, lua_toboolean( L, 3 ) ) );
+        return 1;
+    }
+    static int writeHtml(lua_State *L)
+    {
+        // file:writeHtml( value ) schreibt das HTML-Fragment wie SpecialValue:toHtml( true );
+        // Strings werden escapt
+        _File* obj = checkWriting( L );
+        int len = 0;
+        if( _SpecialValue* v = ValueBinding<_SpecialValue>::cast( L, 2 ) )
+            len = obj->putString( _SpecialValue::renderHtml( v->d_value, true, "latin-1" ), false );
+        else
+            len = obj->putValue( L, 2, true );
+        lua_pushinteger( L, len );
+        return 1;
+    }
+    static int flush(lua_State *L)
+    {
+        _File* obj = checkWriting( L );
+        obj->flush();
+        obj->d_file.flush();
+        if( obj->d_failed )
+            luaL_error( L, "cannot write to file: %s", qPrintable( obj->d_file.fileName() ) );
+        return 0;
+    }
     static int read(lua_State *L)
     {
         _File* obj = ValueBinding<_File>::check( L );
@@ -718,7 +1593,10 @@ struct _File
     static int close(lua_State *L)
     {
         _File* obj = ValueBinding<_File>::check( L );
+        obj->flush();
         obj->d_file.close();
+        if( obj->d_failed )
+            luaL_error( L, "cannot write to file: %s", qPrintable( obj->d_file.fileName() ) );
         return 0;
     }
 };
@@ -727,6 +1605,11 @@ static const luaL_reg _File_reg[] =
     { "openForWriting", _File::openForWriting },
     { "openForReading", _File::openForReading },
     { "write", _File::write },
+    { "writef", _File::writef },
+    { "writeAll", _File::writeAll },
+    { "writeValue", _File::writeValue },
+    { "writeHtml", _File::writeHtml },
+    { "flush", _File::flush },
     { "read", _File::read },
     { "isEof", _File::isEof },
     { "close", _File::close },
@@ -796,19 +1679,71 @@ static int loader(lua_State * L)
 	if( name.isEmpty() || !name.startsWith( ':' ) )
 		return 0;
 	const QString plain = name.mid(1);
-	Sdb::Obj sub = AppContext::inst()->getRoot().getFirstObj();
+	// Root des aufrufenden States verwenden, da Hintergrund-Filter eine eigene Transaktion haben
+	Sdb::Obj sub;
+	lua_getfield( L, LUA_GLOBALSINDEX, "DoorScope" );
+	if( _Repository* root = ValueBinding<_Repository>::cast( L, -1 ) )
+		sub = root->d_obj.getFirstObj();
+	lua_pop( L, 1 );
 	if( !sub.isNull() ) do
 	{
 		if( sub.getType() == TypeLuaScript && sub.getValue(AttrScriptName).getStr() == plain )
 		{
-			if( !Lua::Engine2::getInst()->pushFunction( sub.getValue(AttrScriptSource).getStr().toLatin1(), name ) )
-				luaL_error( L, Lua::Engine2::getInst()->getLastError() );
+			const QByteArray source = LuaBinding::getCode( sub, name );
+			if( L == Lua::Engine2::getInst()->getCtx() )
+			{
+				if( !Lua::Engine2::getInst()->pushFunction( source, name ) )
+					luaL_error( L, "%s", Lua::Engine2::getInst()->getLastError().constData() );
+			}else if( luaL_loadbuffer( L, source, source.size(), name ) != 0 )
+				lua_error( L );
 			return 1;
 		}
 	}while( sub.next() );
 	return 0;
 }
 
+static int _writeCode( lua_State*, const void* p, size_t sz, void* ud )
+{
+	static_cast<QByteArray*>( ud )->append( static_cast<const char*>( p ), int( sz ) );
+	return 0;
+}
+
+static QByteArray _codeKey( const QByteArray& source, const QByteArray& name )
+{
+	// Der Chunk-Name steckt im Bytecode und ersetzt beim Laden den dort angegebenen
+	QCryptographicHash h( QCryptographicHash::Sha1 );
+	h.addData( name );
+	h.addData( "\0", 1 );
+	h.addData( source );
+	return h.result().toHex();
+}
+
+// Bytecode nur im Prozess, nie in der Datei: geladener Bytecode wird von Lua nicht geprueft.
+// Filter- und Script-Jobs rufen getCode aus ihren Threads auf.
+static QCache<QByteArray,QByteArray> s_code( 4 * 1024 * 1024 ); // Bytes
+static QMutex s_codeLock;
+
+QByteArray LuaBinding::getCode(const Sdb::Obj &script, const QByteArray &name)
+{
+	const QByteArray source = script.getValue( AttrScriptSource ).getStr().toLatin1();
+	const QByteArray key = _codeKey( source, name );
+	{
+		QMutexLocker lock( &s_codeLock );
+		if( const QByteArray* bin = s_code.object( key ) )
+			return *bin;
+	}
+	QByteArray bin;
+	lua_State* L = luaL_newstate();
+	if( luaL_loadbuffer( L, source, source.size(), name ) == 0 )
+		lua_dump( L, _writeCode, &bin );
+	lua_close( L );
+	if( bin.isEmpty() )
+		return source;
+	QMutexLocker lock( &s_codeLock );
+	s_code.insert( key, new QByteArray( bin ), bin.size() );
+	return bin;
+}
+
 static int type(lua_State * L)
 {
 	luaL_checkany(L, 1);
@@ -864,6 +1799,9 @@ void LuaBinding::install(lua_State * L)
     ValueBinding<_History,_ContentObject>::install( L, "ChangeEvent", 0, false );
     ValueBinding<_History>::addMetaMethods( L, Meta_reg );
     ValueBinding<_File>::install( L, "File", _File_reg, false );
+    ValueBinding<_ObjectIterator>::install( L, "ObjectIterator", 0, false );
+    ValueBinding<_QueryResult>::install( L, "QueryResult", 0, false );
+    ValueBinding<_ResultList>::install( L, "ResultList", _ResultList_reg, false );
 
 	lua_getfield( L, LUA_GLOBALSINDEX, "package" );
 	if( lua_istable(L, -1 ) )
@@ -893,5 +1831,11 @@ void LuaBinding::setRoot(lua_State *L, const Sdb::Obj &root)
 	_Repository* obj = ValueBinding<_Repository>::create( L );
     obj->d_obj = root;
     lua_setfield( L, LUA_GLOBALSINDEX, "DoorScope" );
+    lua_pushlightuserdata( L, &s_atomCache );
+    lua_pushnil( L );
+    lua_rawset( L, LUA_REGISTRYINDEX );
+    lua_pushlightuserdata( L, &s_nameCache );
+    lua_pushnil( L );
+    lua_rawset( L, LUA_REGISTRYINDEX );
 }
 
@@ -27,6 +27,10 @@ public:
     static void install(lua_State * L);
     static void setRoot(lua_State * L, const Sdb::Obj& root );
 	static int pushObject(lua_State *L, const Sdb::Obj& obj );
+	// Bytecode von TypeLuaScript oder TypeLuaFilter zur Ausfuehrung unter name; wird bei Bedarf
+	// uebersetzt und nur im Speicher gehalten, aus jedem Thread. Bei Syntaxfehlern die Source,
+	// damit der Aufrufer den Fehler wie bisher erhaelt.
+	static QByteArray getCode( const Sdb::Obj& script, const QByteArray& name );
 private:
     LuaBinding(){}
 };
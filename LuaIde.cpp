@@ -35,10 +35,17 @@
 #include <QInputDialog>
 #include <QFileDialog>
 #include <QApplication>
+#include <QTreeWidget>
+#include <QTextEdit>
+#include <QPlainTextEdit>
+#include <QTextBlock>
 #include <QtDebug>
 #include "AppContext.h"
 #include "TypeDefs.h"
 #include "ScriptSelectDlg.h"
+#include "LuaProfiler.h"
+#include "ScriptJob.h"
+#include "LuaBinding.h"
 #include <memory>
 using namespace Ds;
 
@@ -104,10 +111,13 @@ Lua::CodeEditor* LuaIde::createEditor(bool readOnly, const QString &title, const
 	pop->addSeparator();
 	pop->addCommand( "Check Syntax", this, SLOT(handleCheck()) );
 	pop->addCommand( "&Execute",this, SLOT(handleExecute()), tr("CTRL+E"), false );
+	pop->addCommand( "Execute in Background", this, SLOT(handleExecuteBg()), tr("CTRL+SHIFT+E"), false );
+	pop->addCommand( "Cancel Background Script", this, SLOT(handleCancelBg()) );
 	pop->addCommand( "Continue", this, SLOT( handleContinue() ), tr("F5"), false );
 	pop->addCommand( "Step", this, SLOT( handleSingleStep() ), tr("F11"), false );
 	pop->addCommand( "Terminate", this, SLOT( handleAbort() ) );
 	pop->addCommand( "Debugging", this, SLOT(handleSetDebug() ) );
+	pop->addCommand( "Profiling", this, SLOT(handleSetProfile() ) );
 	pop->addCommand( "Break at first line", this, SLOT( handleBreakAtFirst() ) );
 	pop->addCommand( "Toggle Breakpoint", this, SLOT(handleBreakpoint() ), tr("F9"), false );
 	pop->addCommand( "Remove all Breakpoints", this, SLOT(handleRemoveAllBreaks() ) );
@@ -220,7 +230,7 @@ void LuaIde::saveData(Lua::CodeEditor * e)
 	}
 }
 
-LuaIde::LuaIde()
+LuaIde::LuaIde():d_prof(0),d_profile(false),d_job(0)
 {
 	QFileInfo info( AppContext::inst()->getDb()->getFilePath() );
 	setWindowTitle( tr("%1 - DoorScope Lua IDE").arg( info.baseName() ) );
@@ -265,6 +275,8 @@ LuaIde::LuaIde()
 	pop->addCommand(tr("Edit"), this, SLOT(handleEdit()) );
 	pop->addCommand(tr("Check Syntax..."), this, SLOT(handleCheck2()) );
 	pop->addCommand(tr("Execute"), this, SLOT(handleExecute2()) );
+	pop->addCommand(tr("Execute in Background"), this, SLOT(handleExecuteBg2()) );
+	pop->addCommand(tr("Cancel Background Script"), this, SLOT(handleCancelBg()) );
 	pop->addSeparator();
 	pop->addCommand(tr("New..."), this, SLOT(handleCreate()) );
 	pop->addCommand(tr("Duplicate..."), this, SLOT(handleDuplicate()) );
@@ -295,6 +307,15 @@ LuaIde::LuaIde()
 	dock->setWidget( d_locals );
 	addDockWidget( Qt::RightDockWidgetArea, dock );
 
+	dock = createDock( this, tr("Profile" ), false );
+	d_profView = new QTreeWidget( dock );
+	d_profView->setHeaderLabels( QStringList() << tr("Location") << tr("Hits") << tr("Self ms") << tr("Total ms") );
+	d_profView->setAlternatingRowColors( true );
+	d_profView->setSortingEnabled( true );
+	dock->setWidget( d_profView );
+	addDockWidget( Qt::BottomDockWidgetArea, dock );
+	d_prof = new LuaProfiler();
+
 	QVariant state = AppContext::inst()->getSet()->value( "LuaIDE/State" );
 	if( !state.isNull() )
 		restoreState( state.toByteArray() );
@@ -305,6 +326,7 @@ LuaIde::LuaIde()
 
 	new Gui2::AutoShortcut( tr("CTRL+S"), this, this, SLOT(handleSave()) );
 	new Gui2::AutoShortcut( tr("CTRL+E"), this, this, SLOT(handleExecute()) );
+	new Gui2::AutoShortcut( tr("CTRL+SHIFT+E"), this, this, SLOT(handleExecuteBg()) );
 	new Gui2::AutoShortcut( tr("F5"), this, this, SLOT(handleContinue()) );
 	new Gui2::AutoShortcut( tr("F11"), this, this, SLOT(handleSingleStep()) );
 	new Gui2::AutoShortcut( tr("F9"), this, this, SLOT(handleBreakpoint()) );
@@ -312,6 +334,12 @@ LuaIde::LuaIde()
 
 LuaIde::~LuaIde()
 {
+	if( d_job )
+	{
+		d_job->cancel();
+		d_job->wait();
+	}
+	delete d_prof;
 	s_inst = 0;
 }
 
@@ -538,8 +566,69 @@ void LuaIde::handleExecute()
 {
 	Lua::CodeEditor* e = currentEditor();
 	ENABLED_IF( !Lua::Engine2::getInst()->isExecuting() && e != 0 );
-	Lua::Engine2::getInst()->executeCmd( e->text().toLatin1(), ( e->objectName().isEmpty() ) ?
-											 QByteArray("#Editor") : e->objectName().toLatin1() );
+	const QByteArray source = ( e->objectName().isEmpty() ) ? QByteArray("#Editor") : e->objectName().toLatin1();
+	startProfile();
+	Lua::Engine2::getInst()->executeCmd( e->text().toLatin1(), source );
+	stopProfile( source );
+}
+
+void LuaIde::startJob(const QByteArray &code, const QByteArray &source)
+{
+	// Eigener lua_State im Hintergrund, siehe ScriptJob; Globals des Engine2 sind dort nicht sichtbar
+	d_job = new ScriptJob( code, source, this );
+	connect( d_job, SIGNAL( output( const QString& ) ), this, SLOT( onJobOutput( const QString& ) ) );
+	connect( d_job, SIGNAL( finished() ), this, SLOT( onJobDone() ) );
+	statusBar()->showMessage( tr("Running %1 in background...").arg( QString::fromLatin1( source ) ) );
+	d_job->start( QThread::LowPriority );
+}
+
+void LuaIde::handleExecuteBg()
+{
+	Lua::CodeEditor* e = currentEditor();
+	ENABLED_IF( d_job == 0 && e != 0 );
+	startJob( e->text().toLatin1(), ( e->objectName().isEmpty() ) ? QByteArray("#Editor") : e->objectName().toLatin1() );
+}
+
+void LuaIde::handleExecuteBg2()
+{
+	ENABLED_IF( d_scriptList->currentItem() && d_job == 0 );
+	_ScriptViewItem* svi = static_cast<_ScriptViewItem*>( d_scriptList->currentItem() );
+	const QByteArray source = ":" + svi->text(0).toLatin1();
+	startJob( LuaBinding::getCode( svi->d_script, source ), source );
+}
+
+void LuaIde::handleCancelBg()
+{
+	ENABLED_IF( d_job != 0 && !d_job->isCanceled() );
+	d_job->cancel();
+	statusBar()->showMessage( tr("Cancelling background script...") );
+}
+
+void LuaIde::onJobOutput(const QString & str)
+{
+	// Terminal2 zeigt sonst nur die Ausgaben von Engine2
+	if( QTextEdit* t = qobject_cast<QTextEdit*>( d_term ) )
+		t->append( str );
+	else if( QPlainTextEdit* t = qobject_cast<QPlainTextEdit*>( d_term ) )
+		t->appendPlainText( str );
+}
+
+void LuaIde::onJobDone()
+{
+	if( d_job == 0 )
+		return;
+	ScriptJob* job = d_job;
+	d_job = 0;
+	job->deleteLater();
+	if( job->isCanceled() )
+		statusBar()->showMessage( tr("Background script canceled") );
+	else if( !job->getError().isEmpty() )
+	{
+		statusBar()->showMessage( tr("Background script failed") );
+		onJobOutput( job->getError() );
+		QMessageBox::critical( this, tr("Run Script"), job->getError() );
+	}else
+		statusBar()->showMessage( tr("Background script finished") );
 }
 
 void LuaIde::handleContinue()
@@ -565,10 +654,125 @@ void LuaIde::handleAbort()
 
 void LuaIde::handleSetDebug()
 {
-	CHECKED_IF( !Lua::Engine2::getInst()->isExecuting(), Lua::Engine2::getInst()->isDebug() );
+	CHECKED_IF( !Lua::Engine2::getInst()->isExecuting() && !d_profile, Lua::Engine2::getInst()->isDebug() );
 	Lua::Engine2::getInst()->setDebug( !Lua::Engine2::getInst()->isDebug() );
 }
 
+void LuaIde::handleSetProfile()
+{
+	// Lua kennt nur einen Hook pro State; Debugger und Profiler schliessen sich darum aus.
+	CHECKED_IF( !Lua::Engine2::getInst()->isExecuting() && !Lua::Engine2::getInst()->isDebug(), d_profile );
+	d_profile = !d_profile;
+	if( d_profile )
+		d_profView->parentWidget()->show();
+	else
+	{
+		for( int i = 0; i < d_tab->count(); i++ )
+			annotateProfile( dynamic_cast<Lua::CodeEditor*>( d_tab->widget( i ) ), QByteArray() );
+	}
+}
+
+void LuaIde::startProfile()
+{
+	if( !d_profile || Lua::Engine2::getInst()->isDebug() )
+		return;
+	d_prof->start( Lua::Engine2::getInst()->getCtx() );
+}
+
+static QTreeWidgetItem* _profItem( QTreeWidgetItem* p, const QString& loc, quint32 hits, qint64 self, qint64 total )
+{
+	QTreeWidgetItem* i = new QTreeWidgetItem( p );
+	i->setText( 0, loc );
+	i->setData( 1, Qt::DisplayRole, hits );
+	i->setData( 2, Qt::DisplayRole, self / 1000000.0 );
+	if( total >= 0 )
+		i->setData( 3, Qt::DisplayRole, total / 1000000.0 );
+	return i;
+}
+
+void LuaIde::stopProfile( const QByteArray& source )
+{
+	if( !d_prof->isRunning() )
+		return;
+	const bool complete = d_prof->stop();
+	d_profView->clear();
+	d_profView->setSortingEnabled( false );
+
+	QTreeWidgetItem* lines = new QTreeWidgetItem( d_profView );
+	lines->setText( 0, tr("Lines") );
+	const QList<LuaProfiler::Line> l = d_prof->getLines();
+	for( int i = 0; i < l.size(); i++ )
+		_profItem( lines, QString( "%1:%2" ).arg( QString::fromLatin1( l[i].d_source ) ).arg( l[i].d_line ),
+				   l[i].d_hits, l[i].d_time, -1 );
+
+	QTreeWidgetItem* funcs = new QTreeWidgetItem( d_profView );
+	funcs->setText( 0, tr("Functions") );
+	QTreeWidgetItem* host = new QTreeWidgetItem( d_profView );
+	host->setText( 0, tr("Host calls") );
+	qint64 hostTime = 0;
+	const QList<LuaProfiler::Func> f = d_prof->getFuncs();
+	for( int i = 0; i < f.size(); i++ )
+	{
+		if( f[i].d_host )
+		{
+			_profItem( host, QString::fromLatin1( f[i].d_name ), f[i].d_calls, f[i].d_self, f[i].d_total );
+			hostTime += f[i].d_self;
+		}else
+			_profItem( funcs, QString( "%1 (%2:%3)" ).arg( QString::fromLatin1( f[i].d_name ) )
+					   .arg( QString::fromLatin1( f[i].d_source ) ).arg( f[i].d_line ),
+					   f[i].d_calls, f[i].d_self, f[i].d_total );
+	}
+	host->setData( 2, Qt::DisplayRole, hostTime / 1000000.0 );
+	d_profView->setSortingEnabled( true );
+	d_profView->sortByColumn( 2, Qt::DescendingOrder );
+	lines->setExpanded( true );
+	d_profView->resizeColumnToContents( 0 );
+
+	if( complete )
+		statusBar()->showMessage( tr("Profiled %1 ms, %2 ms in host calls").
+								  arg( d_prof->getElapsed() / 1000000 ).arg( hostTime / 1000000 ) );
+	else
+		statusBar()->showMessage( tr("Profile incomplete: the Lua hook was replaced during execution") );
+	for( int i = 0; i < d_tab->count(); i++ )
+	{
+		Lua::CodeEditor* e = dynamic_cast<Lua::CodeEditor*>( d_tab->widget( i ) );
+		annotateProfile( e, ( e->objectName().isEmpty() ? QByteArray("#Editor") : e->objectName().toLatin1() ) == source ?
+							source : QByteArray() );
+	}
+}
+
+void LuaIde::annotateProfile(Lua::CodeEditor * e, const QByteArray &source)
+{
+	// Heisse Zeilen nach Anteil an der Laufzeit einfaerben; leere source entfernt die Markierung
+	QList<QTextEdit::ExtraSelection> sels;
+	if( !source.isEmpty() )
+	{
+		const QList<LuaProfiler::Line> l = d_prof->getLines();
+		qint64 max = 0;
+		for( int i = 0; i < l.size(); i++ )
+			if( l[i].d_source == source )
+				max = qMax( max, l[i].d_time );
+		for( int i = 0; i < l.size() && max > 0; i++ )
+		{
+			if( l[i].d_source != source || l[i].d_line < 1 )
+				continue;
+			const int heat = int( l[i].d_time * 255 / max );
+			if( heat < 8 )
+				continue;
+			const QTextBlock b = e->document()->findBlockByNumber( l[i].d_line - 1 );
+			if( !b.isValid() )
+				continue;
+			QTextEdit::ExtraSelection s;
+			s.format.setBackground( QColor( 255, 0, 0, qMax( 24, heat / 2 ) ) );
+			s.format.setProperty( QTextFormat::FullWidthSelection, true );
+			s.format.setToolTip( tr("%1 hits, %2 ms").arg( l[i].d_hits ).arg( l[i].d_time / 1000000.0 ) );
+			s.cursor = QTextCursor( b );
+			sels.append( s );
+		}
+	}
+	e->setExtraSelections( sels );
+}
+
 void LuaIde::handleBreakAtFirst()
 {
 	CHECKED_IF( true, Lua::Engine2::getInst()->getDefaultCmd() == Lua::Engine2::RunToNextLine );
@@ -774,8 +978,11 @@ void LuaIde::handleExecute2()
 	ENABLED_IF( d_scriptList->currentItem() && !Lua::Engine2::getInst()->isExecuting() );
 	_ScriptViewItem* svi = static_cast<_ScriptViewItem*>( d_scriptList->currentItem() );
 
-	if( Lua::Engine2::getInst()->executeCmd( svi->d_script.getValue(AttrScriptSource).getStr().toLatin1(),
-											 ":" + svi->text(0).toLatin1() ) )
+	const QByteArray source = ":" + svi->text(0).toLatin1();
+	startProfile();
+	const bool ok = Lua::Engine2::getInst()->executeCmd( LuaBinding::getCode( svi->d_script, source ), source );
+	stopProfile( source );
+	if( ok )
 		; // svi->d_script->setCompiled();
 	else if( !Lua::Engine2::getInst()->isSilent() )
 		QMessageBox::critical( this, tr("Run Script"), Lua::Engine2::getInst()->getLastError() );
@@ -23,6 +23,7 @@
 
 class QTabWidget;
 class QToolButton;
+class QTreeWidget;
 
 namespace Lua
 {
@@ -34,6 +35,9 @@ namespace Lua
 
 namespace Ds
 {
+	class LuaProfiler;
+	class ScriptJob;
+
 	class LuaIde : public QMainWindow, public Lua::Engine2::DbgShell
 	{
 		Q_OBJECT
@@ -56,6 +60,10 @@ namespace Ds
 		void toggleBreakPoint( Lua::CodeEditor*, int line );
 		void updateBreakpoints( Lua::CodeEditor* );
 		void saveData( Lua::CodeEditor* );
+		void startProfile();
+		void stopProfile( const QByteArray& source );
+		void annotateProfile( Lua::CodeEditor*, const QByteArray& source );
+		void startJob( const QByteArray& code, const QByteArray& source );
 	protected slots:
 		void onCurrentTabChanged(int);
 		void onClose();
@@ -68,6 +76,7 @@ namespace Ds
 		void handleSingleStep();
 		void handleAbort();
 		void handleSetDebug();
+		void handleSetProfile();
 		void handleBreakAtFirst();
 		void handleBreakpoint();
 		void handleRemoveAllBreaks();
@@ -87,6 +96,11 @@ namespace Ds
 		void handleExport();
 		void handleExportBin();
 		void handleSave();
+		void handleExecuteBg();
+		void handleExecuteBg2();
+		void handleCancelBg();
+		void onJobOutput( const QString& );
+		void onJobDone();
 	private:
 		QTabWidget* d_tab;
 		QToolButton* d_closer;
@@ -94,6 +108,10 @@ namespace Ds
 		Gui::ListView* d_scriptList;
 		Lua::StackView* d_stack;
 		Lua::LocalsView* d_locals;
+		QTreeWidget* d_profView;
+		LuaProfiler* d_prof;
+		bool d_profile;
+		ScriptJob* d_job;
 	};
 }
 
@@ -0,0 +1,245 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "LuaProfiler.h"
+#include <Script/Lua.h>
+using namespace Ds;
+
+static LuaProfiler* s_active = 0;
+
+LuaProfiler::LuaProfiler():d_ctx(0),d_prevHook(0),d_prevMask(0),d_prevCount(0),d_last(0),d_elapsed(0),
+	d_confirm(false)
+{
+}
+
+LuaProfiler::~LuaProfiler()
+{
+	if( d_ctx )
+		stop();
+}
+
+bool LuaProfiler::start( lua_State* L )
+{
+	if( s_active != 0 || L == 0 )
+		return false;
+	d_stack.clear();
+	d_confirm = false;
+	d_lines.clear();
+	d_funcIdx.clear();
+	d_funcs.clear();
+	d_sources.clear();
+	d_cur = Key( 0, 0 );
+	d_elapsed = 0;
+	d_ctx = L;
+	s_active = this;
+	d_prevHook = lua_gethook( L );
+	d_prevMask = lua_gethookmask( L );
+	d_prevCount = lua_gethookcount( L );
+	lua_sethook( L, hook, d_prevMask | LUA_MASKCALL | LUA_MASKRET | LUA_MASKLINE, d_prevCount );
+	d_timer.start();
+	d_last = 0;
+	return true;
+}
+
+bool LuaProfiler::stop()
+{
+	if( d_ctx == 0 )
+		return false;
+	d_elapsed = d_timer.nsecsElapsed();
+	charge( d_elapsed );
+	const bool ok = lua_gethook( d_ctx ) == hook;
+	if( ok )
+		lua_sethook( d_ctx, d_prevHook, d_prevMask, d_prevCount );
+	d_ctx = 0;
+	s_active = 0;
+	d_stack.clear();
+	return ok;
+}
+
+void LuaProfiler::hook( lua_State* L, lua_Debug* ar )
+{
+	LuaProfiler* p = s_active;
+	if( p == 0 || p->d_ctx != L )
+		return;
+	p->onEvent( L, ar );
+	const int mask = ( ar->event == LUA_HOOKTAILRET ) ? LUA_MASKRET : ( 1 << ar->event );
+	if( p->d_prevHook && ( p->d_prevMask & mask ) )
+		p->d_prevHook( L, ar );
+}
+
+void LuaProfiler::charge( qint64 now )
+{
+	// Die Zeit seit dem letzten Ereignis gehoert der laufenden Zeile, ausser es laeuft gerade
+	// eine C-Funktion; deren Zeit steht nur beim Host-Aufruf
+	if( d_cur.first != 0 && ( d_stack.isEmpty() || !d_funcs[ d_stack.last().d_func ].d_host ) )
+		d_lines[ d_cur ].d_time += now - d_last;
+	d_last = now;
+}
+
+QByteArray LuaProfiler::source( const char* s )
+{
+	QHash<const void*,QByteArray>::const_iterator i = d_sources.find( s );
+	if( i != d_sources.end() )
+		return i.value();
+	const QByteArray res( s );
+	d_sources.insert( s, res );
+	return res;
+}
+
+int LuaProfiler::func( lua_State* L, lua_Debug* ar )
+{
+	lua_getinfo( L, "Snf", ar );
+	Key key;
+	const lua_CFunction cf = lua_tocfunction( L, -1 );
+	lua_pop( L, 1 );
+	if( cf )
+		key = Key( (const void*)cf, -1 );
+	else
+		key = Key( ar->source, ar->linedefined ); // source ist ein internierter Lua-String
+	QHash<Key,int>::const_iterator i = d_funcIdx.find( key );
+	if( i != d_funcIdx.end() )
+		return i.value();
+	Func f;
+	f.d_host = cf != 0;
+	if( !f.d_host )
+	{
+		f.d_source = source( ar->source );
+		f.d_line = ar->linedefined;
+	}
+	if( ar->name )
+		f.d_name = ar->name;
+	else if( ar->what && qstrcmp( ar->what, "main" ) == 0 )
+		f.d_name = "<main>";
+	else
+		f.d_name = "?";
+	d_funcs.append( f );
+	d_funcIdx.insert( key, d_funcs.size() - 1 );
+	return d_funcs.size() - 1;
+}
+
+static int _depth( lua_State* L )
+{
+	// Anzahl Ebenen; zuerst verdoppeln, dann halbieren, damit tiefe Rekursion nicht quadratisch wird
+	lua_Debug ar;
+	int lo = 0; // Ebene 0 existiert im Hook immer
+	int hi = 1;
+	while( lua_getstack( L, hi, &ar ) )
+	{
+		lo = hi;
+		hi *= 2;
+	}
+	while( lo + 1 < hi )
+	{
+		const int m = ( lo + hi ) / 2;
+		if( lua_getstack( L, m, &ar ) )
+			lo = m;
+		else
+			hi = m;
+	}
+	return hi;
+}
+
+void LuaProfiler::pop( qint64 now )
+{
+	const Frame f = d_stack.last();
+	d_stack.pop_back();
+	const qint64 total = now - f.d_start;
+	Func& fn = d_funcs[ f.d_func ];
+	fn.d_total += total;
+	fn.d_self += total - f.d_child;
+	if( !d_stack.isEmpty() )
+		d_stack.last().d_child += total;
+	d_cur = f.d_line;
+}
+
+void LuaProfiler::unwind( int depth, qint64 now )
+{
+	// Ein mit pcall abgefangener Fehler verlaesst Frames ohne RET; diese enden jetzt
+	while( !d_stack.isEmpty() && d_stack.last().d_depth > depth )
+		pop( now );
+}
+
+void LuaProfiler::onEvent( lua_State* L, lua_Debug* ar )
+{
+	const qint64 now = d_timer.nsecsElapsed();
+	switch( ar->event )
+	{
+	case LUA_HOOKLINE:
+		{
+			charge( now );
+			if( d_confirm && !d_stack.isEmpty() )
+			{
+				// Ein Tail Call rueckt erst nach dem CALL auf die Tiefe des Aufrufers
+				d_stack.last().d_depth = _depth( L );
+				d_confirm = false;
+			}
+			lua_getinfo( L, "S", ar );
+			d_cur = Key( ar->source, ar->currentline );
+			Line& l = d_lines[ d_cur ];
+			if( l.d_hits == 0 )
+			{
+				l.d_source = source( ar->source );
+				l.d_line = ar->currentline;
+			}
+			l.d_hits++;
+		}
+		break;
+	case LUA_HOOKCALL:
+		{
+			charge( now );
+			Frame f;
+			f.d_depth = _depth( L );
+			unwind( f.d_depth - 1, now );
+			f.d_func = func( L, ar );
+			d_confirm = !d_funcs[ f.d_func ].d_host;
+			f.d_start = d_timer.nsecsElapsed(); // ohne die Zeit fuer getinfo
+			f.d_child = 0;
+			f.d_line = d_cur;
+			d_funcs[ f.d_func ].d_calls++;
+			d_stack.append( f );
+			d_last = f.d_start;
+		}
+		break;
+	case LUA_HOOKRET:
+	case LUA_HOOKTAILRET:
+		{
+			charge( now );
+			d_confirm = false;
+			if( ar->event == LUA_HOOKRET )
+			{
+				const int depth = _depth( L );
+				unwind( depth, now );
+				if( d_stack.isEmpty() || d_stack.last().d_depth != depth )
+					break; // vor start aufgerufen
+			}else if( d_stack.isEmpty() )
+				break;
+			pop( now );
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+QList<LuaProfiler::Line> LuaProfiler::getLines() const
+{
+	return d_lines.values();
+}
+
+QList<LuaProfiler::Func> LuaProfiler::getFuncs() const
+{
+	return d_funcs.toList();
+}
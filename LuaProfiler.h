@@ -0,0 +1,101 @@
+#ifndef LUAPROFILER_H
+#define LUAPROFILER_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QHash>
+#include <QVector>
+#include <QPair>
+#include "Stopwatch.h"
+
+typedef struct lua_State lua_State;
+typedef struct lua_Debug lua_Debug;
+typedef void (*lua_Hook) (lua_State *L, lua_Debug *ar);
+
+namespace Ds
+{
+	// Hook-basierter Profiler fuer einen lua_State: Treffer und Eigenzeit pro Zeile, Aufrufe sowie
+	// Eigen- und Gesamtzeit pro Funktion. C-Funktionen (LuaBinding, Bibliotheken) sind Host-Aufrufe;
+	// ihre Zeit wird nicht der aufrufenden Zeile angerechnet. Ein bereits gesetzter Hook wird
+	// weiter bedient. Nur ein Profiler gleichzeitig, nur im GUI-Thread. Zeiten in Nanosekunden
+	// (vor Qt 4.8 mit Millisekunden-Aufloesung, siehe Stopwatch).
+	class LuaProfiler
+	{
+	public:
+		struct Line
+		{
+			QByteArray d_source;
+			int d_line;
+			quint32 d_hits;
+			qint64 d_time;
+			Line():d_line(0),d_hits(0),d_time(0) {}
+		};
+		struct Func
+		{
+			QByteArray d_name;
+			QByteArray d_source; // leer bei Host-Aufrufen
+			int d_line; // Zeile der Definition
+			bool d_host;
+			quint32 d_calls;
+			qint64 d_self;
+			qint64 d_total; // bei Rekursion mehrfach gezaehlt
+			Func():d_line(0),d_host(false),d_calls(0),d_self(0),d_total(0) {}
+		};
+
+		LuaProfiler();
+		~LuaProfiler();
+		bool start( lua_State* ); // false falls bereits ein Profiler laeuft
+		bool stop(); // false falls der Hook unterwegs ersetzt wurde; die Daten sind dann unvollstaendig
+		bool isRunning() const { return d_ctx != 0; }
+		QList<Line> getLines() const;
+		QList<Func> getFuncs() const;
+		qint64 getElapsed() const { return d_elapsed; }
+	private:
+		typedef QPair<const void*,int> Key; // Source und Zeile bzw. C-Funktion und -1
+		struct Frame
+		{
+			int d_func; // Index in d_funcs
+			qint64 d_start;
+			qint64 d_child;
+			Key d_line; // Zeile des Aufrufers
+			int d_depth; // Stacktiefe laut lua_getstack
+		};
+		static void hook( lua_State*, lua_Debug* );
+		void onEvent( lua_State*, lua_Debug* );
+		void charge( qint64 now );
+		void pop( qint64 now );
+		void unwind( int depth, qint64 now );
+		int func( lua_State*, lua_Debug* );
+		QByteArray source( const char* );
+		lua_State* d_ctx;
+		lua_Hook d_prevHook;
+		int d_prevMask;
+		int d_prevCount;
+		Stopwatch d_timer;
+		qint64 d_last;
+		qint64 d_elapsed;
+		Key d_cur;
+		QVector<Frame> d_stack;
+		bool d_confirm; // Tiefe des obersten Frames beim naechsten LINE nachfuehren
+		QHash<Key,Line> d_lines;
+		QHash<Key,int> d_funcIdx;
+		QVector<Func> d_funcs;
+		QHash<const void*,QByteArray> d_sources;
+	};
+}
+
+#endif // LUAPROFILER_H
@@ -0,0 +1,232 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ObjectQuery.h"
+#include "TypeDefs.h"
+#include "Indexer.h"
+#include "AppContext.h"
+#include <Sdb/Transaction.h>
+#include <Sdb/Database.h>
+#include <Sdb/Idx.h>
+#include <Stream/DataReader.h>
+#include <QTextDocument>
+#include <QUuid>
+using namespace Ds;
+
+// Diese Typen haben AttrObjDocId und stehen damit in IdxDocObjId
+static bool _isIndexed( quint32 type )
+{
+	switch( type )
+	{
+	case TypeTitle:
+	case TypeSection:
+	case TypeTable:
+	case TypeTableRow:
+	case TypeTableCell:
+	case TypePicture:
+		return true;
+	default:
+		return false;
+	}
+}
+
+ObjectQuery::ObjectQuery( Sdb::Transaction* txn ):d_txn(txn)
+{
+	Q_ASSERT( txn != 0 );
+}
+
+void ObjectQuery::addWhere( const QByteArray& attr, const QVariant& value )
+{
+	Cond c;
+	c.d_name = attr;
+	c.d_value = value;
+	d_where.append( c );
+	d_atoms.clear();
+}
+
+const QList<quint32>& ObjectQuery::atoms( quint32 type )
+{
+	QHash<quint32,QList<quint32> >::const_iterator i = d_atoms.find( type );
+	if( i != d_atoms.end() )
+		return i.value();
+	QList<quint32>& l = d_atoms[type];
+	for( int j = 0; j < d_where.size(); j++ )
+		l.append( TypeDefs::findAtom( d_txn->getDb(), d_where[j].d_name.constData(), type ) );
+	return l;
+}
+
+static QString _plain( const Stream::DataCell& v, Sdb::Database* db )
+{
+	switch( v.getType() )
+	{
+	case Stream::DataCell::TypeBml:
+		{
+			Stream::DataReader r( v.getBml() );
+			return r.extractString();
+		}
+	case Stream::DataCell::TypeHtml:
+		{
+			QTextDocument doc;
+			doc.setHtml( v.getStr() );
+			return doc.toPlainText();
+		}
+	case Stream::DataCell::TypeAtom:
+		return QString::fromLatin1( TypeDefs::getSimpleName( v.getAtom(), db ) );
+	default:
+		return TypeDefs::prettyValue( v ).toString();
+	}
+}
+
+bool ObjectQuery::equals( const Stream::DataCell& v, const QVariant& value, Sdb::Database* db )
+{
+	if( v.isNull() )
+		return false;
+	switch( value.type() )
+	{
+	case QVariant::Bool:
+		return ( v.getType() == Stream::DataCell::TypeTrue || v.getType() == Stream::DataCell::TypeFalse ) &&
+				v.getBool() == value.toBool();
+	case QVariant::Double:
+		{
+			bool ok;
+			const double d = v.toVariant().toDouble( &ok );
+			return ok && d == value.toDouble();
+		}
+	default:
+		return _plain( v, db ) == value.toString();
+	}
+}
+
+bool ObjectQuery::matches( const Sdb::Obj& o )
+{
+	if( o.isNull() || o.isDeleted() )
+		return false;
+	const quint32 type = o.getType();
+	if( d_types.isEmpty() )
+	{
+		if( type == TypeStub )
+			return false; // stehen im selben Index wie die richtigen Objekte
+	}else if( !d_types.contains( type ) )
+		return false;
+	if( !d_where.isEmpty() )
+	{
+		const QList<quint32>& a = atoms( type );
+		for( int i = 0; i < d_where.size(); i++ )
+		{
+			if( a[i] == 0 || !equals( TypeDefs::getValue( o, a[i] ), d_where[i].d_value, o.getDb() ) )
+				return false;
+		}
+	}
+	if( !d_hits.isEmpty() && !inHits( o ) )
+		return false;
+	if( !d_text.isEmpty() && !Indexer::fetchText( o ).contains( d_text, Qt::CaseInsensitive ) )
+		return false;
+	return true;
+}
+
+bool ObjectQuery::inHits( const Sdb::Obj& obj ) const
+{
+	// Der Lucene-Index fasst pro Titel dessen Sections und Tabellen zusammen (siehe Indexer)
+	Sdb::Obj o = obj;
+	while( !o.isNull() )
+	{
+		const quint32 type = o.getType();
+		if( type == TypeTitle || type == TypeDocument )
+			return d_hits.contains( o.getOid() );
+		o = o.getOwner();
+	}
+	return false;
+}
+
+void ObjectQuery::walk( const Sdb::Obj& super, QList<quint64>& result )
+{
+	Sdb::Obj o = super.getFirstObj();
+	if( !o.isNull() ) do
+	{
+		if( matches( o ) )
+			result.append( o.getOid() );
+		walk( o, result );
+	}while( o.next() );
+}
+
+void ObjectQuery::scanDoc( const Sdb::Obj& doc, QList<quint64>& result )
+{
+	bool indexed = !d_types.isEmpty();
+	foreach( quint32 t, d_types )
+		indexed = indexed && _isIndexed( t );
+	if( !indexed )
+	{
+		walk( doc, result );
+		return;
+	}
+	// Alle Versionen eines Dokuments haben dieselbe AttrDocId; nur die Objekte von doc
+	Sdb::Idx idx( d_txn, d_txn->getDb()->findIndex( IndexDefs::IdxDocObjId ) );
+	if( idx.seek( QList<Stream::DataCell>() << doc.getValue( AttrDocId ) ) ) do
+	{
+		const Sdb::Obj o = d_txn->getObject( idx.getId() );
+		if( o.getValue( AttrObjHomeDoc ).getOid() == doc.getOid() && matches( o ) )
+			result.append( o.getOid() );
+	}while( idx.nextKey() );
+}
+
+static void _findDocs( const Sdb::Obj& p, QList<Sdb::Obj>& docs )
+{
+	Sdb::Obj o = p.getFirstObj();
+	if( !o.isNull() ) do
+	{
+		if( o.getType() == TypeDocument )
+			docs.append( o );
+		else if( o.getType() == TypeFolder )
+			_findDocs( o, docs );
+	}while( o.next() );
+}
+
+bool ObjectQuery::exec( QList<quint64>& result )
+{
+	d_error.clear();
+	d_hits.clear();
+	result.clear();
+	QSet<quint64> docsHit;
+	if( !d_search.isEmpty() )
+	{
+		Indexer idx;
+		Indexer::ResultList hits;
+		if( !idx.query( d_search, hits ) )
+		{
+			d_error = idx.getError();
+			return false;
+		}
+		if( hits.isEmpty() )
+			return true;
+		for( int i = 0; i < hits.size(); i++ )
+		{
+			d_hits.insert( hits[i].d_title.getOid() );
+			docsHit.insert( hits[i].d_doc.getOid() );
+		}
+	}
+	QList<Sdb::Obj> docs = d_docs;
+	if( docs.isEmpty() )
+		_findDocs( d_txn->getObject( QUuid( AppContext::s_rootUuid ) ), docs );
+	for( int i = 0; i < docs.size(); i++ )
+	{
+		if( docs[i].isNull() || docs[i].getType() != TypeDocument )
+			continue;
+		if( !d_search.isEmpty() && !docsHit.contains( docs[i].getOid() ) )
+			continue;
+		scanDoc( docs[i], result );
+	}
+	return true;
+}
@@ -0,0 +1,67 @@
+#ifndef OBJECTQUERY_H
+#define OBJECTQUERY_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <Sdb/Obj.h>
+#include <QList>
+#include <QSet>
+#include <QHash>
+#include <QVariant>
+
+namespace Ds
+{
+	// Sucht Objekte in Dokumenten nach Typ, Attributwerten und Text. Die Attributnamen werden pro
+	// Objekttyp nur einmal in Atome aufgeloest. Inhaltsobjekte eines Dokuments kommen aus IdxDocObjId
+	// (Reihenfolge der Absolute Number), search schraenkt ueber den Lucene-Index auf die Titel der
+	// Treffer ein. search nur im GUI-Thread (Indexer arbeitet mit AppContext).
+	class ObjectQuery
+	{
+	public:
+		ObjectQuery( Sdb::Transaction* );
+		void addDoc( const Sdb::Obj& doc ) { d_docs.append( doc ); } // ohne Dokument: alle im Repository
+		void addType( quint32 type ) { d_types.insert( type ); } // ohne Typ: alle ausser Stubs
+		void addWhere( const QByteArray& attr, const QVariant& value ); // Gleichheit; String, Zahl oder Bool
+		void setText( const QString& text ) { d_text = text; } // Teilstring, ohne Gross-/Kleinschreibung
+		void setSearch( const QString& query ) { d_search = query; } // Lucene-Syntax wie in SearchView
+		bool exec( QList<quint64>& result );
+		const QString& getError() const { return d_error; }
+		bool matches( const Sdb::Obj& ); // Typ, where und text
+	private:
+		struct Cond
+		{
+			QByteArray d_name;
+			QVariant d_value;
+		};
+		const QList<quint32>& atoms( quint32 type );
+		void scanDoc( const Sdb::Obj& doc, QList<quint64>& result );
+		void walk( const Sdb::Obj& super, QList<quint64>& result );
+		bool inHits( const Sdb::Obj& ) const;
+		static bool equals( const Stream::DataCell&, const QVariant&, Sdb::Database* );
+		Sdb::Transaction* d_txn;
+		QList<Sdb::Obj> d_docs;
+		QSet<quint32> d_types;
+		QList<Cond> d_where;
+		QHash<quint32,QList<quint32> > d_atoms; // Objekttyp -> Atom pro Eintrag in d_where, 0 falls unbekannt
+		QString d_text;
+		QString d_search;
+		QSet<quint64> d_hits; // Titel und Dokumente aus search
+		QString d_error;
+	};
+}
+
+#endif // OBJECTQUERY_H
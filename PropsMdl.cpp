@@ -77,7 +77,7 @@ void PropsMdl::refill()
 		QMap<QByteArray,quint32>::const_iterator j;
 		for( j = dir.begin(); j != dir.end(); ++j )
 		{
-			Stream::DataCell v = d_obj.getValue( j.value() );
+			Stream::DataCell v = TypeDefs::getValue( d_obj, j.value() );
 			if( !j.key().isEmpty() && !v.isNull() )
 			{
 				const int fieldLimit = 50;
@@ -194,7 +194,7 @@ QVariant PropsMdl::data ( const QModelIndex & index, int role ) const
 		QModelIndex i = index;
 		if( index.internalId() >= ValueIndex )
 			i = index.parent();
-		Stream::DataCell v = d_obj.getValue( d_rows[ i.row() ].first );
+		Stream::DataCell v = TypeDefs::getValue( d_obj, d_rows[ i.row() ].first );
 		if( v.isBml() )
 			return v.getArr();
 		else
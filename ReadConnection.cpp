@@ -0,0 +1,72 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ReadConnection.h"
+#include <Sdb/Exceptions.h>
+#include <QFile>
+using namespace Ds;
+
+ReadConnection::ReadConnection( const QString& dbPath ):d_db(0),d_txn(0),d_path(dbPath),
+	d_base(-1),d_changed(false)
+{
+	d_db = new Sdb::Database();
+	try
+	{
+		d_db->open( dbPath );
+		d_txn = new Sdb::Transaction( d_db );
+	}catch( ... )
+	{
+		delete d_db;
+		throw;
+	}
+}
+
+ReadConnection::~ReadConnection()
+{
+	if( d_txn )
+	{
+		d_txn->rollback();
+		delete d_txn;
+	}
+	delete d_db;
+}
+
+void ReadConnection::check()
+{
+	// Unter dem Lese-Lock kann kein Commit laufen; ein anderer Zaehler als beim ersten Block
+	// heisst, dass dazwischen committed wurde
+	const qint64 n = changeCounter( d_path );
+	if( n < 0 )
+		d_changed = true; // nicht feststellbar, also nicht als einheitlich ausgeben
+	else if( d_base < 0 )
+		d_base = n;
+	else if( n != d_base )
+		d_changed = true;
+}
+
+qint64 ReadConnection::changeCounter( const QString& dbPath )
+{
+	// SQLite-Dateikopf: "SQLite format 3\0", Offset 18 Schreibversion (2..WAL),
+	// Offset 24 Aenderungszaehler (32 Bit big endian)
+	QFile f( dbPath );
+	if( !f.open( QIODevice::ReadOnly ) )
+		return -1;
+	const QByteArray h = f.read( 28 );
+	if( h.size() < 28 || !h.startsWith( QByteArray( "SQLite format 3", 16 ) ) || quint8( h[18] ) == 2 )
+		return -1;
+	return ( quint32( quint8( h[24] ) ) << 24 ) | ( quint32( quint8( h[25] ) ) << 16 ) |
+		( quint32( quint8( h[26] ) ) << 8 ) | quint32( quint8( h[27] ) );
+}
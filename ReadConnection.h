@@ -0,0 +1,70 @@
+#ifndef READCONNECTION_H
+#define READCONNECTION_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <Sdb/Database.h>
+#include <Sdb/Transaction.h>
+
+namespace Ds
+{
+	// Eigene Lese-Verbindung fuer Hintergrund-Threads auf dieselbe .dsdb; kein Snapshot:
+	// - innerhalb eines Reader-Blocks bleibt der Stand konsistent, zwischen zwei Blocks werden
+	//   Commits anderer Verbindungen (z.B. AppContext::getTxn) sichtbar; kurze Blocks, damit
+	//   Schreiber im GUI-Thread nicht warten;
+	// - isChanged meldet, ob seit dem Ende des ersten Blocks jemand committed hat (Aenderungszaehler
+	//   im SQLite-Dateikopf). Wer ueber mehrere Blocks einen einheitlichen Stand braucht, prueft
+	//   isChanged am Schluss und beginnt mit restart neu oder verwirft das Resultat;
+	// - Schreiben ist nicht vorgesehen; der Destruktor verwirft allfaellige Aenderungen.
+	// Im Thread erzeugen, der sie benutzt; wirft Sdb::DatabaseException.
+	class ReadConnection
+	{
+	public:
+		class Reader
+		{
+		public:
+			Reader( ReadConnection& c ):d_conn( c ),d_lock( c.d_db, false ) {}
+			~Reader() { d_conn.check(); } // noch unter dem Lock
+		private:
+			ReadConnection& d_conn;
+			Sdb::Database::Lock d_lock;
+		};
+
+		ReadConnection( const QString& dbPath );
+		~ReadConnection();
+		Sdb::Transaction* getTxn() const { return d_txn; }
+		Sdb::Database* getDb() const { return d_db; }
+		Sdb::Obj getObject( quint64 oid ) const { return d_txn->getObject( oid ); }
+		bool isChanged() const { return d_changed; }
+		void restart() { d_base = -1; d_changed = false; } // der naechste Block gilt als erster
+		qint64 getBase() const { return d_base; } // Zaehlerstand des ersten Blocks oder -1
+
+		// Zaehler im Dateikopf, den SQLite bei jedem Commit im Rollback-Journal-Modus erhoeht;
+		// -1 wenn die Datei nicht lesbar ist oder im WAL-Modus laeuft (dort nicht nachgefuehrt)
+		static qint64 changeCounter( const QString& dbPath );
+	private:
+		ReadConnection( const ReadConnection& );
+		void check();
+		Sdb::Database* d_db;
+		Sdb::Transaction* d_txn;
+		QString d_path;
+		qint64 d_base;
+		bool d_changed;
+	};
+}
+
+#endif // READCONNECTION_H
@@ -15,6 +15,7 @@
 */
 
 #include "ReqIfImport.h"
+#include "DocManager.h"
 #include <Sdb/Database.h>
 #include <QDialog>
 #include <QDialogButtonBox>
@@ -112,6 +113,7 @@ void ReqIfImport::clearAll()
 	ReqIfParser::clearAll();
 	d_objCache.clear();
 	d_relCache.clear();
+	d_bulk.clear();
 	d_customObjAttr.clear();
 	d_customModAttr.clear();
 	d_nextId = 1;
@@ -201,7 +203,7 @@ Sdb::Obj ReqIfImport::splitTitleBody( Sdb::Obj& title, const Sdb::Obj& doc )
 		body = AppContext::inst()->getTxn()->createObject( TypeSection );
 		//d_nrToOid[ title.getValue( AttrObjRelId ).getInt32() ] = body.getId();
 		body.aggregateTo( title );
-		body.setValue( AttrObjDocId, doc.getValue( AttrDocId ) );
+		d_bulk.setDocId( body, doc.getValue( AttrDocId ) );
 		body.setValue( AttrObjText, title.getValue( AttrObjText ) );
 		title.setValue( AttrObjText, title.getValue( AttrStubTitle ) );
 		title.setValue( AttrStubTitle, Stream::DataCell().setNull() );
@@ -213,7 +215,6 @@ Sdb::Obj ReqIfImport::splitTitleBody( Sdb::Obj& title, const Sdb::Obj& doc )
 		body.setValue( AttrObjDeleted, title.getValue( AttrObjDeleted ) );
 		body.setValue( AttrObjHomeDoc, title.getValue( AttrObjHomeDoc ) );
 		body.setValue( AttrObjNumber, title.getValue( AttrObjNumber ) );
-		body.setValue( AttrObjDocId, title.getValue( AttrObjDocId ) );
 
 		body.setValue( AttrCreatedBy, title.getValue( AttrCreatedBy ) );
 		body.setValue( AttrCreatedOn, title.getValue( AttrCreatedOn ) );
@@ -340,6 +341,9 @@ Sdb::Obj ReqIfImport::generateSpecification(const ReqIfParser::SpecHierarchy & s
 		for( int i = 0; i < spec.d_children.size(); i++ )
 			generateStructure( doc, doc, spec.d_children[i] );
 
+		d_bulk.flush( doc.getTxn() );
+		DocManager::updateHashes( doc );
+
 		DataWriter w;
 		QSet<quint32>::const_iterator i;
 		for( i = d_customObjAttr.begin(); i != d_customObjAttr.end(); ++i )
@@ -357,12 +361,14 @@ Sdb::Obj ReqIfImport::generateSpecification(const ReqIfParser::SpecHierarchy & s
 	}catch( Sdb::DatabaseException& e )
 	{
 		d_error += e.getCodeString() + " " + e.getMsg();
+		d_bulk.clear();
 		AppContext::inst()->getTxn()->rollback();
 		lock.rollback();
 		return Sdb::Obj();
 	}catch( std::exception& e )
 	{
 		d_error += e.what();
+		d_bulk.clear();
 		AppContext::inst()->getTxn()->rollback();
 		lock.rollback();
 		return Sdb::Obj();
@@ -394,7 +400,7 @@ void ReqIfImport::generateStructure(Sdb::Obj &parent, Sdb::Obj &home, const Spec
 	}
 	// me selber scheint keine relevanten Daten zu enthalten ausser die Struktur
 	const ObjWithVals & data = d_specObjects.value( me.d_ref );
-	obj.setValue( AttrObjText, DataCell().setString( data.d_longName ) );
+	obj.setValue( AttrObjText, TypeDefs::pack( DataCell().setString( data.d_longName ) ) );
 	obj.setValue( AttrObjShort, DataCell().setString( data.d_desc ) );
 	obj.setValue( AttrCreatedBy, DataCell().setString( "DoorScope" ) );
 	obj.setValue( AttrCreatedOn, DataCell().setDateTime( QDateTime::currentDateTime() ) );
@@ -402,7 +408,7 @@ void ReqIfImport::generateStructure(Sdb::Obj &parent, Sdb::Obj &home, const Spec
 	if( data.d_lastChange.isValid() )
 		obj.setValue( AttrModifiedOn, DataCell().setDateTime( data.d_lastChange ) );
 	obj.setValue( AttrObjHomeDoc, home );
-	obj.setValue( AttrObjDocId, home.getValue( AttrDocId ) );
+	d_bulk.setDocId( obj, home.getValue( AttrDocId ) );
 
 	generateAttrs( obj, data, d_specObjectTypes.value( data.d_ref ) );
 
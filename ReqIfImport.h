@@ -19,6 +19,7 @@
 
 #include <DoorScope/ReqIfParser.h>
 #include <Sdb/Obj.h>
+#include "DocManager.h"
 
 namespace Ds
 {
@@ -43,6 +44,7 @@ namespace Ds
 		QSet<quint32> d_customObjAttr;
 		QSet<quint32> d_customModAttr;
 		quint32 d_nextId;
+		BulkIndex d_bulk; // generateSpecification
 	};
 }
 
@@ -0,0 +1,230 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ResultView.h"
+#include <QAbstractTableModel>
+#include <QTreeView>
+#include <QHeaderView>
+#include <QVBoxLayout>
+#include <QResizeEvent>
+#include <QSettings>
+#include <QTimer>
+#include <QHash>
+#include <Gui2/AutoMenu.h>
+#include "AppContext.h"
+#include "TypeDefs.h"
+#include "DocViewer.h"
+using namespace Ds;
+
+static const int s_obj = 0;
+static const int s_doc = 1;
+static const int s_extra = 2; // erste Zusatzspalte aus dem Script
+
+class ResultView::Mdl : public QAbstractTableModel
+{
+public:
+	struct Row
+	{
+		quint64 d_oid;
+		QStringList d_cols;
+		Row( quint64 oid = 0, const QStringList& cols = QStringList() ):d_oid(oid),d_cols(cols){}
+	};
+	QList<Row> d_rows;
+	QList<Row> d_pending; // bis zum naechsten flush
+	QStringList d_head;
+	mutable QHash<quint64,QString> d_docNames;
+
+	Mdl( QObject* p ):QAbstractTableModel( p ) {}
+
+	static Sdb::Obj homeDoc( const Sdb::Obj& o )
+	{
+		switch( o.getType() )
+		{
+		case TypeDocument:
+			return o;
+		case TypeAnnotation:
+			return o.getObject( AttrAnnHomeDoc );
+		default:
+			return o.getObject( AttrObjHomeDoc );
+		}
+	}
+	static QString objText( const Sdb::Obj& o )
+	{
+		switch( o.getType() )
+		{
+		case TypeDocument:
+			return TypeDefs::formatDocName( o, false );
+		case TypeAnnotation:
+			return TypeDefs::elided( o.getValue( AttrAnnText ), 80 );
+		}
+		QString s = TypeDefs::elided( o.getValue( AttrObjText ), 80 );
+		const QString nr = o.getValue( AttrObjNumber ).toString(true);
+		if( !nr.isEmpty() )
+			s = nr + QChar(' ') + s;
+		return s;
+	}
+	void flush()
+	{
+		if( d_pending.isEmpty() )
+			return;
+		beginInsertRows( QModelIndex(), d_rows.size(), d_rows.size() + d_pending.size() - 1 );
+		d_rows += d_pending;
+		d_pending.clear();
+		endInsertRows();
+	}
+	void clear()
+	{
+		d_pending.clear();
+		d_docNames.clear();
+		if( d_rows.isEmpty() )
+			return;
+		beginRemoveRows( QModelIndex(), 0, d_rows.size() - 1 );
+		d_rows.clear();
+		endRemoveRows();
+	}
+	int rowCount( const QModelIndex & parent = QModelIndex() ) const
+	{
+		return ( parent.isValid() ) ? 0 : d_rows.size();
+	}
+	int columnCount( const QModelIndex & parent = QModelIndex() ) const
+	{
+		return ( parent.isValid() ) ? 0 : s_extra + d_head.size();
+	}
+	QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const
+	{
+		if( !index.isValid() || role != Qt::DisplayRole )
+			return QVariant();
+		const Row& r = d_rows[index.row()];
+		if( index.column() >= s_extra )
+			return r.d_cols.value( index.column() - s_extra );
+		const Sdb::Obj o = AppContext::inst()->getTxn()->getObject( r.d_oid );
+		if( o.isNull() || o.isDeleted() )
+			return ( index.column() == s_obj ) ? tr("<deleted>") : QString();
+		if( index.column() == s_obj )
+			return objText( o );
+		const Sdb::Obj doc = homeDoc( o );
+		QHash<quint64,QString>::const_iterator i = d_docNames.find( doc.getOid() );
+		if( i == d_docNames.end() )
+			i = d_docNames.insert( doc.getOid(), TypeDefs::formatDocName( doc, false ) );
+		return i.value();
+	}
+	QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const
+	{
+		if( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+			return QVariant();
+		switch( section )
+		{
+		case s_obj:
+			return tr("Object");
+		case s_doc:
+			return tr("Document");
+		}
+		return d_head.value( section - s_extra );
+	}
+};
+
+ResultView::ResultView( const QString& title, const QStringList& cols )
+{
+	setAttribute( Qt::WA_DeleteOnClose );
+	setWindowTitle( title );
+
+	QVBoxLayout* vbox = new QVBoxLayout( this );
+	vbox->setMargin( 3 );
+
+	d_mdl = new Mdl( this );
+	d_mdl->d_head = cols;
+
+	d_list = new QTreeView( this );
+	// Gleich hohe Zeilen: die View fragt nur die sichtbaren Zeilen ab, auch bei 100k Eintraegen
+	d_list->setUniformRowHeights( true );
+	d_list->setRootIsDecorated( false );
+	d_list->setAllColumnsShowFocus( true );
+	d_list->setAlternatingRowColors( true );
+	d_list->setModel( d_mdl );
+	// Kein ResizeToContents, das wuerde alle Zeilen ausmessen
+	d_list->header()->setResizeMode( QHeaderView::Interactive );
+	d_list->header()->resizeSection( s_obj, 300 );
+	connect( d_list, SIGNAL( activated ( const QModelIndex & ) ), this, SLOT( onGoto() ) );
+	connect( d_list, SIGNAL( doubleClicked ( const QModelIndex & ) ), this, SLOT( onGoto() ) );
+	vbox->addWidget( d_list );
+
+	Gui2::AutoMenu* pop = new Gui2::AutoMenu( d_list, true );
+	pop->addCommand( tr("Show object"), this, SLOT( onGotoIf() ), tr("Return") );
+
+	QSize s = AppContext::inst()->getSet()->value("ResultView/Size" ).toSize();
+	if( s.isValid() )
+		resize( s );
+}
+
+ResultView::~ResultView()
+{
+}
+
+void ResultView::resizeEvent ( QResizeEvent * e )
+{
+	QWidget::resizeEvent( e );
+	if( e->spontaneous() )
+		AppContext::inst()->getSet()->setValue("ResultView/Size", e->size() );
+}
+
+void ResultView::addRow( quint64 oid, const QStringList& cols )
+{
+	if( d_mdl->d_pending.isEmpty() )
+		QTimer::singleShot( 0, this, SLOT( onFlush() ) );
+	d_mdl->d_pending.append( Mdl::Row( oid, cols ) );
+}
+
+void ResultView::clear()
+{
+	d_mdl->clear();
+}
+
+int ResultView::count() const
+{
+	return d_mdl->d_rows.size() + d_mdl->d_pending.size();
+}
+
+void ResultView::onFlush()
+{
+	d_mdl->flush();
+}
+
+void ResultView::onGoto()
+{
+	const QModelIndex i = d_list->currentIndex();
+	if( !i.isValid() )
+		return;
+	Sdb::Obj o = AppContext::inst()->getTxn()->getObject( d_mdl->d_rows[i.row()].d_oid );
+	if( o.isNull() || o.isDeleted() )
+		return;
+	if( o.getType() == TypeAnnotation )
+		o = o.getOwner(); // das annotierte Objekt
+	const Sdb::Obj doc = Mdl::homeDoc( o );
+	if( doc.isNull() )
+		return;
+
+	DocViewer* v = DocViewer::showDoc( doc );
+	quint64 id = o.getId();
+	if( id == doc.getId() )
+		id = doc.getFirstObj().getId();
+	v->gotoObject( id );
+}
+
+void ResultView::onGotoIf()
+{
+	ENABLED_IF( d_list->currentIndex().isValid() );
+	onGoto();
+}
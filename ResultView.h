@@ -0,0 +1,52 @@
+#ifndef RESULTVIEW_H
+#define RESULTVIEW_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QWidget>
+#include <QStringList>
+
+class QTreeView;
+
+namespace Ds
+{
+	// Ergebnisliste fuer Scripts (DoorScope:createResultList). Gespeichert werden nur OID und die
+	// Zusatzspalten; Objekt- und Dokumenttext entstehen erst beim Zeichnen der sichtbaren Zeilen.
+	// addRow sammelt und fuegt gebuendelt ins Modell ein. Nur im GUI-Thread.
+	class ResultView : public QWidget
+	{
+		Q_OBJECT
+	public:
+		ResultView( const QString& title, const QStringList& cols );
+		~ResultView();
+		void addRow( quint64 oid, const QStringList& cols );
+		void clear();
+		int count() const;
+	protected:
+		void resizeEvent ( QResizeEvent * e );
+	protected slots:
+		void onGoto();
+		void onGotoIf();
+		void onFlush();
+	private:
+		class Mdl;
+		Mdl* d_mdl;
+		QTreeView* d_list;
+	};
+}
+
+#endif // RESULTVIEW_H
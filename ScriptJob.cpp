@@ -0,0 +1,199 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ScriptJob.h"
+#include "AppContext.h"
+#include "LuaBinding.h"
+#include "DocSelectorDlg.h"
+#include <Sdb/Exceptions.h>
+#include <Script/Lua.h>
+#include <QApplication>
+#include <QFileDialog>
+#include <QSettings>
+using namespace Ds;
+
+static const int s_hookCount = 10000; // Instruktionen zwischen zwei Pruefungen
+static const int s_lockSlice = 50; // ms, danach wird der Lese-Lock kurz freigegeben
+
+ScriptJob::ScriptJob( const QByteArray& code, const QByteArray& name, QObject* p ):QThread(p),
+	d_code(code),d_name(name),d_root(0),d_conn(0),d_reader(0),d_req(NoRequest),d_cancel(false)
+{
+	// Im GUI-Thread erzeugt; damit laufen auch die Slots dort
+	d_path = AppContext::inst()->getDb()->getFilePath();
+	d_root = AppContext::inst()->getRoot().getOid();
+}
+
+void ScriptJob::cancel()
+{
+	QMutexLocker lock( &d_mutex );
+	d_cancel = true;
+	d_answered.wakeAll();
+}
+
+ScriptJob* ScriptJob::current()
+{
+	return qobject_cast<ScriptJob*>( QThread::currentThread() );
+}
+
+void ScriptJob::relock()
+{
+	delete d_reader;
+	d_reader = 0;
+	d_reader = new ReadConnection::Reader( *d_conn );
+	d_lockTime.start();
+}
+
+void ScriptJob::hook( lua_State* L, lua_Debug* )
+{
+	ScriptJob* job = current();
+	if( job == 0 )
+		return;
+	if( job->d_cancel )
+		luaL_error( L, "script canceled by user" );
+	if( job->d_lockTime.elapsed() > s_lockSlice )
+	{
+		job->relock();
+		// Offene Obj-Cursor des Scripts wuerden sonst Staende vor und nach dem Commit mischen
+		if( job->d_conn->isChanged() )
+			luaL_error( L, "the repository was modified while the script was running; please run it again" );
+	}
+}
+
+int ScriptJob::print( lua_State* L )
+{
+	// Wie print der Lua-Bibliothek, aber ueber output an das GUI
+	ScriptJob* job = current();
+	const int n = lua_gettop( L );
+	QString str;
+	lua_getglobal( L, "tostring" );
+	for( int i = 1; i <= n; i++ )
+	{
+		lua_pushvalue( L, -1 );
+		lua_pushvalue( L, i );
+		lua_call( L, 1, 1 );
+		const char* s = lua_tostring( L, -1 );
+		if( s == 0 )
+			return luaL_error( L, "'tostring' must return a string to 'print'" );
+		if( i > 1 )
+			str += QChar('\t');
+		str += QString::fromLatin1( s );
+		lua_pop( L, 1 );
+	}
+	if( job )
+		emit job->output( str );
+	return 0;
+}
+
+void ScriptJob::run()
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs( L );
+	LuaBinding::install( L );
+	lua_pushcfunction( L, print );
+	lua_setglobal( L, "print" );
+	try
+	{
+		ReadConnection conn( d_path );
+		d_conn = &conn;
+		relock();
+		LuaBinding::setRoot( L, conn.getObject( d_root ) );
+		lua_sethook( L, hook, LUA_MASKCOUNT, s_hookCount );
+		if( luaL_loadbuffer( L, d_code, d_code.size(), d_name ) != 0 || lua_pcall( L, 0, 0, 0 ) != 0 )
+		{
+			if( !d_cancel )
+				d_error = QString::fromLatin1( lua_tostring( L, -1 ) );
+			lua_pop( L, 1 );
+		}
+		delete d_reader;
+		d_reader = 0;
+		d_conn = 0;
+	}catch( const Sdb::DatabaseException& e )
+	{
+		delete d_reader;
+		d_reader = 0;
+		d_conn = 0;
+		d_error = QString( "%1: %2" ).arg( e.getCodeString() ).arg( e.getMsg() );
+	}
+	lua_close( L );
+}
+
+QVariant ScriptJob::ask( Request r, const QString& title )
+{
+	Q_ASSERT( QThread::currentThread() == this );
+	QMutexLocker lock( &d_mutex );
+	d_req = r;
+	d_reqTitle = title;
+	d_answer = QVariant();
+	// Der Lese-Lock wird freigegeben, solange der Benutzer im Dialog ist
+	delete d_reader;
+	d_reader = 0;
+	QMetaObject::invokeMethod( this, "onRequest", Qt::QueuedConnection );
+	while( d_req != NoRequest && !d_cancel )
+		d_answered.wait( &d_mutex );
+	d_req = NoRequest;
+	const QVariant res = d_answer;
+	lock.unlock();
+	relock();
+	return res;
+}
+
+void ScriptJob::onRequest()
+{
+	Request r;
+	QString title;
+	{
+		QMutexLocker lock( &d_mutex );
+		if( d_req == NoRequest || d_cancel )
+			return;
+		r = d_req;
+		title = d_reqTitle;
+	}
+	QVariant res;
+	switch( r )
+	{
+	case SelectDoc:
+		{
+			DocSelectorDlg dlg( QApplication::activeWindow() );
+			dlg.setWindowTitle( title );
+			dlg.resize( AppContext::inst()->getSet()->value(
+							"DocSelectorDlg/Size", QSize( 400, 400 ) ).toSize() ); // RISK
+			res = dlg.select( AppContext::inst()->getRoot() );
+		}
+		break;
+	case SaveFile:
+		res = QFileDialog::getSaveFileName( QApplication::activeWindow(), title );
+		break;
+	case OpenFile:
+		res = QFileDialog::getOpenFileName( QApplication::activeWindow(), title );
+		break;
+	default:
+		break;
+	}
+	QMutexLocker lock( &d_mutex );
+	d_answer = res;
+	d_req = NoRequest;
+	d_answered.wakeAll();
+}
+
+quint64 ScriptJob::selectDocument( const QString& title )
+{
+	return ask( SelectDoc, title ).toULongLong();
+}
+
+QString ScriptJob::getFileName( const QString& title, bool save )
+{
+	return ask( ( save ) ? SaveFile : OpenFile, title ).toString();
+}
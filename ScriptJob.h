@@ -0,0 +1,80 @@
+#ifndef SCRIPTJOB_H
+#define SCRIPTJOB_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVariant>
+#include "ReadConnection.h"
+#include "Stopwatch.h"
+
+typedef struct lua_State lua_State;
+typedef struct lua_Debug lua_Debug;
+
+namespace Ds
+{
+	// Fuehrt ein Script in einem eigenen lua_State ueber eine eigene ReadConnection aus (nur lesen).
+	// print geht ueber output an das GUI. Dialoge (selectDocument, File.openFor...) laufen im GUI-Thread,
+	// der Job wartet solange. Der Lese-Lock wird regelmaessig freigegeben, damit Schreiber im
+	// GUI-Thread nicht blockiert werden; wurde inzwischen committed, bricht das Script mit einem
+	// Fehler ab. cancel bricht beim naechsten Instruktionsblock ab.
+	class ScriptJob : public QThread
+	{
+		Q_OBJECT
+	public:
+		ScriptJob( const QByteArray& code, const QByteArray& name, QObject* p = 0 );
+		void cancel();
+		bool isCanceled() const { return d_cancel; }
+		const QString& getError() const { return d_error; }
+		const QByteArray& getName() const { return d_name; }
+
+		static ScriptJob* current(); // 0 ausserhalb eines ScriptJob
+		// Nur aus dem Job-Thread; 0 bzw. leer bei Abbruch
+		quint64 selectDocument( const QString& title );
+		QString getFileName( const QString& title, bool save );
+	signals:
+		void output( const QString& );
+	protected:
+		void run();
+	protected slots:
+		void onRequest();
+	private:
+		enum Request { NoRequest, SelectDoc, SaveFile, OpenFile };
+		static void hook( lua_State*, lua_Debug* );
+		static int print( lua_State* );
+		QVariant ask( Request, const QString& title );
+		void relock();
+		QByteArray d_code;
+		QByteArray d_name;
+		QString d_path;
+		quint64 d_root;
+		QString d_error;
+		ReadConnection* d_conn;
+		ReadConnection::Reader* d_reader;
+		Stopwatch d_lockTime;
+		QMutex d_mutex; // fuer die folgenden
+		QWaitCondition d_answered;
+		Request d_req;
+		QString d_reqTitle;
+		QVariant d_answer;
+		volatile bool d_cancel;
+	};
+}
+
+#endif // SCRIPTJOB_H
@@ -0,0 +1,215 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Statistics.h"
+#include "TypeDefs.h"
+#include "AppContext.h"
+#include <Sdb/Database.h>
+#include <Sdb/Transaction.h>
+#include <Stream/DataWriter.h>
+#include <QApplication>
+#include <QProgressDialog>
+using namespace Ds;
+
+static Statistics* s_inst = 0;
+
+Statistics::Statistics( QObject* p ):QObject( p ),d_lastId(0),d_lastDoc(0),d_scanned(0)
+{
+	AppContext::inst()->getDb()->addObserver( this, SLOT(onDbUpdate( Sdb::UpdateInfo )));
+}
+
+Statistics* Statistics::inst()
+{
+	if( s_inst == 0 )
+		s_inst = new Statistics( AppContext::inst() );
+	return s_inst;
+}
+
+qint64 Statistics::valueSize( const Stream::DataCell& v )
+{
+	Stream::DataWriter w;
+	w.writeSlot( v );
+	return w.getStream().size();
+}
+
+qint64 Statistics::objectSize( const Sdb::Obj& o )
+{
+	qint64 n = 16;
+	Sdb::Obj::Names names = o.getNames();
+	Sdb::Obj::Names::const_iterator i;
+	for( i = names.begin(); i != names.end(); ++i )
+		n += 4 + valueSize( o.getValue( *i ) );
+	Sdb::Qit q = o.getFirstSlot();
+	if( !q.isNull() ) do
+	{
+		n += 8;
+	}while( q.next() );
+	return n;
+}
+
+void Statistics::scan( const Sdb::Obj& o, Doc& d, QSet<quint64>& visited )
+{
+	if( visited.contains( o.getOid() ) )
+		return;
+	visited.insert( o.getOid() );
+	const quint32 type = o.getType();
+	d.d_types[type]++;
+	d.d_objects++;
+	if( type == TypeHistory )
+		d.d_history++;
+	else if( type == TypeAnnotation )
+		d.d_annotations++;
+	qint64 bytes = 16;
+	Sdb::Obj::Names names = o.getNames();
+	Sdb::Obj::Names::const_iterator i;
+	for( i = names.begin(); i != names.end(); ++i )
+	{
+		const qint64 n = valueSize( o.getValue( *i ) );
+		d.d_attrBytes[*i] += n;
+		bytes += 4 + n;
+		if( *i == AttrPicImage )
+			d.d_imageBytes += n;
+	}
+	// Indexeintraege gemaess TypeDefs::initDb; Schluessel plus OID
+	if( type == TypeDocument )
+	{
+		d.d_indexEntries++;
+		d.d_indexBytes += valueSize( o.getValue( AttrDocId ) ) + 8;
+	}else if( type == TypeAnnotation )
+	{
+		d.d_indexEntries++;
+		d.d_indexBytes += 8 + valueSize( o.getValue( AttrAnnNr ) ) + 8;
+	}else if( names.contains( AttrObjDocId ) )
+	{
+		d.d_indexEntries++;
+		d.d_indexBytes += valueSize( o.getValue( AttrObjDocId ) ) + valueSize( o.getValue( AttrObjIdent ) ) + 8;
+	}
+	// TypeHistory ist nur ueber Slots erreichbar und haengt an mehreren Objekten
+	Sdb::Qit q = o.getFirstSlot();
+	if( !q.isNull() ) do
+	{
+		bytes += 8;
+		const Sdb::Obj hr = o.getTxn()->getObject( q.getValue() );
+		if( !hr.isNull() )
+			scan( hr, d, visited );
+	}while( q.next() );
+	d.d_bytes += bytes;
+	Sdb::Obj sub = o.getFirstObj();
+	if( !sub.isNull() ) do
+	{
+		scan( sub, d, visited );
+	}while( sub.next() );
+}
+
+static void _findDocs( const Sdb::Obj& p, QList<Sdb::Obj>& docs )
+{
+	Sdb::Obj o = p.getFirstObj();
+	if( !o.isNull() ) do
+	{
+		if( o.getType() == TypeDocument )
+			docs.append( o );
+		else if( o.getType() == TypeFolder )
+			_findDocs( o, docs );
+	}while( o.next() );
+}
+
+bool Statistics::refresh( QProgressDialog* progress )
+{
+	QList<Sdb::Obj> all;
+	_findDocs( AppContext::inst()->getRoot(), all );
+	QList<Sdb::Obj> todo;
+	QSet<quint64> present;
+	for( int i = 0; i < all.size(); i++ )
+	{
+		present.insert( all[i].getOid() );
+		if( !d_docs.contains( all[i].getOid() ) || d_dirty.contains( all[i].getOid() ) )
+			todo.append( all[i] );
+	}
+	Docs::iterator j = d_docs.begin();
+	while( j != d_docs.end() )
+	{
+		if( !present.contains( j.key() ) )
+			j = d_docs.erase( j );
+		else
+			++j;
+	}
+	if( progress )
+		progress->setRange( 0, todo.size() );
+	d_scanned = 0;
+	for( int i = 0; i < todo.size(); i++ )
+	{
+		if( progress )
+		{
+			progress->setValue( i );
+			progress->setLabelText( tr("Scanning %1").arg( TypeDefs::formatDocName( todo[i] ) ) );
+			QApplication::processEvents();
+			if( progress->wasCanceled() )
+				return false;
+		}
+		Doc d;
+		d.d_name = TypeDefs::formatDocName( todo[i] );
+		QSet<quint64> visited;
+		scan( todo[i], d, visited );
+		d_docs[ todo[i].getOid() ] = d;
+		d_dirty.remove( todo[i].getOid() );
+		d_scanned++;
+	}
+	if( progress )
+		progress->setValue( todo.size() );
+	return true;
+}
+
+void Statistics::onDbUpdate( Sdb::UpdateInfo info )
+{
+	switch( info.d_kind )
+	{
+	case Sdb::UpdateInfo::DbClosing:
+		d_docs.clear();
+		d_dirty.clear();
+		d_lastId = d_lastDoc = 0;
+		break;
+	case Sdb::UpdateInfo::ObjectErased:
+		// Geloeschte Objekte lassen sich keinem Dokument mehr zuordnen; geloeschte Dokumente
+		// verschwinden beim naechsten refresh
+		if( info.d_id == d_lastId )
+			d_lastId = d_lastDoc = 0;
+		break;
+	case Sdb::UpdateInfo::ValueChanged:
+		if( d_docs.isEmpty() )
+			break; // noch nie gescannt; refresh scannt ohnehin alles
+		if( info.d_id != d_lastId )
+		{
+			// Importe aendern viele Werte desselben Objekts hintereinander
+			const Sdb::Obj o = AppContext::inst()->getTxn()->getObject( info.d_id );
+			d_lastId = info.d_id;
+			switch( o.getType() )
+			{
+			case TypeDocument:
+				d_lastDoc = o.getOid();
+				break;
+			case TypeAnnotation:
+				d_lastDoc = o.getValue( AttrAnnHomeDoc ).getOid();
+				break;
+			default:
+				d_lastDoc = o.getValue( AttrObjHomeDoc ).getOid();
+				break;
+			}
+		}
+		if( d_lastDoc )
+			d_dirty.insert( d_lastDoc );
+		break;
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QMap>
+#include <QSet>
+#include <Sdb/Obj.h>
+#include <Sdb/UpdateInfo.h>
+
+class QProgressDialog;
+
+namespace Ds
+{
+	// Speicherbedarf pro Dokument; Bytes sind aus der serialisierten Form der Werte geschaetzt.
+	// refresh scannt nur neue und seit dem letzten Aufruf veraenderte Dokumente. Nur im GUI-Thread.
+	class Statistics : public QObject
+	{
+		Q_OBJECT
+	public:
+		struct Doc
+		{
+			QString d_name;
+			QMap<quint32,int> d_types; // Objekttyp -> Anzahl
+			QMap<quint32,qint64> d_attrBytes; // Attribut-Atom -> Bytes
+			qint64 d_bytes; // alle Objekte inkl. History und Annotationen
+			qint64 d_imageBytes;
+			qint64 d_indexBytes;
+			int d_objects;
+			int d_history;
+			int d_annotations;
+			int d_indexEntries; // IdxDocId, IdxDocObjId und IdxAnnDocNr
+			Doc():d_bytes(0),d_imageBytes(0),d_indexBytes(0),d_objects(0),d_history(0),
+				d_annotations(0),d_indexEntries(0) {}
+		};
+		typedef QMap<quint64,Doc> Docs; // OID des Dokuments -> Statistik
+
+		static Statistics* inst();
+		static qint64 valueSize( const Stream::DataCell& );
+		static qint64 objectSize( const Sdb::Obj& ); // Werte plus Namen, Slots und Verwaltung
+
+		bool refresh( QProgressDialog* = 0 ); // false bei Abbruch
+		const Docs& getDocs() const { return d_docs; }
+		int getScanned() const { return d_scanned; } // im letzten refresh gescannte Dokumente
+	protected slots:
+		void onDbUpdate( Sdb::UpdateInfo );
+	private:
+		Statistics( QObject* );
+		static void scan( const Sdb::Obj& o, Doc&, QSet<quint64>& visited );
+		Docs d_docs;
+		QSet<quint64> d_dirty;
+		quint64 d_lastId; // onDbUpdate: letztes Objekt und sein Dokument
+		quint64 d_lastDoc;
+		int d_scanned;
+	};
+}
+
+#endif // STATISTICS_H
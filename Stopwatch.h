@@ -0,0 +1,54 @@
+#ifndef STOPWATCH_H
+#define STOPWATCH_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QtGlobal>
+#if QT_VERSION >= 0x040800
+#include <QElapsedTimer>
+#else
+#include <QTime>
+#endif
+
+namespace Ds
+{
+	// QElapsedTimer gibt es erst ab Qt 4.7, nsecsElapsed ab Qt 4.8; die ausgelieferten Builds
+	// verwenden Qt 4.4.3. Dort misst QTime, mit Millisekunden-Aufloesung.
+	class Stopwatch
+	{
+	public:
+		void start() { d_time.start(); }
+		void restart() { d_time.restart(); }
+		qint64 elapsed() const { return d_time.elapsed(); } // ms
+		qint64 nsecsElapsed() const
+		{
+#if QT_VERSION >= 0x040800
+			return d_time.nsecsElapsed();
+#else
+			return qint64( d_time.elapsed() ) * 1000000;
+#endif
+		}
+	private:
+#if QT_VERSION >= 0x040800
+		QElapsedTimer d_time;
+#else
+		QTime d_time;
+#endif
+	};
+}
+
+#endif // STOPWATCH_H
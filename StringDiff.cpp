@@ -53,13 +53,86 @@ public:
 };
 
 
-QVector<StringDiff::Item> StringDiff::Diff(const QString& ArrayA, const QString& ArrayB)
+static inline int _tokenClass( const QChar& c )
+{
+	if( c.isLetterOrNumber() || c == QChar('_') )
+		return 1;
+	if( c.isSpace() )
+		return 2;
+	return 0; // jedes andere Zeichen ist ein eigenes Token
+}
+
+void StringDiff::Tokenize(const QString& str, QHash<QString,uint>& ids, QVector<uint>& data, QVector<int>& pos)
+{
+	data.reserve( str.size() / 4 );
+	pos.reserve( str.size() / 4 );
+	int i = 0;
+	while( i < str.size() )
+	{
+		const int start = i;
+		const int cls = _tokenClass( str[i++] );
+		if( cls != 0 )
+			while( i < str.size() && _tokenClass( str[i] ) == cls )
+				i++;
+		const QString tok = str.mid( start, i - start );
+		QHash<QString,uint>::const_iterator j = ids.find( tok );
+		if( j == ids.end() )
+			j = ids.insert( tok, ids.size() );
+		data.append( j.value() );
+		pos.append( start );
+	}
+	pos.append( str.size() );
+}
+
+QVector<StringDiff::Item> StringDiff::Diff(const QString& ArrayA, const QString& ArrayB, Mode mode, int maxCost)
 {
 	// The A-Version of the data (original data) to be compared.
-	DiffData DataA(ArrayA);
+	DiffData DataA;
 
 	// The B-Version of the data (modified data) to be compared.
-	DiffData DataB(ArrayB);
+	DiffData DataB;
+
+	// Equal elements at start and end are trimmed before the buffers and vectors are allocated.
+	int Prefix = 0;
+	int Suffix = 0;
+	QVector<int> PosA; // Tokens only: character position of each token
+	QVector<int> PosB;
+	if( mode == Tokens )
+	{
+		QHash<QString,uint> ids;
+		QVector<uint> a;
+		QVector<uint> b;
+		Tokenize( ArrayA, ids, a, PosA );
+		Tokenize( ArrayB, ids, b, PosB );
+		while( Prefix < a.size() && Prefix < b.size() && a[Prefix] == b[Prefix] )
+			Prefix++;
+		while( Suffix < a.size() - Prefix && Suffix < b.size() - Prefix && 
+			a[a.size() - 1 - Suffix] == b[b.size() - 1 - Suffix] )
+			Suffix++;
+		DataA.init( a.size() - Prefix - Suffix );
+		for( int i = 0; i < DataA.Length; i++ )
+			DataA.data[i] = a[Prefix + i];
+		DataB.init( b.size() - Prefix - Suffix );
+		for( int i = 0; i < DataB.Length; i++ )
+			DataB.data[i] = b[Prefix + i];
+	}else
+	{
+		const QChar* a = ArrayA.constData();
+		const QChar* b = ArrayB.constData();
+		while( Prefix < ArrayA.size() && Prefix < ArrayB.size() && a[Prefix] == b[Prefix] )
+			Prefix++;
+		while( Suffix < ArrayA.size() - Prefix && Suffix < ArrayB.size() - Prefix && 
+			a[ArrayA.size() - 1 - Suffix] == b[ArrayB.size() - 1 - Suffix] )
+			Suffix++;
+		DataA.init( ArrayA.size() - Prefix - Suffix );
+		for( int i = 0; i < DataA.Length; i++ )
+			DataA.data[i] = a[Prefix + i].unicode();
+		DataB.init( ArrayB.size() - Prefix - Suffix );
+		for( int i = 0; i < DataB.Length; i++ )
+			DataB.data[i] = b[Prefix + i].unicode();
+	}
+	if( DataA.Length == 0 && DataB.Length == 0 )
+		return Items();
 
 	const int MAX = DataA.Length + DataB.Length + 1;
 	/// vector for the (0,0) to (x,y) search
@@ -67,12 +140,30 @@ QVector<StringDiff::Item> StringDiff::Diff(const QString& ArrayA, const QString&
 	/// vector for the (u,v) to (N,M) search
 	QVector<int> UpVector( 2 * MAX + 2 );
 
-	LCS( DataA, 0, DataA.Length, DataB, 0, DataB.Length, DownVector, UpVector );
-	return CreateDiffs( DataA, DataB );
+	LCS( DataA, 0, DataA.Length, DataB, 0, DataB.Length, DownVector, UpVector, maxCost );
+	Items res = CreateDiffs( DataA, DataB );
+
+	// Back to positions in the original strings
+	for( int i = 0; i < res.size(); i++ )
+	{
+		Item& it = res[i];
+		it.StartA += Prefix;
+		it.StartB += Prefix;
+		if( mode == Tokens )
+		{
+			const int endA = PosA[it.StartA + it.deletedA];
+			const int endB = PosB[it.StartB + it.insertedB];
+			it.StartA = PosA[it.StartA];
+			it.StartB = PosB[it.StartB];
+			it.deletedA = endA - it.StartA;
+			it.insertedB = endB - it.StartB;
+		}
+	}
+	return res;
 }
 
 StringDiff::SMSRD StringDiff::SMS(DiffData& DataA, int LowerA, int UpperA, DiffData& DataB, int LowerB, int UpperB,
-								  QVector<int>& DownVector, QVector<int>& UpVector)
+								  QVector<int>& DownVector, QVector<int>& UpVector, int maxCost)
 {
 	SMSRD ret;
 	const int MAX = DataA.Length + DataB.Length + 1;
@@ -89,6 +180,8 @@ StringDiff::SMSRD StringDiff::SMS(DiffData& DataA, int LowerA, int UpperA, DiffD
 	int UpOffset = MAX - UpK;
 
 	int MaxD = ((UpperA - LowerA + UpperB - LowerB) / 2) + 1;
+	if( maxCost > 0 && maxCost < MaxD )
+		MaxD = maxCost;
 
 	// Debug.Write(2, "SMS", String.Format("Search the box: A[{0}-{1}] to B[{2}-{3}]", LowerA, UpperA, LowerB, UpperB));
 
@@ -167,11 +260,17 @@ StringDiff::SMSRD StringDiff::SMS(DiffData& DataA, int LowerA, int UpperA, DiffD
 
 	} // for D
 
+	if( maxCost > 0 )
+	{
+		// cost limit reached, the caller treats the box as changed
+		ret.x = -1;
+		return ret;
+	}
 	throw _MyException("the algorithm should never come here.");
 }
 
 void StringDiff::LCS(DiffData& DataA, int LowerA, int UpperA, DiffData& DataB, int LowerB, int UpperB, 
-					 QVector<int>& DownVector, QVector<int>& UpVector) 
+					 QVector<int>& DownVector, QVector<int>& UpVector, int maxCost) 
 {
 	// Debug.Write(2, "LCS", String.Format("Analyse the box: A[{0}-{1}] to B[{2}-{3}]", LowerA, UpperA, LowerB, UpperB));
 
@@ -197,12 +296,21 @@ void StringDiff::LCS(DiffData& DataA, int LowerA, int UpperA, DiffData& DataB, i
 
 	} else {
 		// Find the middle snakea and length of an optimal path for A and B
-		SMSRD smsrd = SMS(DataA, LowerA, UpperA, DataB, LowerB, UpperB, DownVector, UpVector);
+		SMSRD smsrd = SMS(DataA, LowerA, UpperA, DataB, LowerB, UpperB, DownVector, UpVector, maxCost);
 		// Debug.Write(2, "MiddleSnakeData", String.Format("{0},{1}", smsrd.x, smsrd.y));
 
+		if( smsrd.x < 0 ) {
+			// too expensive; coarse result: the whole box is deleted and inserted
+			while (LowerA < UpperA)
+				DataA.modified[LowerA++] = true;
+			while (LowerB < UpperB)
+				DataB.modified[LowerB++] = true;
+			return;
+		}
+
 		// The path is from LowerX to (x,y) and (x,y) to UpperX
-		LCS(DataA, LowerA, smsrd.x, DataB, LowerB, smsrd.y, DownVector, UpVector);
-		LCS(DataA, smsrd.x, UpperA, DataB, smsrd.y, UpperB, DownVector, UpVector);  // 2002.09.20: no need for 2 points 
+		LCS(DataA, LowerA, smsrd.x, DataB, LowerB, smsrd.y, DownVector, UpVector, maxCost);
+		LCS(DataA, smsrd.x, UpperA, DataB, smsrd.y, UpperB, DownVector, UpVector, maxCost);  // 2002.09.20: no need for 2 points 
 	}
 }
 
@@ -61,15 +61,28 @@ namespace Ds
 		}; 
 		typedef QVector<Item> Items;
 
-
+		/// <summary>Unit of comparison.</summary>
+		enum Mode
+		{
+		  /// <summary>Every character is compared.</summary>
+		  Chars,
+		  /// <summary>Words, whitespace runs and single other characters are compared.</summary>
+		  Tokens
+		};
 
 		/// <summary>
 		/// Find the difference in 2 arrays of integers.
 		/// </summary>
 		/// <param name="ArrayA">A-version of the numbers (usualy the old one)</param>
 		/// <param name="ArrayB">B-version of the numbers (usualy the new one)</param>
+		/// <param name="mode">compare characters or tokens; Items are always in characters</param>
+		/// <param name="maxCost">max. D searched for the middle snake of a box (in characters or tokens).
+		/// The forward and reverse paths each run up to D steps, so a box is only diffed in detail
+		/// while its edit distance is at most about 2 * maxCost; beyond that the whole remaining box
+		/// (not only the part over the limit) is reported as deleted and inserted. The limit applies
+		/// again to each sub-box of the recursion. 0 means no limit.</param>
 		/// <returns>Returns a array of Items that describe the differences.</returns>
-		static QVector<Item> Diff(const QString& ArrayA, const QString& ArrayB);
+		static QVector<Item> Diff(const QString& ArrayA, const QString& ArrayB, Mode mode = Chars, int maxCost = 0);
 	private:
 		/// <summary>
 		/// Shortest Middle Snake Return Data
@@ -88,8 +101,8 @@ namespace Ds
 			/// <summary>Number of elements (lines).</summary>
 			int Length;
 
-			/// <summary>Buffer of numbers that will be compared.</summary>
-			QString data;
+			/// <summary>Buffer of numbers that will be compared (characters or token ids).</summary>
+			QVector<uint> data;
 
 			/// <summary>
 			/// Array of booleans that flag for modified data.
@@ -101,15 +114,25 @@ namespace Ds
 			/// <summary>
 			/// Initialize the Diff-Data buffer.
 			/// </summary>
-			/// <param name="data">reference to the buffer</param>
-			DiffData(const QString& initData) {
-			  data = initData;
-			  Length = initData.size();
+			/// <param name="Len">number of elements, to be filled into data</param>
+			void init(int Len) {
+			  Length = Len;
+			  data.resize( Length );
 			  modified.resize( Length + 2 );
 			} 
 			DiffData():Length(0){}
 		}; 
 
+		/// <summary>
+		/// Split a string into words, whitespace runs and single other characters
+		/// and map each distinct token to a number.
+		/// </summary>
+		/// <param name="str">the string to split</param>
+		/// <param name="ids">token to number, shared by both strings</param>
+		/// <param name="data">receives the token numbers</param>
+		/// <param name="pos">receives the character position of each token plus the string length</param>
+		static void Tokenize(const QString& str, QHash<QString,uint>& ids, QVector<uint>& data, QVector<int>& pos);
+
 		/// <summary>
 		/// This is the algorithm to find the Shortest Middle Snake (SMS).
 		/// </summary>
@@ -121,9 +144,10 @@ namespace Ds
 		/// <param name="UpperB">upper bound of the actual range in DataB (exclusive)</param>
 		/// <param name="DownVector">a vector for the (0,0) to (x,y) search. Passed as a parameter for speed reasons.</param>
 		/// <param name="UpVector">a vector for the (u,v) to (N,M) search. Passed as a parameter for speed reasons.</param>
-		/// <returns>a MiddleSnakeData record containing x,y and u,v</returns>
+		/// <param name="maxCost">max. D to search, i.e. about half the edit distance of the box; 0 means no limit</param>
+		/// <returns>a MiddleSnakeData record containing x,y and u,v; x is -1 if maxCost was exceeded</returns>
 		static SMSRD SMS(DiffData& DataA, int LowerA, int UpperA, DiffData& DataB, int LowerB, int UpperB,
-			QVector<int>& DownVector, QVector<int>& UpVector);
+			QVector<int>& DownVector, QVector<int>& UpVector, int maxCost);
 
 		/// <summary>
 		/// This is the divide-and-conquer implementation of the longes common-subsequence (LCS) 
@@ -139,7 +163,9 @@ namespace Ds
 		/// <param name="UpperB">upper bound of the actual range in DataB (exclusive)</param>
 		/// <param name="DownVector">a vector for the (0,0) to (x,y) search. Passed as a parameter for speed reasons.</param>
 		/// <param name="UpVector">a vector for the (u,v) to (N,M) search. Passed as a parameter for speed reasons.</param>
-		static void LCS(DiffData& DataA, int LowerA, int UpperA, DiffData& DataB, int LowerB, int UpperB, QVector<int>& DownVector, QVector<int>& UpVector);
+		/// <param name="maxCost">see Diff</param>
+		static void LCS(DiffData& DataA, int LowerA, int UpperA, DiffData& DataB, int LowerB, int UpperB, 
+			QVector<int>& DownVector, QVector<int>& UpVector, int maxCost);
 
 		/// <summary>Scan the tables of which lines are inserted and deleted,
 		/// producing an edit script in forward order.  
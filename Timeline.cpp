@@ -0,0 +1,347 @@
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "Timeline.h"
+#include "TypeDefs.h"
+#include "DocManager.h"
+#include "AppContext.h"
+#include "ReadConnection.h"
+#include <Sdb/Transaction.h>
+#include <Sdb/Database.h>
+#include <Sdb/Exceptions.h>
+#include <Sdb/Idx.h>
+#include <QDataStream>
+#include <QDateTime>
+#include <QMap>
+#include <QThread>
+#include <QVariant>
+using namespace Ds;
+
+namespace Ds
+{
+	class TimelineJob : public QThread
+	{
+	public:
+		QString d_path; // eigene Verbindung, siehe ReadConnection
+		QList<quint64> d_versions;
+		Timeline* d_res;
+		QString d_error;
+		volatile bool d_cancel;
+		volatile int d_done; // verglichene Versionen, fuer getProgress
+
+		TimelineJob( QObject* p ):QThread(p),d_res(0),d_cancel(false),d_done(0) {}
+		~TimelineJob() { if( d_res ) delete d_res; }
+	protected:
+		void run();
+	};
+}
+
+static TimelineCache* s_inst = 0;
+static const int s_maxRetries = 3; // Vergleiche, bevor aufgegeben wird
+
+// Schluessel: AttrDocId und OIDs aller Versionen
+
+static QByteArray _key( const Sdb::Obj& doc, const QList<quint64>& versions )
+{
+	QByteArray key = doc.getValue( AttrDocId ).toString().toUtf8();
+	for( int i = 0; i < versions.size(); i++ )
+	{
+		key += ':';
+		key += QByteArray::number( versions[i] );
+	}
+	return key;
+}
+
+static QDateTime _date( const Sdb::Obj& doc )
+{
+	// Baseline-Datum falls vorhanden, sonst Exportdatum
+	QDateTime d = doc.getValue( AttrDocVerDate ).toVariant().toDateTime();
+	if( !d.isValid() )
+		d = doc.getValue( AttrDocExported ).toVariant().toDateTime();
+	return d;
+}
+
+QList<quint64> Timeline::findVersions( const Sdb::Obj& doc )
+{
+	QMap<QPair<QDateTime,quint64>,quint64> sort;
+	Sdb::Idx i( doc.getTxn(), doc.getDb()->findIndex( IndexDefs::IdxDocId ) );
+	if( i.seek( QList<Stream::DataCell>() << doc.getValue( AttrDocId ) ) ) do
+	{
+		Sdb::Obj v = doc.getTxn()->getObject( i.getId() );
+		if( v.getType() == TypeDocument )
+			sort[ qMakePair( _date( v ), v.getOid() ) ] = v.getOid();
+	}while( i.nextKey() );
+	return sort.values();
+}
+
+const char* Timeline::kindName( quint8 k )
+{
+	switch( k )
+	{
+	case Created:
+		return "created";
+	case Modified:
+		return "modified";
+	case Deleted:
+		return "deleted";
+	default:
+		return "";
+	}
+}
+
+const Timeline::Entry* Timeline::find( const Sdb::Obj& obj ) const
+{
+	const Stream::DataCell v = obj.getValue( AttrObjIdent );
+	if( v.isNull() )
+		return 0;
+	QHash<qint32,Entry>::const_iterator i = d_entries.find( v.getInt32() );
+	if( i == d_entries.end() )
+		return 0;
+	return &i.value();
+}
+
+typedef QHash<qint32,QByteArray> _Hashes;
+
+static void _collect( const Sdb::Obj& o, _Hashes& hashes, QHash<qint32,quint64>& oids )
+{
+	// Dieselben Objekte wie DocManager::createHisto; bei Split zaehlt der Body.
+	// getHash rechnet bei alten Dokumenten ohne AttrObjHash; darum nur im TimelineJob.
+	const Stream::DataCell v = o.getValue( AttrObjIdent );
+	if( o.getType() == TypeStub || v.isNull() )
+		return;
+	if( o.getValue( AttrTitleSplit ).isNull() )
+	{
+		hashes[v.getInt32()] = DocManager::getHash( o );
+		oids[v.getInt32()] = o.getOid();
+	}
+	Sdb::Obj sub = o.getFirstObj();
+	if( !sub.isNull() ) do
+	{
+		_collect( sub, hashes, oids );
+	}while( sub.next() );
+}
+
+void Timeline::build( ReadConnection& conn, volatile bool* cancel, volatile int* done )
+{
+	const int n = d_versions.size();
+	_Hashes prev;
+	for( int v = 0; v < n && !*cancel; v++ )
+	{
+		// Jede Version wird genau einmal durchlaufen und nur mit der vorherigen verglichen
+		_Hashes cur;
+		QHash<qint32,quint64> oids;
+		QList<quint64> tops;
+		{
+			ReadConnection::Reader lock( conn );
+			Sdb::Obj o = conn.getObject( d_versions[v] ).getFirstObj();
+			if( !o.isNull() ) do
+			{
+				tops.append( o.getOid() );
+			}while( o.next() );
+		}
+		for( int t = 0; t < tops.size() && !*cancel; t++ )
+		{
+			// Ein Lese-Block pro Objekt der obersten Ebene, damit Schreiber im GUI-Thread nicht warten
+			ReadConnection::Reader lock( conn );
+			_collect( conn.getObject( tops[t] ), cur, oids );
+		}
+		_Hashes::const_iterator i;
+		for( i = cur.begin(); i != cur.end(); ++i )
+		{
+			if( v == 0 )
+				continue;
+			_Hashes::const_iterator j = prev.find( i.key() );
+			if( j == prev.end() )
+			{
+				d_entries[i.key()].d_changes.append( Change( Created, v ) );
+			}else if( j.value() != i.value() )
+			{
+				QMap<quint32,quint64> l;
+				QMap<quint32,quint64> r;
+				QDataStream in1( j.value() );
+				in1 >> l;
+				QDataStream in2( i.value() );
+				in2 >> r;
+				Entry& e = d_entries[i.key()];
+				QMap<quint32,quint64>::const_iterator k;
+				for( k = r.begin(); k != r.end(); ++k )
+					if( l.value( k.key() ) != k.value() )
+						e.d_changes.append( Change( Modified, v, k.key() ) );
+				for( k = l.begin(); k != l.end(); ++k )
+					if( !r.contains( k.key() ) )
+						e.d_changes.append( Change( Modified, v, k.key() ) );
+			}
+		}
+		for( i = prev.begin(); i != prev.end(); ++i )
+		{
+			if( !cur.contains( i.key() ) )
+				d_entries[i.key()].d_changes.append( Change( Deleted, v ) );
+		}
+		QHash<qint32,quint64>::const_iterator k;
+		for( k = oids.begin(); k != oids.end(); ++k )
+		{
+			Entry& e = d_entries[k.key()];
+			if( e.d_oids.isEmpty() )
+				e.d_oids.resize( n );
+			e.d_oids[v] = k.value();
+		}
+		prev = cur;
+		*done = v + 1;
+	}
+	// Nur Objekte mit Aenderungen werden behalten
+	QHash<qint32,Entry>::iterator e = d_entries.begin();
+	while( e != d_entries.end() )
+	{
+		if( e.value().d_changes.isEmpty() )
+			e = d_entries.erase( e );
+		else
+			++e;
+	}
+}
+
+void TimelineJob::run()
+{
+	try
+	{
+		ReadConnection conn( d_path );
+		for( int i = 0; i < s_maxRetries && !d_cancel; i++ )
+		{
+			Timeline* t = new Timeline();
+			t->d_versions = d_versions;
+			t->build( conn, &d_cancel, &d_done );
+			if( !conn.isChanged() )
+			{
+				d_res = t;
+				return;
+			}
+			// Versionen aus verschiedenen Staenden; nochmals von vorne
+			delete t;
+			conn.restart();
+			d_done = 0;
+		}
+		d_error = TimelineCache::tr("the repository was modified while comparing the versions");
+	}catch( const Sdb::DatabaseException& e )
+	{
+		d_error = QString( "%1: %2" ).arg( e.getCodeString() ).arg( e.getMsg() );
+	}
+}
+
+TimelineCache::TimelineCache( QObject* p ):QObject( p )
+{
+	d_cache.setMaxCost( 200000 );
+	AppContext::inst()->getDb()->addObserver( this, SLOT(onDbUpdate( Sdb::UpdateInfo )));
+}
+
+TimelineCache::~TimelineCache()
+{
+	cancelAll();
+	if( s_inst == this )
+		s_inst = 0;
+}
+
+TimelineCache* TimelineCache::inst()
+{
+	if( s_inst == 0 )
+		s_inst = new TimelineCache( AppContext::inst() );
+	return s_inst;
+}
+
+const Timeline* TimelineCache::get( const Sdb::Obj& doc, bool& pending, QString* error )
+{
+	pending = false;
+	if( doc.getType() != TypeDocument )
+		return 0;
+	const QList<quint64> versions = Timeline::findVersions( doc );
+	if( versions.size() < 2 )
+		return 0;
+	const QByteArray key = _key( doc, versions );
+	Timeline* t = d_cache.object( key );
+	if( t != 0 )
+		return t;
+	if( d_errors.contains( key ) )
+	{
+		// Einmal melden; beim naechsten Aufruf wird neu verglichen
+		const QString msg = d_errors.take( key );
+		if( error )
+			*error = msg;
+		return 0;
+	}
+	pending = true;
+	if( d_jobs.contains( key ) )
+		return 0;
+	TimelineJob* job = new TimelineJob( this );
+	job->d_path = doc.getDb()->getFilePath();
+	job->d_versions = versions;
+	connect( job, SIGNAL(finished()), this, SLOT(onJobFinished()) );
+	d_jobs[key] = job;
+	job->start( QThread::LowPriority );
+	return 0;
+}
+
+int TimelineCache::getProgress() const
+{
+	if( d_jobs.isEmpty() )
+		return -1;
+	const TimelineJob* job = d_jobs.begin().value();
+	return job->d_done * 100 / qMax( job->d_versions.size(), 1 );
+}
+
+void TimelineCache::onJobFinished()
+{
+	TimelineJob* job = static_cast<TimelineJob*>( sender() );
+	const QByteArray key = d_jobs.key( job ); // job nicht dereferenzieren, evtl. bereits abgebrochen
+	if( key.isNull() )
+		return;
+	d_jobs.remove( key );
+	if( job->d_res != 0 )
+	{
+		const int cost = job->d_res->d_entries.size() + 1;
+		if( cost <= d_cache.maxCost() )
+			d_cache.insert( key, job->d_res, cost );
+		else
+		{
+			d_errors[key] = tr("too many changes to show a timeline");
+			delete job->d_res;
+		}
+		job->d_res = 0;
+	}else
+		d_errors[key] = job->d_error;
+	job->deleteLater();
+	emit built();
+}
+
+void TimelineCache::cancelAll()
+{
+	QHash<QByteArray,TimelineJob*>::const_iterator i;
+	for( i = d_jobs.begin(); i != d_jobs.end(); ++i )
+		i.value()->d_cancel = true;
+	for( i = d_jobs.begin(); i != d_jobs.end(); ++i )
+	{
+		i.value()->wait();
+		delete i.value();
+	}
+	d_jobs.clear();
+}
+
+void TimelineCache::onDbUpdate( Sdb::UpdateInfo info )
+{
+	if( info.d_kind == Sdb::UpdateInfo::DbClosing )
+	{
+		cancelAll();
+		d_cache.clear();
+		d_errors.clear();
+	}
+}
@@ -0,0 +1,93 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+/*
+* Copyright 2005-2017 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the DoorScope application
+* see <http://doorscope.ch/>).
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QCache>
+#include <QObject>
+#include <Sdb/Obj.h>
+#include <Sdb/UpdateInfo.h>
+
+namespace Ds
+{
+	class ReadConnection;
+	class TimelineJob;
+
+	// Vergleicht alle Versionen eines Dokuments (gleiche AttrDocId, via IdxDocId) in einem Durchgang
+	// anhand AttrObjHash und haelt pro Objekt (AttrObjIdent) nur die Aenderungen. Es werden keine
+	// TypeHistory erzeugt.
+	class Timeline
+	{
+	public:
+		enum Kind { Created = 1, Modified, Deleted };
+		struct Change
+		{
+			quint32 d_attr; // nur bei Modified
+			quint16 d_version; // Index in getVersions()
+			quint8 d_kind;
+			Change( quint8 k = 0, quint16 v = 0, quint32 a = 0 ):d_attr(a),d_version(v),d_kind(k) {}
+		};
+		struct Entry
+		{
+			QVector<quint64> d_oids; // pro Version, 0 wenn nicht vorhanden
+			QList<Change> d_changes; // nach Version sortiert
+		};
+
+		static QList<quint64> findVersions( const Sdb::Obj& doc ); // aelteste zuerst
+		static const char* kindName( quint8 );
+
+		const QList<quint64>& getVersions() const { return d_versions; }
+		const Entry* find( const Sdb::Obj& obj ) const; // 0 wenn unveraendert ueber alle Versionen
+	private:
+		friend class TimelineJob;
+		friend class TimelineCache;
+		Timeline() {}
+		void build( ReadConnection&, volatile bool* cancel, volatile int* done );
+		QList<quint64> d_versions;
+		QHash<qint32,Entry> d_entries;
+	};
+
+	// Baut die Timeline im Hintergrund mit eigener Verbindung (ReadConnection) und haelt sie
+	// pro Dokument-Id und Versionsliste; geleert beim Schliessen der Datenbank.
+	class TimelineCache : public QObject
+	{
+		Q_OBJECT
+	public:
+		static TimelineCache* inst();
+		// 0 wenn nur eine Version vorhanden ist, die Timeline noch gebaut wird (pending) oder der
+		// letzte Versuch fehlschlug (error, wird nur einmal gemeldet)
+		const Timeline* get( const Sdb::Obj& doc, bool& pending, QString* error = 0 );
+		int getProgress() const; // Prozent oder -1, wenn nichts in Arbeit
+	signals:
+		void built(); // Timeline im Cache oder Fehler; get erneut aufrufen
+	protected slots:
+		void onJobFinished();
+		void onDbUpdate( Sdb::UpdateInfo );
+	private:
+		TimelineCache( QObject* );
+		~TimelineCache();
+		void cancelAll();
+		QCache<QByteArray,Timeline> d_cache; // Kosten in Objekten mit Aenderungen
+		QHash<QByteArray,TimelineJob*> d_jobs;
+		QHash<QByteArray,QString> d_errors;
+	};
+}
+
+#endif // TIMELINE_H
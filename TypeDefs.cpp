@@ -18,6 +18,7 @@
 #include <Sdb/Database.h>
 #include <Sdb/Obj.h>
 #include <Stream/DataReader.h>
+#include <Stream/DataWriter.h>
 #include <QHash>
 #include <QtDebug>
 #include "AppContext.h"
@@ -72,6 +73,7 @@ static const _NameMapping s_names[] =
     {AttrDocDiffSource, "DiffSource", 0, 0  },
     {AttrDocAltName, "AltName", 0, 0  },
     {AttrDocIndex, "Index", 0, 0  },
+    {AttrDocFilterStamp, "FilterStamp", 0, 0  },
     {AttrObjIdent, "RelId", "Absolute Number", 0  },
     {AttrObjNumber, "Number", "Object Number", 0  },
     {AttrObjAttrChanged, "AttrChanged", 0, 0  },
@@ -81,6 +83,7 @@ static const _NameMapping s_names[] =
     {AttrObjHomeDoc, "HomeDoc", 0, TypeObject  },
     {AttrObjDeleted, "Deleted", 0, 0  },
     {AttrObjDocId, "DocId", 0, TypeObject  },
+    {AttrObjHash, "Hash", 0, 0  },
 	{TypeTitle, "Heading", 0, 0 },
     {AttrTitleSplit, "TitleSplit", 0, 0  },
 	{TypeSection, "Section", 0, 0 },
@@ -135,6 +138,9 @@ static const _NameMapping s_names[] =
 	{TypeLuaFilter, "Filter", 0, 0  },
 	{AttrScriptName, "Name", 0, TypeLuaScript },
 	{AttrScriptSource, "Source", 0, TypeLuaScript  },
+	{AttrFilterResults, "Results", 0, TypeLuaFilter  },
+	{AttrScriptBin, "Binary", 0, TypeLuaScript  },
+	{AttrScriptBinKey, "BinaryKey", 0, TypeLuaScript  },
 	{ 0, 0, 0, 0 }
 };
 
@@ -157,7 +163,11 @@ void TypeDefs::init( Database& db )
                 s_nameToAtom.insert( qMakePair( quint32(s_names[i].d_type), key ), s_names[i].d_id );
         }
     }
+	initDb( db );
+}
 
+void TypeDefs::initDb( Database& db )
+{
 	Database::Lock lock( &db, true );
 
 	// Root
@@ -344,8 +354,85 @@ const char* TypeDefs::getPrettyName( quint32 atom )
 	return "";
 }
 
-QString TypeDefs::elided( const Stream::DataCell& v, quint32 len )
+static const char* s_packTag = "DsZ1"; // Praefix der komprimierten LOBs
+static const int s_packTagLen = 4;
+static const int s_packMin = 2048; // kleinere Werte lohnen sich nicht
+static bool s_packOn = true;
+
+void TypeDefs::setPacking( bool on )
+{
+	s_packOn = on;
+}
+
+bool TypeDefs::isPackable( quint32 attr )
+{
+	return attr == AttrObjText || attr == AttrPicImage || attr == AttrHistOld || attr == AttrHistNew;
+}
+
+static bool _hasPackTag( const Stream::DataCell& v )
+{
+	return v.isLob() && v.getArr().startsWith( s_packTag );
+}
+
+static bool _unpack( const Stream::DataCell& v, Stream::DataCell& out )
+{
+	// Der Praefix allein reicht nicht; ein LOB des Anwenders kann zufaellig gleich beginnen
+	const QByteArray raw = qUncompress( v.getArr().mid( s_packTagLen ) );
+	if( raw.isEmpty() )
+		return false;
+	Stream::DataReader r( raw );
+	if( r.nextToken() != Stream::DataReader::Slot )
+		return false;
+	out = r.readValue();
+	return !Stream::DataReader::isUseful( r.nextToken() ); // genau ein Wert
+}
+
+bool TypeDefs::isPacked( const Stream::DataCell& v )
+{
+	Stream::DataCell tmp;
+	return _hasPackTag( v ) && _unpack( v, tmp );
+}
+
+Stream::DataCell TypeDefs::pack( const Stream::DataCell& v )
+{
+	// Fremde LOBs mit dem Praefix werden unabhaengig von Groesse und Einstellung verpackt,
+	// damit unpack sie nicht mit einem gepackten Wert verwechselt
+	const bool tagged = _hasPackTag( v );
+	if( tagged && isPacked( v ) )
+		return v; // bereits gepackt, z.B. beim Kopieren in die History
+	if( v.isNull() || ( !s_packOn && !tagged ) )
+		return v;
+	Stream::DataWriter w;
+	w.writeSlot( v );
+	const QByteArray raw = w.getStream();
+	if( raw.size() < s_packMin && !tagged )
+		return v;
+	const QByteArray z = qCompress( raw, 1 ); // schnellste Stufe; BML komprimiert trotzdem gut
+	if( z.size() + s_packTagLen > raw.size() * 9 / 10 && !tagged )
+		return v; // z.B. bereits komprimierte Bilder
+	Stream::DataCell res;
+	res.setLob( QByteArray( s_packTag, s_packTagLen ) + z );
+	return res;
+}
+
+Stream::DataCell TypeDefs::unpack( const Stream::DataCell& v )
+{
+	if( !_hasPackTag( v ) )
+		return v;
+	Stream::DataCell res;
+	if( !_unpack( v, res ) )
+		return v; // kein gepackter Wert, sondern ein LOB mit zufaellig gleichem Anfang
+	return res;
+}
+
+Stream::DataCell TypeDefs::getValue( const Sdb::Obj& o, quint32 attr )
+{
+	return unpack( o.getValue( attr ) );
+}
+
+QString TypeDefs::elided( const Stream::DataCell& c, quint32 len )
 {
+	const Stream::DataCell v = unpack( c );
 	QString res;
 	if( v.isNull() )
 		return "";
@@ -382,9 +469,10 @@ QString TypeDefs::formatDocName( const Sdb::Obj& doc, bool full )
 		return name;
 }
 
-QVariant TypeDefs::prettyValue( const Stream::DataCell& v )
+QVariant TypeDefs::prettyValue( const Stream::DataCell& c )
 {
     // Es wird ein einfacher String ohne Markup erzeugt.
+	const Stream::DataCell v = unpack( c );
 	switch( v.getType() )
 	{
 	case Stream::DataCell::TypeDateTime:
@@ -94,7 +94,8 @@ namespace Ds
 		AttrDocMaxAnnot = DsStart + 99, // UInt32, max. Annotationsnummer
 		AttrDocDiffSource = DsStart + 100, // OID, Referenz auf Dokument, zu dem die Histo erzeugt wurde
 		AttrDocAltName = DsStart + 101, // String oder leer, optionaler Override von AttrDocName
-		AttrDocIndex = DsStart + 102 // BML mit Volltextindex oder Null
+		AttrDocIndex = DsStart + 102, // BML mit Volltextindex oder Null
+		AttrDocFilterStamp = DsStart + 103 // UInt32, erhht bei nderung von Review-Status oder Annotationen
 	};
 
 	enum TypeDef_Object // abstract, inherits ContentObject
@@ -112,7 +113,8 @@ namespace Ds
 		AttrObjText = DsStart + 263,	// String|BML|HTML, Object Heading oder Object Text
 		AttrObjHomeDoc = DsStart + 264,	// OID, Referenz auf Document, welches Obj besitzt
 		AttrObjDeleted = DsStart + 265,	// Bool, ~deleted, optional
-		AttrObjDocId = DsStart + 272	// redundant UniqueId(Home Doc)
+		AttrObjDocId = DsStart + 272,	// redundant UniqueId(Home Doc)
+		AttrObjHash = DsStart + 273	// LOB, berechnet beim Import: QMap<Attribut,Hash> frs Erzeugen der History
 	};
 
 	// NOTE: Doors-Objekte knnen gleichzeitig Titel und Body sein. Das geht hier nicht.
@@ -287,7 +289,13 @@ namespace Ds
 		TypeLuaScript = DsStart + 820,
 		TypeLuaFilter = DsStart + 823,
 		AttrScriptName = DsStart + 821,
-		AttrScriptSource = DsStart + 822
+		AttrScriptSource = DsStart + 822,
+		AttrFilterResults = DsStart + 824, // Lob, letztes Resultat pro Dokument, siehe FilterCache::find
+		// DsStart + 825 und 826 nicht mehr verwendet
+		// Nicht mehr verwendet, Bytecode bleibt im Speicher (LuaBinding::getCode); alte Werte
+		// werden nicht mehr gelesen und von Compactor nicht kopiert
+		AttrScriptBin = DsStart + 827,
+		AttrScriptBinKey = DsStart + 828
 	};
 
 	enum TypeDef_Root
@@ -299,12 +307,25 @@ namespace Ds
 		static const char* historyTypeString[];
 		static const char* historyTypePrettyString[];
 		static void init( Sdb::Database& db );
+		static void initDb( Sdb::Database& db ); // nur Indizes und Atome der Datenbank, ohne die statischen Tabellen
         static quint32 findAtom( const char* name, quint32 type = 0 );
         static quint32 findAtom( Sdb::Database*, const char* name, quint32 type = 0 );
         static const char* getPrettyName( quint32 atom );
 		static QByteArray getPrettyName( quint32 atom, Sdb::Database* ); // alles
         static QByteArray getSimpleName( quint32 atom, Sdb::Database* ); // alles
 		static QString elided( const Stream::DataCell&, quint32 len = 50 );
+		// Grosse Werte (Text, Bild, History) werden komprimiert als LOB gespeichert; der serialisierte
+		// Originalwert samt Typ steckt darin, unpack liefert ihn unveraendert zurueck.
+		// Abweichung vom bisherigen Format: in der Datenbank steht fuer diese Attribute ein LOB statt
+		// des Originaltyps; wer Obj::getValue statt getValue verwendet (auch aeltere DoorScope-Versionen),
+		// sieht den gepackten LOB. Als gepackt gilt ein LOB nur, wenn er mit dem Praefix beginnt und sich
+		// zu genau einem Wert entpacken laesst; fremde LOBs mit dem Praefix verpackt pack immer.
+		static bool isPackable( quint32 attr );
+		static bool isPacked( const Stream::DataCell& );
+		static Stream::DataCell pack( const Stream::DataCell& );
+		static Stream::DataCell unpack( const Stream::DataCell& );
+		static Stream::DataCell getValue( const Sdb::Obj&, quint32 attr ); // Obj::getValue mit unpack
+		static void setPacking( bool on ); // betrifft nur neu geschriebene Werte
 		static QString formatDate( const QDateTime& );
 		static QString extractName( const QString& fullName );
 		static QString formatDocName( const Sdb::Obj& doc, bool full = true );